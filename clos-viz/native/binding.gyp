@@ -0,0 +1,14 @@
+{
+  "targets": [
+    {
+      "target_name": "clos_addon",
+      "sources": ["clos_addon.c", "../../libclos.c"],
+      "include_dirs": ["../.."],
+      "cflags_c": ["-std=c11", "-O2"],
+      "xcode_settings": {
+        "GCC_C_LANGUAGE_STANDARD": "c11",
+        "GCC_OPTIMIZATION_LEVEL": "2"
+      }
+    }
+  ]
+}
@@ -0,0 +1,703 @@
+// clos_addon.c
+//
+// Node-API binding for libclos: a ClosRouter holds one fabric inside the viz server, so an edit
+// costs the solve itself instead of a spawn, temp files for routes/state/locks, a state JSON file
+// and stdout scraping.
+//
+//   const router = new ClosRouter({ size: 10, strictStability: false, incremental: false })
+//   router.loadPreviousState(json)          stability anchor from a state JSON string
+//   router.anchor()                         anchor on the fabric as it is now
+//   router.setLocks([{ input, egressBlock, spine }])
+//   router.applyRoute(input, [outputs])     -> bool, solved on the calling thread
+//   router.clear(input)                     -> bool
+//   await router.run(commands, onProgress)  -> { failed, log }, solved on a worker thread;
+//                                              onProgress gets each PROGRESS report as an object
+//   router.whatIf(input, [outputs])         -> reroutes, or null if the route does not fit
+//   router.snapshot()                       -> counters plus Int32Arrays backed by the C snapshot
+//   router.stateJson()                      -> the state JSON the CLI writes with --json
+//   router.report() / router.takeLog()      -> fabric report into the log / log since last take
+//   router.close()
+//
+// A router is not reentrant: every method throws while a run() is in flight.
+//
+// Build: npm run build:native (node-gyp, see binding.gyp)
+
+#define _POSIX_C_SOURCE 200809L  // open_memstream under -std=c11
+#define NAPI_VERSION 8
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <node_api.h>
+
+#include "libclos.h"
+
+_Static_assert(sizeof(int) == 4, "snapshot arrays are exposed as Int32Array");
+
+#define PROGRESS_QUEUE_MAX 16  // reports waiting for the main thread; later ones are dropped
+
+typedef struct {
+  clos_ctx *clos;                     // NULL once closed
+  FILE *log;                          // open_memstream: solver log since the last takeLog()
+  char *log_buf;
+  size_t log_len;
+  bool busy;                          // a run() owns the context
+  napi_threadsafe_function progress;  // the running run()'s onProgress, NULL otherwise
+} Router;
+
+typedef struct {
+  Router *router;
+  napi_ref self;                      // keeps the JS object (and the context) alive during the run
+  napi_deferred deferred;
+  napi_async_work work;
+  char **commands;
+  int count;
+  int failed;
+} RunJob;
+
+// A snapshot is freed once every typed array over it has been collected
+typedef struct {
+  clos_snapshot *snap;
+  int refs;
+} SnapshotHold;
+
+// --- ERRORS -----------------------------------------------------------------
+
+static void throw_last_error(napi_env env) {
+  bool pending = false;
+  napi_is_exception_pending(env, &pending);
+  if (pending) return;
+
+  const napi_extended_error_info *info = NULL;
+  napi_get_last_error_info(env, &info);
+  napi_throw_error(env, NULL, info && info->error_message ? info->error_message : "Node-API call failed");
+}
+
+#define NAPI_CALL(env, call)  \
+  do {                        \
+    if ((call) != napi_ok) {  \
+      throw_last_error(env);  \
+      return NULL;            \
+    }                         \
+  } while (0)
+
+// --- LOG --------------------------------------------------------------------
+
+static bool ensure_log(Router *router) {
+  if (router->log) return true;
+  router->log = open_memstream(&router->log_buf, &router->log_len);
+  if (!router->log) return false;
+  if (router->clos) clos_set_log(router->clos, router->log);
+  return true;
+}
+
+static void close_log(Router *router) {
+  if (!router->log) return;
+  if (router->clos) clos_set_log(router->clos, NULL);
+  fclose(router->log);
+  free(router->log_buf);
+  router->log = NULL;
+  router->log_buf = NULL;
+  router->log_len = 0;
+}
+
+static napi_value take_log(napi_env env, Router *router) {
+  napi_value text;
+  if (!router->log) {
+    NAPI_CALL(env, napi_create_string_utf8(env, "", 0, &text));
+    return text;
+  }
+
+  fflush(router->log);
+  napi_status status = napi_create_string_utf8(env, router->log_buf, router->log_len, &text);
+  close_log(router);
+  NAPI_CALL(env, status);
+  return text;
+}
+
+// --- ARGUMENTS --------------------------------------------------------------
+
+// The Router behind `this`, or NULL with an exception pending (closed, busy, or not a ClosRouter)
+static Router *get_router(napi_env env, napi_callback_info info, size_t *argc, napi_value *argv) {
+  napi_value self;
+  void *data = NULL;
+  if (napi_get_cb_info(env, info, argc, argv, &self, NULL) != napi_ok || napi_unwrap(env, self, &data) != napi_ok) {
+    throw_last_error(env);
+    return NULL;
+  }
+
+  Router *router = data;
+  if (!router->clos) {
+    napi_throw_error(env, NULL, "ClosRouter is closed");
+    return NULL;
+  }
+  if (router->busy) {
+    napi_throw_error(env, NULL, "ClosRouter is busy (run() in progress)");
+    return NULL;
+  }
+  if (!ensure_log(router)) {
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  return router;
+}
+
+static bool get_int(napi_env env, napi_value value, const char *what, int *out) {
+  napi_valuetype type;
+  if (napi_typeof(env, value, &type) != napi_ok || type != napi_number) {
+    napi_throw_type_error(env, NULL, what);
+    return false;
+  }
+  return napi_get_value_int32(env, value, out) == napi_ok;
+}
+
+// Array of integers as a malloc'd int[] (NULL with an exception pending on error)
+static int *get_int_array(napi_env env, napi_value value, const char *what, int *count) {
+  bool is_array = false;
+  uint32_t len = 0;
+  if (napi_is_array(env, value, &is_array) != napi_ok || !is_array ||
+      napi_get_array_length(env, value, &len) != napi_ok) {
+    napi_throw_type_error(env, NULL, what);
+    return NULL;
+  }
+
+  int *out = malloc(sizeof(int) * (len > 0 ? len : 1));
+  if (!out) {
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    napi_value item;
+    if (napi_get_element(env, value, i, &item) != napi_ok || !get_int(env, item, what, &out[i])) {
+      free(out);
+      return NULL;
+    }
+  }
+  *count = (int)len;
+  return out;
+}
+
+// Optional option properties: absent or undefined keeps the default
+static bool get_option(napi_env env, napi_value options, const char *key, napi_value *value) {
+  bool has = false;
+  if (napi_has_named_property(env, options, key, &has) != napi_ok || !has) return false;
+  if (napi_get_named_property(env, options, key, value) != napi_ok) return false;
+  napi_valuetype type;
+  return napi_typeof(env, *value, &type) == napi_ok && type != napi_undefined;
+}
+
+static void option_int(napi_env env, napi_value options, const char *key, int *out) {
+  napi_value value;
+  if (get_option(env, options, key, &value)) napi_get_value_int32(env, value, out);
+}
+
+static void option_bool(napi_env env, napi_value options, const char *key, bool *out) {
+  napi_value value;
+  if (get_option(env, options, key, &value)) napi_get_value_bool(env, value, out);
+}
+
+static bool set_int(napi_env env, napi_value obj, const char *key, long long value) {
+  napi_value v;
+  return napi_create_int64(env, (int64_t)value, &v) == napi_ok && napi_set_named_property(env, obj, key, v) == napi_ok;
+}
+
+static napi_value make_bool(napi_env env, bool value) {
+  napi_value v;
+  NAPI_CALL(env, napi_get_boolean(env, value, &v));
+  return v;
+}
+
+// --- LIFECYCLE --------------------------------------------------------------
+
+static void on_progress(void *user, const clos_progress *progress) {
+  Router *router = user;
+  if (!router->progress) return;  // synchronous calls report nothing
+
+  clos_progress *copy = malloc(sizeof(clos_progress));
+  if (!copy) return;
+  *copy = *progress;
+  if (napi_call_threadsafe_function(router->progress, copy, napi_tsfn_nonblocking) != napi_ok) free(copy);
+}
+
+static void router_finalize(napi_env env, void *data, void *hint) {
+  (void)env;
+  (void)hint;
+  Router *router = data;
+  close_log(router);
+  clos_free(router->clos);
+  free(router);
+}
+
+// new ClosRouter({ size, strictStability, maxReroutes, outputWeighted, minBranches, defragReroutes,
+//                  branchBudget, search: "dfs" | "lds" | "sat", lnsBudgetMs, learn, incremental,
+//                  paranoid, solutionCacheSize })
+static napi_value router_new(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  napi_value self;
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, &self, NULL));
+
+  clos_options opts;
+  clos_options_init(&opts);
+  napi_valuetype type = napi_undefined;
+  if (argc >= 1) NAPI_CALL(env, napi_typeof(env, argv[0], &type));
+  if (type == napi_object) {
+    napi_value options = argv[0];
+    int branch_budget = (int)opts.branch_budget;
+    option_int(env, options, "size", &opts.size);
+    option_bool(env, options, "strictStability", &opts.strict_stability);
+    option_int(env, options, "maxReroutes", &opts.max_reroutes);
+    option_bool(env, options, "outputWeighted", &opts.output_weighted);
+    option_bool(env, options, "minBranches", &opts.min_branches);
+    option_int(env, options, "defragReroutes", &opts.defrag_reroutes);
+    option_int(env, options, "branchBudget", &branch_budget);
+    option_int(env, options, "lnsBudgetMs", &opts.lns_budget_ms);
+    option_bool(env, options, "learn", &opts.learn);
+    option_bool(env, options, "incremental", &opts.incremental);
+    option_bool(env, options, "paranoid", &opts.paranoid);
+    option_int(env, options, "solutionCacheSize", &opts.solution_cache_size);
+    opts.branch_budget = branch_budget;
+
+    napi_value search;
+    if (get_option(env, options, "search", &search)) {
+      char engine[8] = "";
+      size_t len = 0;
+      napi_get_value_string_utf8(env, search, engine, sizeof(engine), &len);
+      if (strcmp(engine, "dfs") == 0) {
+        opts.search = CLOS_SEARCH_DFS;
+      } else if (strcmp(engine, "lds") == 0) {
+        opts.search = CLOS_SEARCH_LDS;
+      } else if (strcmp(engine, "sat") == 0) {
+        opts.search = CLOS_SEARCH_SAT;
+      } else {
+        napi_throw_range_error(env, NULL, "search must be \"dfs\", \"lds\" or \"sat\"");
+        return NULL;
+      }
+    }
+  }
+  if (opts.size < 2) {
+    napi_throw_range_error(env, NULL, "size must be at least 2");
+    return NULL;
+  }
+
+  Router *router = calloc(1, sizeof(Router));
+  if (!router || !ensure_log(router)) {
+    free(router);
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  opts.out = router->log;
+  opts.progress = on_progress;
+  opts.progress_user = router;
+  router->clos = clos_create(&opts);
+  if (!router->clos) {
+    router_finalize(env, router, NULL);
+    napi_throw_error(env, NULL, "Failed to allocate the fabric");
+    return NULL;
+  }
+
+  if (napi_wrap(env, self, router, router_finalize, NULL, NULL) != napi_ok) {
+    router_finalize(env, router, NULL);
+    throw_last_error(env);
+    return NULL;
+  }
+  return self;
+}
+
+static napi_value router_close(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Router *router = get_router(env, info, &argc, NULL);
+  if (!router) return NULL;
+  close_log(router);
+  clos_free(router->clos);
+  router->clos = NULL;
+  return NULL;
+}
+
+// --- STATE ------------------------------------------------------------------
+
+static napi_value router_load_previous_state(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Router *router = get_router(env, info, &argc, argv);
+  if (!router) return NULL;
+
+  size_t len = 0;
+  if (argc < 1 || napi_get_value_string_utf8(env, argv[0], NULL, 0, &len) != napi_ok) {
+    napi_throw_type_error(env, NULL, "loadPreviousState(json) expects a string");
+    return NULL;
+  }
+  char *json = malloc(len + 1);
+  if (!json) {
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  napi_get_value_string_utf8(env, argv[0], json, len + 1, &len);
+  bool ok = clos_load_previous_state_json(router->clos, json);
+  free(json);
+  return make_bool(env, ok);
+}
+
+static napi_value router_anchor(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Router *router = get_router(env, info, &argc, NULL);
+  if (!router) return NULL;
+  clos_anchor_previous_state(router->clos);
+  return NULL;
+}
+
+// setLocks([{ input, egressBlock | egress, spine }]), all 0-based except input
+static napi_value router_set_locks(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Router *router = get_router(env, info, &argc, argv);
+  if (!router) return NULL;
+
+  bool is_array = false;
+  uint32_t len = 0;
+  if (argc < 1 || napi_is_array(env, argv[0], &is_array) != napi_ok || !is_array ||
+      napi_get_array_length(env, argv[0], &len) != napi_ok) {
+    napi_throw_type_error(env, NULL, "setLocks(locks) expects an array");
+    return NULL;
+  }
+
+  clos_lock *locks = malloc(sizeof(clos_lock) * (len > 0 ? len : 1));
+  if (!locks) {
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    napi_value item, value;
+    clos_lock lock = { .input_id = -1, .egress_block = -1, .spine = -1 };
+    if (napi_get_element(env, argv[0], i, &item) == napi_ok) {
+      if (get_option(env, item, "input", &value)) napi_get_value_int32(env, value, &lock.input_id);
+      if (get_option(env, item, "egressBlock", &value) || get_option(env, item, "egress", &value)) {
+        napi_get_value_int32(env, value, &lock.egress_block);
+      }
+      if (get_option(env, item, "spine", &value)) napi_get_value_int32(env, value, &lock.spine);
+    }
+    locks[i] = lock;  // malformed entries surface as RANGE lock conflicts
+  }
+
+  bool ok = clos_set_locks(router->clos, locks, (int)len);
+  free(locks);
+  return make_bool(env, ok);
+}
+
+// --- COMMANDS ---------------------------------------------------------------
+
+static napi_value router_apply_route(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  Router *router = get_router(env, info, &argc, argv);
+  if (!router) return NULL;
+
+  int input_id = 0;
+  int count = 0;
+  if (argc < 2 || !get_int(env, argv[0], "applyRoute(input, outputs) expects a number", &input_id)) return NULL;
+  int *outputs = get_int_array(env, argv[1], "applyRoute(input, outputs) expects an array of ports", &count);
+  if (!outputs) return NULL;
+
+  bool ok = clos_apply_route(router->clos, input_id, outputs, count);
+  free(outputs);
+  return make_bool(env, ok);
+}
+
+static napi_value router_clear(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Router *router = get_router(env, info, &argc, argv);
+  if (!router) return NULL;
+
+  int input_id = 0;
+  if (argc < 1 || !get_int(env, argv[0], "clear(input) expects a number", &input_id)) return NULL;
+  return make_bool(env, clos_apply_clear(router->clos, input_id));
+}
+
+static napi_value router_what_if(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  Router *router = get_router(env, info, &argc, argv);
+  if (!router) return NULL;
+
+  int input_id = 0;
+  int count = 0;
+  if (argc < 2 || !get_int(env, argv[0], "whatIf(input, outputs) expects a number", &input_id)) return NULL;
+  int *outputs = get_int_array(env, argv[1], "whatIf(input, outputs) expects an array of ports", &count);
+  if (!outputs) return NULL;
+
+  int reroutes = clos_what_if_route(router->clos, input_id, outputs, count);
+  free(outputs);
+
+  napi_value result;
+  if (reroutes < 0) {
+    NAPI_CALL(env, napi_get_null(env, &result));
+  } else {
+    NAPI_CALL(env, napi_create_int32(env, reroutes, &result));
+  }
+  return result;
+}
+
+// --- ASYNC RUN --------------------------------------------------------------
+
+static void free_run_job(napi_env env, RunJob *job) {
+  for (int i = 0; i < job->count; i++) free(job->commands[i]);
+  free(job->commands);
+  if (job->self) napi_delete_reference(env, job->self);
+  if (job->work) napi_delete_async_work(env, job->work);
+  free(job);
+}
+
+// Main thread: hands one PROGRESS report to onProgress
+static void call_progress(napi_env env, napi_value callback, void *context, void *data) {
+  (void)context;
+  clos_progress *progress = data;
+  if (env && callback) {
+    napi_value obj, undefined;
+    if (napi_create_object(env, &obj) == napi_ok && napi_get_undefined(env, &undefined) == napi_ok &&
+        set_int(env, obj, "attempts", progress->attempts) && set_int(env, obj, "elapsedMs", progress->elapsed_ms) &&
+        set_int(env, obj, "depth", progress->depth) && set_int(env, obj, "numDemands", progress->num_demands) &&
+        set_int(env, obj, "bestCost", progress->best_cost)) {
+      napi_call_function(env, undefined, callback, 1, &obj, NULL);
+    }
+  }
+  free(progress);
+}
+
+// Worker thread: no Node-API calls here
+static void run_execute(napi_env env, void *data) {
+  (void)env;
+  RunJob *job = data;
+  for (int i = 0; i < job->count; i++) {
+    if (!clos_apply_command(job->router->clos, job->commands[i])) job->failed++;
+  }
+}
+
+static void run_complete(napi_env env, napi_status status, void *data) {
+  RunJob *job = data;
+  Router *router = job->router;
+  router->busy = false;
+  if (router->progress) {
+    napi_release_threadsafe_function(router->progress, napi_tsfn_release);
+    router->progress = NULL;
+  }
+
+  napi_value result = NULL;
+  if (status == napi_ok && napi_create_object(env, &result) == napi_ok && set_int(env, result, "failed", job->failed)) {
+    napi_value log = take_log(env, router);
+    if (!log || napi_set_named_property(env, result, "log", log) != napi_ok) result = NULL;
+  }
+
+  if (result) {
+    napi_resolve_deferred(env, job->deferred, result);
+  } else {
+    napi_value message, error;
+    napi_create_string_utf8(env, "ClosRouter run failed", NAPI_AUTO_LENGTH, &message);
+    napi_create_error(env, NULL, message, &error);
+    napi_reject_deferred(env, job->deferred, error);
+  }
+  free_run_job(env, job);
+}
+
+// run(commands, onProgress?): routes-file lines (route, clear, batches) solved in order on a
+// worker thread. Resolves to { failed, log }.
+static napi_value router_run(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  napi_value self;
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, &self, NULL));
+  Router *router = get_router(env, info, &argc, argv);
+  if (!router) return NULL;
+
+  bool is_array = false;
+  uint32_t len = 0;
+  if (argc < 1 || napi_is_array(env, argv[0], &is_array) != napi_ok || !is_array ||
+      napi_get_array_length(env, argv[0], &len) != napi_ok) {
+    napi_throw_type_error(env, NULL, "run(commands) expects an array of strings");
+    return NULL;
+  }
+
+  RunJob *job = calloc(1, sizeof(RunJob));
+  if (!job || !(job->commands = calloc(len > 0 ? len : 1, sizeof(char *)))) {
+    free(job);
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  job->router = router;
+  for (uint32_t i = 0; i < len; i++) {
+    napi_value item;
+    size_t size = 0;
+    if (napi_get_element(env, argv[0], i, &item) != napi_ok ||
+        napi_get_value_string_utf8(env, item, NULL, 0, &size) != napi_ok ||
+        !(job->commands[i] = malloc(size + 1))) {
+      free_run_job(env, job);
+      napi_throw_type_error(env, NULL, "run(commands) expects an array of strings");
+      return NULL;
+    }
+    job->count++;
+    napi_get_value_string_utf8(env, item, job->commands[i], size + 1, &size);
+  }
+
+  napi_valuetype callback_type = napi_undefined;
+  if (argc >= 2) napi_typeof(env, argv[1], &callback_type);
+
+  napi_value promise, name;
+  if (napi_create_promise(env, &job->deferred, &promise) != napi_ok ||
+      napi_create_reference(env, self, 1, &job->self) != napi_ok ||
+      napi_create_string_utf8(env, "ClosRouter.run", NAPI_AUTO_LENGTH, &name) != napi_ok ||
+      napi_create_async_work(env, NULL, name, run_execute, run_complete, job, &job->work) != napi_ok) {
+    throw_last_error(env);
+    free_run_job(env, job);  // an unsettled deferred is simply dropped
+    return NULL;
+  }
+  if (callback_type == napi_function &&
+      napi_create_threadsafe_function(env, argv[1], NULL, name, PROGRESS_QUEUE_MAX, 1, NULL, NULL, NULL,
+                                      call_progress, &router->progress) != napi_ok) {
+    throw_last_error(env);
+    free_run_job(env, job);
+    return NULL;
+  }
+  if (napi_queue_async_work(env, job->work) != napi_ok) {
+    throw_last_error(env);
+    if (router->progress) napi_release_threadsafe_function(router->progress, napi_tsfn_release);
+    router->progress = NULL;
+    free_run_job(env, job);
+    return NULL;
+  }
+
+  router->busy = true;
+  return promise;
+}
+
+// --- RESULTS ----------------------------------------------------------------
+
+static void release_snapshot(napi_env env, void *data, void *hint) {
+  (void)env;
+  (void)data;
+  SnapshotHold *hold = hint;
+  if (--hold->refs == 0) {
+    clos_snapshot_free(hold->snap);
+    free(hold);
+  }
+}
+
+// Int32Array over a snapshot array without copying it (a copy where external buffers are refused)
+static bool set_int32_view(napi_env env, napi_value obj, const char *key, SnapshotHold *hold, int *data, size_t count) {
+  napi_value buffer, array;
+  hold->refs++;
+  if (napi_create_external_arraybuffer(env, data, sizeof(int) * count, release_snapshot, hold, &buffer) != napi_ok) {
+    hold->refs--;
+    void *copy = NULL;
+    if (napi_create_arraybuffer(env, sizeof(int) * count, &copy, &buffer) != napi_ok) return false;
+    memcpy(copy, data, sizeof(int) * count);
+  }
+  return napi_create_typedarray(env, napi_int32_array, count, buffer, 0, &array) == napi_ok &&
+         napi_set_named_property(env, obj, key, array) == napi_ok;
+}
+
+// Port arrays have ports + 1 entries ([0] unused); trunk arrays are size x size, row-major
+static napi_value router_snapshot(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Router *router = get_router(env, info, &argc, NULL);
+  if (!router) return NULL;
+
+  SnapshotHold *hold = malloc(sizeof(SnapshotHold));
+  clos_snapshot *snap = hold ? clos_snapshot_take(router->clos) : NULL;
+  if (!snap) {
+    free(hold);
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  hold->snap = snap;
+  hold->refs = 1;  // released below, after the arrays took theirs
+
+  size_t ports = (size_t)snap->ports + 1;
+  size_t trunks = (size_t)snap->size * (size_t)snap->size;
+  napi_value obj = NULL;
+  bool ok = napi_create_object(env, &obj) == napi_ok &&
+            set_int(env, obj, "size", snap->size) &&
+            set_int(env, obj, "ports", snap->ports) &&
+            set_int32_view(env, obj, "desiredOwner", hold, snap->desired_owner, ports) &&
+            set_int32_view(env, obj, "s3PortOwner", hold, snap->s3_port_owner, ports) &&
+            set_int32_view(env, obj, "s3PortSpine", hold, snap->s3_port_spine, ports) &&
+            set_int32_view(env, obj, "s1ToS2", hold, snap->s1_to_s2, trunks) &&
+            set_int32_view(env, obj, "s2ToS3", hold, snap->s2_to_s3, trunks) &&
+            set_int(env, obj, "repacks", snap->repacks) &&
+            set_int(env, obj, "failedCommands", snap->failed_commands) &&
+            set_int(env, obj, "lastReroutes", snap->last_reroutes) &&
+            set_int(env, obj, "cumulativeReroutes", snap->cumulative_reroutes) &&
+            set_int(env, obj, "cumulativeOutputReroutes", snap->cumulative_output_reroutes) &&
+            set_int(env, obj, "lastSolveUs", snap->last_solve_us) &&
+            set_int(env, obj, "totalSolveUs", snap->total_solve_us);
+  release_snapshot(env, NULL, hold);
+  if (!ok) {
+    throw_last_error(env);
+    return NULL;
+  }
+  return obj;
+}
+
+static napi_value router_state_json(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Router *router = get_router(env, info, &argc, NULL);
+  if (!router) return NULL;
+
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&buf, &len);
+  if (!f) {
+    napi_throw_error(env, NULL, "Out of memory");
+    return NULL;
+  }
+  clos_write_json_stream(router->clos, f);
+  fclose(f);
+
+  napi_value json;
+  napi_status status = napi_create_string_utf8(env, buf, len, &json);
+  free(buf);
+  NAPI_CALL(env, status);
+  return json;
+}
+
+static napi_value router_report(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Router *router = get_router(env, info, &argc, NULL);
+  if (!router) return NULL;
+  clos_print_report(router->clos);
+  return NULL;
+}
+
+static napi_value router_take_log(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Router *router = get_router(env, info, &argc, NULL);
+  if (!router) return NULL;
+  return take_log(env, router);
+}
+
+// --- MODULE -----------------------------------------------------------------
+
+static napi_value init(napi_env env, napi_value exports) {
+  napi_property_descriptor methods[] = {
+    { "loadPreviousState", NULL, router_load_previous_state, NULL, NULL, NULL, napi_default, NULL },
+    { "anchor", NULL, router_anchor, NULL, NULL, NULL, napi_default, NULL },
+    { "setLocks", NULL, router_set_locks, NULL, NULL, NULL, napi_default, NULL },
+    { "applyRoute", NULL, router_apply_route, NULL, NULL, NULL, napi_default, NULL },
+    { "clear", NULL, router_clear, NULL, NULL, NULL, napi_default, NULL },
+    { "whatIf", NULL, router_what_if, NULL, NULL, NULL, napi_default, NULL },
+    { "run", NULL, router_run, NULL, NULL, NULL, napi_default, NULL },
+    { "snapshot", NULL, router_snapshot, NULL, NULL, NULL, napi_default, NULL },
+    { "stateJson", NULL, router_state_json, NULL, NULL, NULL, napi_default, NULL },
+    { "report", NULL, router_report, NULL, NULL, NULL, napi_default, NULL },
+    { "takeLog", NULL, router_take_log, NULL, NULL, NULL, napi_default, NULL },
+    { "close", NULL, router_close, NULL, NULL, NULL, napi_default, NULL },
+  };
+
+  napi_value cls;
+  NAPI_CALL(env, napi_define_class(env, "ClosRouter", NAPI_AUTO_LENGTH, router_new, NULL,
+                                   sizeof(methods) / sizeof(methods[0]), methods, &cls));
+  NAPI_CALL(env, napi_set_named_property(env, exports, "ClosRouter", cls));
+  return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)
@@ -4,6 +4,7 @@ import express from "express"
 import cors from "cors"
 import multer from "multer"
 import { spawn } from "child_process"
+import { createRequire } from "module"
 import fs from "fs"
 import path from "path"
 import { fileURLToPath } from "url"
@@ -24,7 +25,9 @@ const PORT = Number.isFinite(parsedPort) ? parsedPort : 4121
 
 const ROUTES_DIR = path.join(__dirname, "public", "routes")
 const STATES_DIR = path.join(__dirname, "public", "states")
+const SCENES_DIR = path.join(__dirname, "public", "scenes")
 const ROUTER_PATH = path.join(__dirname, "..", "clos_mult_router")
+const PREFIX_CACHE_PATH = path.join(__dirname, ".prefix_cache.txt")
 const PP128_SOLVER_PATH = path.resolve(process.env.HOME, "projects", "pp128-fw", "comparison", "pp128_solver")
 const CLOS_V2_SOLVER_PATH = path.resolve(process.env.HOME, "projects", "pp_clos_solver_v2", "bin", "clos_solver")
 
@@ -38,6 +41,45 @@ let currentSize = 10
 let activeRun = null
 let runCounter = 0
 
+// Commands of the run that produced lastState. The next run sends them again followed by the edit,
+// so the router's prefix cache (--prefix-cache) restores lastState and solves only the edit. The
+// list is rebuilt from scratch once it grows past PREFIX_COMPACT_FACTOR times the route count.
+const PREFIX_COMPACT_FACTOR = 2
+let lastCommands = null  // { state, routes, commands }
+
+// In-process router (native/clos_addon.c, built with `npm run build:native`): route edits on the
+// clos solver run in a ClosRouter that still holds lastState, so an edit sends only the changed
+// inputs and costs no spawn, temp files or state file. Without the addon, or with CLOS_NATIVE=0,
+// every run spawns ROUTER_PATH.
+const NATIVE_ADDON_PATH = path.join(__dirname, "native", "build", "Release", "clos_addon.node")
+let ClosRouter = null
+if (process.env.CLOS_NATIVE !== "0" && fs.existsSync(NATIVE_ADDON_PATH)) {
+  try {
+    ClosRouter = createRequire(import.meta.url)(NATIVE_ADDON_PATH).ClosRouter
+  } catch (err) {
+    console.error("Failed to load the native router, spawning it instead:", err.message)
+  }
+}
+let nativeRouter = null  // { router, key, state, routes, commands, busy }: holds `state` while state === lastState
+
+// Idle-time defragmentation (opt-in): once no request has arrived for DEFRAG_IDLE_MS, the current
+// routes are re-solved with --defrag so the router may spend up to DEFRAG_REROUTES reroutes on
+// fewer branches. Any request pre-empts it, and a result is dropped if the state moved meanwhile.
+const DEFRAG_IDLE_MS = parseInt(process.env.CLOS_DEFRAG_IDLE_MS || "0", 10) || 0
+const DEFRAG_REROUTES = parseInt(process.env.CLOS_DEFRAG_REROUTES || "2", 10) || 0
+let defragTimer = null
+let defragChild = null
+let stateGeneration = 0
+let lastMaintenance = null
+
+// Scenes: stored configurations (desired_owner + s3_port_spine). With SCENE_PRECOMPUTE_IDLE_MS set
+// (opt-in, like idle defrag), once the state has been idle that long the transition from it to every
+// saved scene is solved in the background (router --scene), so a recall just swaps in the result.
+const SCENE_PRECOMPUTE_IDLE_MS = parseInt(process.env.CLOS_SCENE_PRECOMPUTE_MS || "0", 10) || 0
+const sceneTransitions = new Map()  // scene file -> { from, state }: the result of recalling it from `from`
+let scenePrecomputeTimer = null
+let scenePrecomputeChild = null
+
 const progressRegex = /PROGRESS:\s+(\d+)\s+attempts in\s+(\d+)s\s+\(depth=(\d+)\/(\d+),\s+best_cost=([-\d]+)\)/
 
 function beginRun(child, tmpFiles = []) {
@@ -118,6 +160,309 @@ function buildRunSummary(run) {
   }
 }
 
+function routeLinesFromState(state) {
+  const outputsByInput = new Map()
+  const owners = state.desired_owner || []
+  for (let port = 1; port < owners.length; port++) {
+    const inputId = owners[port]
+    if (!inputId) continue
+    if (!outputsByInput.has(inputId)) outputsByInput.set(inputId, [])
+    outputsByInput.get(inputId).push(port)
+  }
+  return [...outputsByInput.entries()].map(([inputId, outputs]) => `${inputId}.${outputs.join(".")}`)
+}
+
+function routeLinesFromRoutes(routes) {
+  const lines = []
+  for (const [inputId, outputs] of Object.entries(routes)) {
+    if (Array.isArray(outputs) && outputs.length > 0) {
+      lines.push(`${inputId}.${outputs.join(".")}`)
+    }
+  }
+  return lines
+}
+
+function stateMatchesRoutes(state, routes) {
+  const owners = state.desired_owner || []
+  let routed = 0
+  for (const [inputId, outputs] of Object.entries(routes)) {
+    if (!Array.isArray(outputs)) continue
+    for (const port of outputs) {
+      if (owners[port] !== Number(inputId)) return false
+      routed++
+    }
+  }
+  return owners.filter((owner) => owner > 0).length === routed
+}
+
+// Commands that take the routes `before` to `routes`: clears first (an output may move between
+// inputs), then a route line for every input whose outputs changed. A route line only adds
+// outputs, so an input that lost any is cleared before it is routed again.
+function routeEdits(before, routes) {
+  const clears = []
+  const changed = []
+  for (const inputId of new Set([...Object.keys(before), ...Object.keys(routes)])) {
+    const oldOutputs = Array.isArray(before[inputId]) ? before[inputId] : []
+    const newOutputs = Array.isArray(routes[inputId]) ? routes[inputId] : []
+    const kept = new Set(newOutputs)
+    const same = oldOutputs.length === newOutputs.length && oldOutputs.every((port) => kept.has(port))
+    if (same) continue
+    if (!oldOutputs.every((port) => kept.has(port))) clears.push(`!${inputId}`)
+    if (newOutputs.length > 0) changed.push(`${inputId}.${newOutputs.join(".")}`)
+  }
+  return [...clears, ...changed]
+}
+
+// Last run's commands plus the edit
+function routeCommandsFor(routes, lines) {
+  if (!lastCommands || lastCommands.state !== lastState) return lines
+
+  const commands = [...lastCommands.commands, ...routeEdits(lastCommands.routes, routes)]
+  return commands.length > PREFIX_COMPACT_FACTOR * lines.length + 16 ? lines : commands
+}
+
+function recordRunProgress(run, progress) {
+  run.progress.attemptsTotal += BigInt(progress.attempts)
+  run.progress.depth = progress.depth
+  run.progress.maxDepth = progress.numDemands
+  run.progress.bestCost = progress.bestCost
+}
+
+// Solves `routes` in the in-process router and resolves to { state, log }. A router that still
+// holds lastState gets just the edit, anchored on its fabric; otherwise a fresh one is anchored on
+// lastState and sent every route line, like a spawned run. Past PREFIX_COMPACT_FACTOR times the
+// route count in commands it is rebuilt the same way, so its cumulative counters stay comparable.
+async function solveRoutesNative(run, routes, lines, locks, strictStability, incremental) {
+  const key = `${currentSize}:${strictStability ? 1 : 0}:${incremental ? 1 : 0}`
+  let entry = nativeRouter
+  let commands = null
+  // Incremental repair depends on the order edits arrive in, so it always gets the plain list
+  if (entry && !entry.busy && !incremental && entry.key === key && entry.state === lastState) {
+    commands = routeEdits(entry.routes, routes)
+    if (entry.commands + commands.length > PREFIX_COMPACT_FACTOR * lines.length + 16) commands = null
+  }
+  if (commands) {
+    entry.router.anchor()
+  } else {
+    if (entry && !entry.busy) entry.router.close()
+    const router = new ClosRouter({ size: currentSize, strictStability: !!strictStability, incremental: !!incremental })
+    if (lastState) router.loadPreviousState(JSON.stringify(lastState))
+    entry = nativeRouter = { router, key, state: null, routes: null, commands: 0, busy: false }
+    commands = lines
+  }
+
+  const { router } = entry
+  entry.state = null  // out of step with lastState until this run is accepted
+  entry.busy = true
+  try {
+    router.setLocks(locks)
+    const result = await router.run(commands, (progress) => recordRunProgress(run, progress))
+    entry.commands += commands.length
+    router.report()
+    const log = result.log + router.takeLog()
+    const state = JSON.parse(router.stateJson())
+    return { state, log, entry }
+  } finally {
+    entry.busy = false
+  }
+}
+
+function cancelDefrag() {
+  if (defragTimer) {
+    clearTimeout(defragTimer)
+    defragTimer = null
+  }
+  if (defragChild) {
+    try {
+      defragChild.kill("SIGTERM")
+    } catch (err) {
+      console.error("Failed to stop defrag run:", err.message)
+    }
+    defragChild = null
+  }
+}
+
+// Called whenever the router produced a new lastState
+function stateChanged() {
+  scheduleDefrag()
+  scheduleScenePrecompute()
+}
+
+function scheduleDefrag() {
+  stateGeneration += 1
+  cancelDefrag()
+  if (DEFRAG_IDLE_MS > 0 && fs.existsSync(ROUTER_PATH)) {
+    defragTimer = setTimeout(runDefrag, DEFRAG_IDLE_MS)
+  }
+}
+
+// Restarts the idle countdown, leaving a running defrag and the state generation alone
+function restartDefragIdle() {
+  if (defragTimer) {
+    clearTimeout(defragTimer)
+    defragTimer = null
+  }
+  if (DEFRAG_IDLE_MS > 0 && !defragChild && fs.existsSync(ROUTER_PATH)) {
+    defragTimer = setTimeout(runDefrag, DEFRAG_IDLE_MS)
+  }
+}
+
+function runDefrag() {
+  defragTimer = null
+  if (!lastState || (activeRun && activeRun.status === "running")) return
+  const lines = routeLinesFromState(lastState)
+  if (lines.length === 0) return
+
+  const generation = stateGeneration
+  const before = lastState
+  const tmpRoutes = path.join(__dirname, ".tmp_defrag_routes.txt")
+  const tmpJson = path.join(__dirname, ".tmp_defrag_state.json")
+  const tmpPrevState = path.join(__dirname, ".tmp_defrag_prev_state.json")
+  const tmpLocks = path.join(__dirname, ".tmp_defrag_locks.json")
+  const tmpFiles = [tmpRoutes, tmpJson, tmpPrevState, tmpLocks]
+
+  fs.writeFileSync(tmpRoutes, lines.join("\n"))
+  fs.writeFileSync(tmpPrevState, JSON.stringify(before))
+  const args = [tmpRoutes, "--json", tmpJson, "--size", String(currentSize), "--previous-state", tmpPrevState,
+    "--defrag", String(DEFRAG_REROUTES)]
+  if (lastLocks.length > 0) {
+    fs.writeFileSync(tmpLocks, JSON.stringify({ locks: lastLocks }))
+    args.push("--locks", tmpLocks)
+  }
+
+  const child = spawn(ROUTER_PATH, args)
+  defragChild = child
+  child.on("close", (code) => {
+    if (defragChild === child) defragChild = null
+    try {
+      if (code !== 0 || generation !== stateGeneration) return
+      const state = JSON.parse(fs.readFileSync(tmpJson, "utf-8"))
+      if (!(state.total_branches < before.total_branches)) return
+
+      lastState = state
+      stateGeneration += 1
+      lastMaintenance = {
+        id: stateGeneration,
+        at: new Date().toISOString(),
+        branchesBefore: before.total_branches,
+        branchesAfter: state.total_branches,
+        reroutesDemands: state.reroutes_demands,
+        reroutesOutputs: state.reroutes_outputs,
+        state
+      }
+      scheduleScenePrecompute()
+      console.log(`[defrag] branches ${before.total_branches} -> ${state.total_branches}, ` +
+        `${state.reroutes_demands} demand reroute(s)`)
+    } catch (err) {
+      console.error("Defrag run failed:", err.message)
+    } finally {
+      for (const file of tmpFiles) {
+        try {
+          if (fs.existsSync(file)) fs.unlinkSync(file)
+        } catch (err) {
+          console.error(`Failed to remove temp file ${file}:`, err.message)
+        }
+      }
+    }
+  })
+}
+
+function sceneFiles() {
+  const suffix = `.${currentSize}.json`
+  if (!fs.existsSync(SCENES_DIR)) return []
+  return fs.readdirSync(SCENES_DIR).filter((f) => f.endsWith(suffix)).sort()
+}
+
+// Runs router --scene from lastState; calls done(err, state)
+function solveSceneTransition(file, from, locks, done) {
+  const tag = `.tmp_scene_${process.pid}_${Date.now()}`
+  const tmpJson = path.join(__dirname, `${tag}_state.json`)
+  const tmpPrevState = path.join(__dirname, `${tag}_prev_state.json`)
+  const tmpLocks = path.join(__dirname, `${tag}_locks.json`)
+  const tmpFiles = [tmpJson, tmpPrevState, tmpLocks]
+
+  const args = ["--scene", path.join(SCENES_DIR, file), "--json", tmpJson, "--size", String(currentSize)]
+  if (from) {
+    fs.writeFileSync(tmpPrevState, JSON.stringify(from))
+    args.push("--previous-state", tmpPrevState)
+  }
+  if (locks.length > 0) {
+    fs.writeFileSync(tmpLocks, JSON.stringify({ locks }))
+    args.push("--locks", tmpLocks)
+  }
+
+  const child = spawn(ROUTER_PATH, args)
+  let stdout = ""
+  child.stdout.on("data", (data) => {
+    stdout += data.toString()
+  })
+  child.on("close", (code) => {
+    let state = null
+    let error = null
+    try {
+      if (code !== 0) throw new Error(`Scene ${file} could not be realized (exit ${code})`)
+      state = JSON.parse(fs.readFileSync(tmpJson, "utf-8"))
+      state.solverLog = parseRouterLog(stdout, state)
+    } catch (err) {
+      error = err
+    } finally {
+      for (const tmp of tmpFiles) {
+        try {
+          if (fs.existsSync(tmp)) fs.unlinkSync(tmp)
+        } catch (err) {
+          console.error(`Failed to remove temp file ${tmp}:`, err.message)
+        }
+      }
+    }
+    done(error, state)
+  })
+  return child
+}
+
+function cancelScenePrecompute() {
+  if (scenePrecomputeTimer) {
+    clearTimeout(scenePrecomputeTimer)
+    scenePrecomputeTimer = null
+  }
+  if (scenePrecomputeChild) {
+    try {
+      scenePrecomputeChild.kill("SIGTERM")
+    } catch (err) {
+      console.error("Failed to stop scene precompute:", err.message)
+    }
+    scenePrecomputeChild = null
+  }
+}
+
+function scheduleScenePrecompute() {
+  cancelScenePrecompute()
+  if (SCENE_PRECOMPUTE_IDLE_MS > 0 && fs.existsSync(ROUTER_PATH)) {
+    scenePrecomputeTimer = setTimeout(precomputeNextScene, SCENE_PRECOMPUTE_IDLE_MS)
+  }
+}
+
+// One scene at a time, until every scene has a transition from the current state
+function precomputeNextScene() {
+  scenePrecomputeTimer = null
+  const from = lastState
+  const file = sceneFiles().find((f) => sceneTransitions.get(f)?.from !== from)
+  if (!file) return
+
+  const locks = lastLocks
+  const child = solveSceneTransition(file, from, locks, (err, state) => {
+    if (scenePrecomputeChild === child) scenePrecomputeChild = null
+    if (lastState !== from || lastLocks !== locks) return  // stale: a newer schedule is pending
+    if (err) {
+      console.error(`[scenes] ${err.message}`)
+      sceneTransitions.set(file, { from, state: null })
+    } else {
+      sceneTransitions.set(file, { from, state })
+    }
+    scenePrecomputeTimer = setTimeout(precomputeNextScene, 0)
+  })
+  scenePrecomputeChild = child
+}
+
 // Parse router stdout into structured log entries
 function parseRouterLog(stdout, state = {}) {
   const entries = []
@@ -222,6 +567,9 @@ if (!fs.existsSync(ROUTES_DIR)) {
 if (!fs.existsSync(STATES_DIR)) {
   fs.mkdirSync(STATES_DIR, { recursive: true })
 }
+if (!fs.existsSync(SCENES_DIR)) {
+  fs.mkdirSync(SCENES_DIR, { recursive: true })
+}
 
 // ============================================================================
 // pp128 solver conversion functions
@@ -583,6 +931,19 @@ function parsePropatchsWithChains(data) {
 app.use(cors())
 app.use(express.json())
 
+// Any request ends the idle period. One that may change the state also stops a running defrag;
+// a read-only one just restarts the countdown. The countdown starts over once the request is done.
+app.use("/api", (req, res, next) => {
+  if (req.path === "/maintenance") return next()
+  if (req.method === "GET" && req.path !== "/process-stream") {
+    restartDefragIdle()
+  } else {
+    cancelDefrag()
+    res.on("close", restartDefragIdle)
+  }
+  next()
+})
+
 // Configure multer for route file uploads
 const routeStorage = multer.diskStorage({
   destination: (req, file, cb) => cb(null, ROUTES_DIR),
@@ -1076,7 +1437,7 @@ app.post("/api/process", async (req, res) => {
 
   // Check if router binary exists
   if (!fs.existsSync(ROUTER_PATH)) {
-    return res.status(500).json({ error: "Router binary not found. Run: gcc -O2 -Wall -std=c11 ../clos_mult_router.c -o ../clos_mult_router" })
+    return res.status(500).json({ error: "Router binary not found. Run: gcc -O2 -Wall -std=c11 ../libclos.c ../clos_mult_router.c -o ../clos_mult_router" })
   }
 
   if (activeRun && activeRun.status === "running") {
@@ -1149,6 +1510,7 @@ app.post("/api/process", async (req, res) => {
 
       const solverLog = parseRouterLog(stdout, state)
       lastState = state
+      stateChanged()
 
       if (state.lock_conflicts && state.lock_conflicts.length > 0) {
         finishRun(run)
@@ -1590,6 +1952,7 @@ app.get("/api/process-stream", (req, res) => {
 
       // Cache for future incremental updates
       lastState = state
+      stateChanged()
 
       // Send the complete state
       if (canWrite) {
@@ -1618,7 +1981,7 @@ app.get("/api/process-stream", (req, res) => {
 // POST /api/process-routes - Process routes from JSON directly
 // Body: { routes: { [inputId: string]: number[] }, strictStability?: boolean, incremental?: boolean, size?: number, solver?: "clos" | "pp128" }
 // e.g., { routes: { "1": [21, 22], "7": [31, 44, 92] }, strictStability: true, incremental: true, size: 8 }
-app.post("/api/process-routes", (req, res) => {
+app.post("/api/process-routes", async (req, res) => {
   const { routes, strictStability, incremental, size, locks, solver } = req.body
   const usePp128 = solver === "pp128"
   const useClosV2 = solver === "clos_v2"
@@ -1823,17 +2186,51 @@ app.post("/api/process-routes", (req, res) => {
   // Standard clos_mult_router path
   // Convert routes object to route file format
   // Format: input.output1.output2.output3...
-  const lines = []
-  for (const [inputId, outputs] of Object.entries(routes)) {
-    if (Array.isArray(outputs) && outputs.length > 0) {
-      lines.push(`${inputId}.${outputs.join(".")}`)
-    }
-  }
+  const lines = routeLinesFromRoutes(routes)
 
   if (lines.length === 0) {
     return res.status(400).json({ error: "No valid routes provided" })
   }
 
+  if (ClosRouter) {
+    const lockArray = Array.isArray(locks) ? locks : []
+    const run = beginRun(null)
+    if (!run) {
+      return res.status(409).json({ error: "Solver already running" })
+    }
+    // An in-process solve cannot be killed: a cancelled run is answered now and its result dropped
+    run.onCancel = () => {
+      finishRun(run)
+      res.status(409).json({ error: "Run cancelled", summary: buildRunSummary(run) })
+    }
+
+    try {
+      const { state, log, entry } = await solveRoutesNative(run, routes, lines, lockArray, strictStability, incremental)
+      if (run.cancelled) return
+
+      const solverLog = parseRouterLog(log, state)
+      lastState = state
+      lastLocks = lockArray
+      lastCommands = null
+      // A rejected command leaves the router short of the routes, so only exact runs are reused
+      if (stateMatchesRoutes(state, routes)) Object.assign(entry, { state, routes })
+      stateChanged()
+
+      if (state.lock_conflicts && state.lock_conflicts.length > 0) {
+        return res.status(409).json({ error: "Locked path conflict", lockConflicts: state.lock_conflicts })
+      }
+      res.json({ ...state, solverLog })
+    } catch (err) {
+      if (!run.cancelled) res.status(500).json({ error: err.message })
+    } finally {
+      finishRun(run)
+    }
+    return
+  }
+
+  // Incremental repair depends on the order edits arrive in, so it always gets the plain list
+  const commands = incremental ? lines : routeCommandsFor(routes, lines)
+
   // Write temp route file
   const tmpRoutes = path.join(__dirname, ".tmp_routes.txt")
   const tmpJson = path.join(__dirname, ".tmp_state.json")
@@ -1841,9 +2238,9 @@ app.post("/api/process-routes", (req, res) => {
   const tmpLocks = path.join(__dirname, ".tmp_locks.json")
   const tmpFiles = [tmpRoutes, tmpJson, tmpPrevState, tmpLocks]
 
-  fs.writeFileSync(tmpRoutes, lines.join("\n"))
+  fs.writeFileSync(tmpRoutes, commands.join("\n"))
 
-  const args = [tmpRoutes, "--json", tmpJson, "--size", String(currentSize)]
+  const args = [tmpRoutes, "--json", tmpJson, "--size", String(currentSize), "--prefix-cache", PREFIX_CACHE_PATH]
 
   if (lastState) {
     fs.writeFileSync(tmpPrevState, JSON.stringify(lastState))
@@ -1918,6 +2315,9 @@ app.post("/api/process-routes", (req, res) => {
       const solverLog = parseRouterLog(stdout, state)
       lastState = state
       lastLocks = lockArray
+      // A rejected command leaves the state short of the routes, so only exact runs seed the next one
+      lastCommands = stateMatchesRoutes(state, routes) ? { state, routes, commands } : null
+      stateChanged()
 
       if (state.lock_conflicts && state.lock_conflicts.length > 0) {
         finishRun(run)
@@ -1953,7 +2353,7 @@ app.post("/api/cancel-run", (req, res) => {
   }
 
   try {
-    run.child.kill("SIGTERM")
+    if (run.child) run.child.kill("SIGTERM")
   } catch (err) {
     console.error("Failed to SIGTERM solver:", err.message)
   }
@@ -1971,6 +2371,97 @@ app.post("/api/cancel-run", (req, res) => {
   res.json({ success: true, summary })
 })
 
+// GET /api/maintenance - Last idle-time defragmentation, while its state is still the current one.
+// The UI polls this and swaps in last.state once per id.
+app.get("/api/maintenance", (req, res) => {
+  const last = lastMaintenance && lastMaintenance.state === lastState ? lastMaintenance : null
+  res.json({ enabled: DEFRAG_IDLE_MS > 0, idleMs: DEFRAG_IDLE_MS, reroutes: DEFRAG_REROUTES, last })
+})
+
+// GET /api/scenes - Scenes for the current size, and whether a recall would be instant
+app.get("/api/scenes", (req, res) => {
+  try {
+    const scenes = sceneFiles().map((file) => {
+      const transition = sceneTransitions.get(file)
+      return {
+        name: file.replace(/\.\d+\.json$/, ""),
+        file,
+        ready: Boolean(transition && transition.from === lastState && transition.state)
+      }
+    })
+    res.json({ scenes })
+  } catch (err) {
+    res.status(500).json({ error: err.message })
+  }
+})
+
+// POST /api/scenes - Store the current state (or body.state) as a named scene
+// Body: { name: "show-open", state?: {...} }
+app.post("/api/scenes", (req, res) => {
+  const { name } = req.body
+  const state = req.body.state || lastState
+  if (!name || !/^[a-zA-Z0-9_-]+$/.test(name)) {
+    return res.status(400).json({ error: "Invalid scene name. Use only letters, numbers, dashes, and underscores." })
+  }
+  if (!state || !Array.isArray(state.desired_owner)) {
+    return res.status(400).json({ error: "No state to store" })
+  }
+
+  const file = `${name}.${currentSize}.json`
+  const scene = { N: currentSize, desired_owner: state.desired_owner, s3_port_spine: state.s3_port_spine || [] }
+  try {
+    fs.writeFileSync(path.join(SCENES_DIR, file), JSON.stringify(scene))
+    sceneTransitions.delete(file)
+    scheduleScenePrecompute()
+    res.json({ file, success: true })
+  } catch (err) {
+    res.status(500).json({ error: err.message })
+  }
+})
+
+// DELETE /api/scenes/:name - Remove a scene
+app.delete("/api/scenes/:name", (req, res) => {
+  const file = `${req.params.name}.${currentSize}.json`
+  const filepath = path.join(SCENES_DIR, file)
+  if (!/^[a-zA-Z0-9_-]+$/.test(req.params.name) || !fs.existsSync(filepath)) {
+    return res.status(404).json({ error: "Scene not found" })
+  }
+  fs.unlinkSync(filepath)
+  sceneTransitions.delete(file)
+  res.json({ success: true })
+})
+
+// POST /api/scenes/:name/recall - Switch to a scene: the precomputed transition if there is one,
+// else solved now
+app.post("/api/scenes/:name/recall", (req, res) => {
+  const file = `${req.params.name}.${currentSize}.json`
+  if (!/^[a-zA-Z0-9_-]+$/.test(req.params.name) || !fs.existsSync(path.join(SCENES_DIR, file))) {
+    return res.status(404).json({ error: "Scene not found" })
+  }
+
+  const adopt = (state, precomputed) => {
+    lastState = state
+    sceneTransitions.delete(file)
+    stateChanged()
+    res.json({ ...state, precomputed })
+  }
+
+  const transition = sceneTransitions.get(file)
+  if (transition && transition.from === lastState && transition.state) {
+    return adopt(transition.state, true)
+  }
+
+  if (activeRun && activeRun.status === "running") {
+    return res.status(409).json({ error: "Solver already running" })
+  }
+  const from = lastState
+  solveSceneTransition(file, from, lastLocks, (err, state) => {
+    if (err) return res.status(500).json({ error: err.message })
+    if (lastState !== from) return res.status(409).json({ error: "State changed during recall" })
+    adopt(state, false)
+  })
+})
+
 // GET /api/size - Get current crossbar size
 app.get("/api/size", (req, res) => {
   res.json({ size: currentSize })
@@ -19,6 +19,9 @@ type LockPayload = { input: number; egressBlock: number; spine: number }
 type RouteMap = Record<number, number[]>
 type PreserveMode = "none" | "all" | "locked"
 
+// How often an idle UI asks the server for an idle-time defragmentation result
+const MAINTENANCE_POLL_MS = 2000
+
 const normalizeOutputs = (outputs: number[]) => {
   const unique = Array.from(new Set(outputs))
   unique.sort((a, b) => a - b)
@@ -318,6 +321,7 @@ export default function App() {
   const eventSourceRef = useRef<EventSource | null>(null)
   const runAbortRef = useRef<AbortController | null>(null)
   const cancelRequestedRef = useRef(false)
+  const maintenanceSeenRef = useRef<number | null>(null)
 
   const inputs = useMemo(() => (state ? deriveInputs(state) : []), [state])
 
@@ -730,6 +734,51 @@ export default function App() {
     }
   }
 
+  // Idle-time defragmentation (server CLOS_DEFRAG_IDLE_MS) re-solves the routes behind the UI's
+  // back; poll for it while idle and show the result if it still connects the outputs on screen
+  // the same way (a defrag only moves spines)
+  useEffect(() => {
+    if (loading || solverRunning || !state) return
+    const current = state.s3_port_owner
+    let cancelled = false
+    let timer: ReturnType<typeof setTimeout> | null = null
+
+    async function pollMaintenance() {
+      try {
+        const res = await fetch("/api/maintenance")
+        if (cancelled || !res.ok) return
+        const json = await res.json()
+        if (cancelled || !json.enabled) return
+        const last = json.last
+        if (last && last.id !== maintenanceSeenRef.current) {
+          maintenanceSeenRef.current = last.id
+          const parsed = fabricStateSchema.safeParse(last.state)
+          if (parsed.success && parsed.data.s3_port_owner.length === current.length &&
+              parsed.data.s3_port_owner.every((owner, port) => owner === current[port])) {
+            setState(parsed.data)
+            setSolverLog(prev => [...prev, {
+              level: 'summary',
+              type: 'info',
+              message: `Idle defrag: branches ${last.branchesBefore} → ${last.branchesAfter}, ` +
+                `${last.reroutesDemands} demand reroute(s)`,
+              timestamp: last.at
+            }])
+            return
+          }
+        }
+      } catch (e) {
+        console.error("Failed to poll maintenance:", e)
+      }
+      if (!cancelled) timer = setTimeout(pollMaintenance, MAINTENANCE_POLL_MS)
+    }
+
+    timer = setTimeout(pollMaintenance, MAINTENANCE_POLL_MS)
+    return () => {
+      cancelled = true
+      if (timer) clearTimeout(timer)
+    }
+  }, [state, loading, solverRunning])
+
   // Fetch crossbar size on mount
   useEffect(() => {
     fetchCrossbarSize()
@@ -18,6 +18,16 @@ export const fabricStateSchema = z.object({
     spine: int,
     reason: z.string()
   })).optional(),
+  unsat_core: z.array(z.object({
+    input: int,
+    egress_block: int
+  })).optional(),
+  unsat_core_input: int.optional(),
+  alternatives: z.array(z.object({
+    input: int,
+    targets: z.array(int),
+    reroutes: int
+  })).optional(),
   solve_ms: z.number().optional(),
   solve_total_ms: z.number().optional(),
   solve_nodes: z.number().optional(),
@@ -58,7 +68,8 @@ export const solverResponseSchema = fabricStateSchema.extend({
     type: z.enum(['success', 'error', 'info', 'warning'])
   })).optional(),
   stability_changes: z.number().optional(),
-  strict_stability: z.boolean().optional()
+  strict_stability: z.boolean().optional(),
+  max_reroutes: z.number().optional()
 })
 
 export type SolverResponse = z.infer<typeof solverResponseSchema>
@@ -0,0 +1,6130 @@
+// libclos.c
+//
+// 3-stage Clos fabric simulator + COMPLETE (backtracking) global repacker for multicast ("mult") fanout.
+//
+// What you had before:
+// - an incremental greedy placer + a single-leg local "defrag"
+// - fast, but it could fail even when a solution exists
+//
+// What this version does:
+// - maintains a desired end-state: output port -> input_id
+// - after every command, it REPACKS THE ENTIRE FABRIC from scratch using a backtracking solver
+// - if any valid assignment exists under this model, it will find one
+// - it also minimizes total "branches" (spines used) as a secondary objective
+//
+// Model (symmetric C(N,N,N), default N=10):
+// - Stage 1: N ingress blocks, N ports each (ports 1..N^2)
+// - Stage 2: N spines
+// - Stage 3: N egress blocks, N ports each (ports 1..N^2)
+//
+// Key constraints (route isolation in the sense you mean):
+// 1) Each ingress-block -> spine trunk is owned by at most one input.
+// 2) Each spine -> egress-block trunk is owned by at most one input.
+// 3) Each output port selects exactly one trunk (one-of-m selection).
+//
+// Mult behavior:
+// - multiple output ports in the SAME egress block can share the same (spine, egress-block) trunk for a given input
+// - congestion occurs when too many distinct inputs want to reach the same egress block (max N in this topology)
+//
+// All state lives in a clos_ctx (libclos.h); clos_mult_router.c is the command-line front end.
+
+#define _POSIX_C_SOURCE 200809L  // strdup/strtok_r under -std=c11
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/time.h>
+#include "libclos.h"
+
+#define MAX_LINE_LENGTH 1024
+#define PROGRESS_CHECK_INTERVAL 1024  // must be power-of-two for mask check
+#define PROGRESS_CHECK_MASK (PROGRESS_CHECK_INTERVAL - 1)
+
+// --- SIZE CONFIG ------------------------------------------------------------
+// Runtime-configurable Clos size (C(N,N,N)), fixed per context by clos_create(). The macros
+// read the context named `clos` that every fabric function has in scope.
+#define N (clos->n)
+#define TOTAL_BLOCKS (clos->total_blocks)
+#define MAX_PORTS (clos->max_ports)
+
+// --- FABRIC STATISTICS (kept live by the fabric mutators) -------------------
+typedef struct {
+  // Routes
+  int routes_active;
+  int routes_preserved;   // same spine as previous
+  int routes_new;         // no previous assignment
+  int routes_removed;     // had previous but now gone
+
+  // Multicast
+  int inputs_with_mult;   // inputs with 2+ output ports
+  int inputs_multi_spine; // inputs using 2+ spines
+  int egress_with_mult;   // egress blocks with 2+ distinct inputs
+
+  // Capacity
+  int max_egress_load;    // max inputs per egress block
+  int max_egress_block;   // which block has max load (1-indexed)
+  int active_spines;      // count of spines with at least 1 route
+  int total_branches;     // sum of spines used per active input
+} FabricStats;
+
+// --- LOCKED PATHS -----------------------------------------------------------
+typedef struct {
+  int input_id;
+  int egress_block;
+  int spine;
+  const char *reason;
+} LockConflict;
+
+// Locks compiled once per load (compile_locks), so solves never scan all (N²+1)×N lock slots
+typedef struct {
+  int input_id;
+  int egress_block;
+  int spine;
+} LockEntry;
+
+// --- UNSAT CORE (last rejected command) -------------------------------------
+// Irreducible set of (input, egress_block) demands that cannot coexist, see extract_unsat_core()
+typedef struct {
+  int input_id;
+  int egress_block;
+} UnsatCoreEntry;
+
+// --- ROUTE ALTERNATIVES (last rejected route) -------------------------------
+typedef struct {
+  int input_id;
+  int *targets;
+  int num_targets;
+  int reroutes;  // demands rerouted relative to the fabric at rejection time
+} RouteAlternative;
+
+// --- SOLVER SCRATCH ---------------------------------------------------------
+// One solver variable: an input that needs a spine into an egress block (COMPLETE GLOBAL SOLVER)
+typedef struct {
+  int input_id;      // 1..100
+  int ingress_block; // 0..9
+  int egress_block;  // 0..9
+} Demand;
+
+// Buffers sized once per fabric and reused by every solve
+typedef struct {
+  int max_demands;
+  int block_words;
+  int spine_words;
+
+  Demand *demands;
+  Demand *demands_backup;
+  int *active_inputs;
+  uint64_t *need_blocks_mask;
+
+  int **tmp_s2;
+  int *tmp_s2_storage;
+  int **tmp_s1_owner;
+  int *tmp_s1_owner_storage;
+
+  uint64_t *used_spines_mask;
+  int *assignment;
+  int *best_assignment;
+  Demand *best_demands;
+  int *spine_use_count;
+  uint64_t *lock_spines_mask;
+
+  int **prev_spine_for;
+  int *prev_spine_for_storage;
+  int **unset_spine_for;  // all -1; the "previous" map for incremental repair
+  int *unset_spine_for_storage;
+
+  int **reroute_weight;
+  int *reroute_weight_storage;
+
+  int **kernel_s2_claim;  // spine x egress block -> input whose previous spine wants it, -1 if contested
+  int *kernel_s2_claim_storage;
+  int **kernel_s1_claim;  // ingress block x spine -> same, for the Stage1 trunk
+  int *kernel_s1_claim_storage;
+  bool *kernel_hot_egress;  // blocks the kernel has grown into; their demands are not pinned
+  bool *kernel_hot_ingress;
+
+  int **ls_s2_count;      // local search: demands on each Stage2 trunk (spine x egress block)
+  int *ls_s2_count_storage;
+  int **ls_s1_count;      // inputs on each Stage1 trunk (ingress block x spine)
+  int *ls_s1_count_storage;
+  int **ls_input_use;     // demands of each input on each spine
+  int *ls_input_use_storage;
+
+  int **demand_activity;  // input x egress block -> conflict score; persists across solves (SOLVER MEMORY)
+  int *demand_activity_storage;
+
+  int **plan_hint;        // input x egress block -> spine for its next placement, -1 none (PLANNING, SCENES)
+  int *plan_hint_storage;
+
+  bool initialized;
+} SolverScratch;
+
+typedef struct SolutionCacheEntry SolutionCacheEntry;  // SOLUTION CACHE
+typedef struct PrefixCacheEntry PrefixCacheEntry;      // PREFIX CACHE
+
+// --- CONTEXT ----------------------------------------------------------------
+// Everything one fabric owns. Contexts share nothing, so a process can hold several fabrics and
+// solve them on different threads, one thread per context at a time.
+struct clos_ctx {
+  int n;                                 // N
+  int total_blocks;                      // N ingress and N egress blocks
+  int max_ports;                         // N^2
+  size_t max_demands;                    // MAX_PORTS × TOTAL_BLOCKS
+  FILE *out;                             // solver log (stdout for the CLI)
+  clos_progress_fn progress;             // called with each PROGRESS report (optional)
+  void *progress_user;
+
+  // Desired state: the "truth" this app tries to realize in the fabric.
+  // desired_owner[out_port] = input_id (0 = disconnected)
+  int *desired_owner;
+
+  // Previous state (for stability): with --previous-state, existing spine assignments are preserved
+  int *prev_s3_port_spine;               // previous spine assignments (-1 = none)
+  bool have_previous_state;
+  bool strict_stability;                 // --strict-stability flag
+  int max_reroutes;                      // --max-reroutes K: reroutes a solve may spend (-1 = unlimited)
+  int last_stability_cost;               // track changes from previous state
+  bool output_weighted;                  // --output-weighted: reroute cost = outputs moved, not demands
+  int last_reroute_cost;                 // optimized stability cost (== last_stability_cost unless weighted)
+
+  // Stability metrics (cumulative across all commands)
+  int cumulative_reroutes;               // total spine changes across all solves
+  int cumulative_output_reroutes;        // total output-port spine changes across all solves
+  int initial_route_count;               // routes at start of file (from previous state)
+  bool tracked_initial;                  // whether we've captured initial state
+  long long total_solve_us;              // cumulative solve time across all repacks
+  long long last_solve_us;               // last repack solve time
+  int repack_count;                      // number of successful repacks
+  long long last_solve_nodes;            // last repack backtrack nodes
+  long long total_solve_nodes;           // cumulative backtrack nodes across repacks
+  int solution_cache_hits;               // repacks answered from the solution cache
+  int solution_cache_misses;
+  int failed_commands;                   // commands rejected (route or clear failed)
+
+  // Branch phase (secondary objective, --min-branches)
+  bool min_branches_mode;                // --min-branches flag
+  long long branch_node_budget;          // --branch-budget: node cap for the branch phase
+  long long last_branch_nodes;
+  long long total_branch_nodes;
+  int defrag_reroutes;                   // --defrag K: reroutes the branch phase may spend, in max_reroutes units (-1 off)
+
+  // Search engine: how the optimality search after the greedy seed and conflict kernel is run
+  clos_search search_engine;             // --search
+  int lns_budget_ms;                     // --lns-budget MS: improve the incumbent by LNS for MS ms instead of proving it
+  bool learn_mode;                       // --learn FILE: carry conflict scores between commands (SOLVER MEMORY)
+  bool plan_mode;                        // --plan: solve the routes file as one session with lookahead (PLANNING)
+  bool placement_hints;                  // new demands try solver_scratch.plan_hint first (--plan, --scene)
+
+  // Fabric state (realized solution)
+  int **s1_to_s2;                        // ingress block -> spine trunk owner (0 free, else input_id)
+  int *s1_to_s2_storage;
+  int **s2_to_s3;                        // spine -> egress block trunk owner (0 free, else input_id)
+  int *s2_to_s3_storage;
+  int *s3_port_owner;                    // output port -> input_id (0 free)
+  int *s3_port_spine;                    // output port -> spine index (0..N-1), -1 if disconnected
+  int **demand_count;                    // input_id -> egress block output count
+  int *demand_count_storage;
+  int **current_spine_for;               // input_id -> egress block spine, -1 if none
+  int *current_spine_for_storage;
+
+  // Fabric statistics (kept live by the fabric mutators)
+  FabricStats live_stats;                // max_egress_block is filled in by compute_fabric_stats()
+  int *outputs_per_input;                // input_id -> routed output ports
+  int *input_spine_use;                  // input_id * N + spine -> egress blocks it carries
+  int *input_spine_count;                // input_id -> distinct spines (branches)
+  int *egress_load;                      // egress block -> owned trunks
+  int *egress_load_hist;                 // load 0..N -> egress blocks with that load
+  int *spine_load;                       // spine -> owned trunks
+
+  // Incremental repair base: Stage1/Stage2 trunks and per-input spine masks that mirror the
+  // committed fabric. The fabric mutators keep them in step on commit; incremental_repair()
+  // searches on them directly and then restores only the entries its demands could touch, so
+  // repair setup is O(changed demands).
+  int **repair_s2;                       // mirrors s2_to_s3 between repairs
+  int *repair_s2_storage;
+  int **repair_s1_owner;                 // mirrors s1_to_s2 between repairs
+  int *repair_s1_owner_storage;
+  uint64_t *repair_spines_mask;          // input_id row -> spines the input holds trunks on
+  int repair_spine_words;
+
+  // Fabric validation: the fabric mutators and desired_owner edits record what they touch;
+  // validate_fabric() checks just that set, with a periodic full pass
+  bool paranoid_mode;                    // --paranoid flag (always on with -DCLOS_PARANOID)
+  int commits_since_full_check;
+  int *touched_trunks;                   // spine * TOTAL_BLOCKS + egress block
+  int touched_trunk_count;
+  bool *trunk_touched;
+  int *touched_ports;                    // output ports
+  int touched_port_count;
+  bool *port_touched;
+
+  // Locked paths: lock_spine_for[input_id][egress_block] = spine (0..N-1), or -1 if unlocked
+  int **lock_spine_for;
+  int *lock_spine_for_storage;
+  bool have_locks;
+  int last_locked_demands;
+  int last_locked_outputs;
+  LockConflict *lock_conflicts;
+  int lock_conflict_count;
+  int lock_conflict_load_count;          // the first ones, found while loading; the rest come from demands
+  int lock_conflict_cap;
+  LockEntry *lock_list;                  // ordered by (input, egress block)
+  int lock_list_count;
+  bool lock_trunks_shared;               // two locks claim one trunk: a conflict once both demands exist
+  int *lock_claim_storage;               // N×TOTAL_BLOCKS Stage2 claims, then TOTAL_BLOCKS×N Stage1 claims
+
+  int last_rerouted_outputs;
+
+  // Unsat core and route alternatives (last rejected command)
+  UnsatCoreEntry *unsat_core;
+  int unsat_core_count;
+  int unsat_core_input;                  // input of the rejected route (0 = clear or unknown)
+  int core_focus_input;                  // set by apply_route_request() while it repacks
+  RouteAlternative *route_alternatives;  // best ALTERNATIVE_MAX, ranked by reroutes
+  int route_alternative_count;
+
+  // Incremental repair metrics
+  bool incremental_mode;
+  long long total_repair_us;
+  long long last_repair_us;
+  int repair_count;
+  int repair_attempts;
+  int repair_failures;
+  long long last_repair_nodes;
+  long long total_repair_nodes;
+
+  SolverScratch solver_scratch;
+
+  // Solution cache
+  SolutionCacheEntry *solution_cache;
+  int solution_cache_cap;                // --solution-cache-size (0 disables)
+  int solution_cache_count;
+  unsigned long long solution_cache_tick;
+
+  // Prefix cache
+  bool prefix_cache_mode;                // --prefix-cache FILE
+  PrefixCacheEntry *prefix_cache;
+  int prefix_cache_cap;                  // --prefix-cache-size (0 disables)
+  int prefix_cache_count;
+  unsigned long long prefix_cache_tick;
+};
+
+static void recount_fabric_stats(clos_ctx *clos);  // Forward declaration
+
+#define FULL_VALIDATION_INTERVAL 64
+
+// --- HELPERS ----------------------------------------------------------------
+static inline int get_block(clos_ctx *clos, int port) {
+  return (port - 1) / N;
+}
+
+// Reroutes a solve may spend: none under --strict-stability, else --max-reroutes (-1 = unlimited)
+static inline int reroute_budget(clos_ctx *clos) {
+  return clos->strict_stability ? 0 : clos->max_reroutes;
+}
+
+static inline bool within_reroute_budget(clos_ctx *clos, int reroutes) {
+  return reroute_budget(clos) < 0 || reroutes <= reroute_budget(clos);
+}
+
+static inline bool is_valid_port(clos_ctx *clos, int p) {
+  return p >= 1 && p <= MAX_PORTS;
+}
+
+static char *trim_in_place(char *s) {
+  while (*s && isspace((unsigned char)*s)) s++;
+  if (*s == 0) return s;
+
+  char *end = s + strlen(s) - 1;
+  while (end > s && isspace((unsigned char)*end)) end--;
+  end[1] = '\0';
+  return s;
+}
+
+// --- DYNAMIC ALLOCATION HELPERS ---------------------------------------------
+static int **alloc_int_matrix(int rows, int cols, int **out_storage) {
+  if (out_storage) *out_storage = NULL;
+  int *storage = calloc((size_t)rows * (size_t)cols, sizeof(int));
+  if (!storage) return NULL;
+
+  int **rows_ptr = malloc((size_t)rows * sizeof(int *));
+  if (!rows_ptr) {
+    free(storage);
+    return NULL;
+  }
+
+  for (int r = 0; r < rows; r++) {
+    rows_ptr[r] = storage + (size_t)r * cols;
+  }
+
+  if (out_storage) *out_storage = storage;
+  return rows_ptr;
+}
+
+static void free_int_matrix(int **matrix, int *storage) {
+  free(storage);
+  free(matrix);
+}
+
+static inline int bitset_words(int bits) {
+  return (bits + 63) / 64;
+}
+
+static inline uint64_t *bitset_row(uint64_t *base, int row, int word_count) {
+  return base + (size_t)row * (size_t)word_count;
+}
+
+static inline const uint64_t *bitset_row_const(const uint64_t *base, int row, int word_count) {
+  return base + (size_t)row * (size_t)word_count;
+}
+
+static inline bool bitset_any(const uint64_t *row, int word_count) {
+  for (int i = 0; i < word_count; i++) {
+    if (row[i]) return true;
+  }
+  return false;
+}
+
+static inline bool bitset_test(const uint64_t *row, int bit) {
+  return (row[bit >> 6] & (1ULL << (bit & 63))) != 0;
+}
+
+static inline void bitset_set(uint64_t *row, int bit) {
+  row[bit >> 6] |= (1ULL << (bit & 63));
+}
+
+static inline void bitset_clear(uint64_t *row, int bit) {
+  row[bit >> 6] &= ~(1ULL << (bit & 63));
+}
+
+static inline int bitset_popcount(const uint64_t *row, int word_count) {
+  int count = 0;
+  for (int i = 0; i < word_count; i++) {
+    count += __builtin_popcountll(row[i]);
+  }
+  return count;
+}
+
+static inline long long now_us(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (long long)tv.tv_sec * 1000000LL + (long long)tv.tv_usec;
+}
+
+static int find_spine_for_input_egress(clos_ctx *clos, int input_id, int egress_block, int **s2) {
+  for (int s = 0; s < N; s++) {
+    if (s2[s][egress_block] == input_id) return s;
+  }
+  return -1;
+}
+
+// --- SOLVER SCRATCH (forward decl) ------------------------------------------
+static bool init_solver_scratch(clos_ctx *clos);
+static void free_solver_scratch(clos_ctx *clos);
+
+static void compute_lock_counts(clos_ctx *clos, const uint64_t *need_blocks_mask, int block_words) {
+  clos->last_locked_demands = 0;
+  clos->last_locked_outputs = 0;
+  if (!clos->have_locks) return;
+
+  for (int i = 0; i < clos->lock_list_count; i++) {
+    const LockEntry *lock = &clos->lock_list[i];
+    if (bitset_test(bitset_row_const(need_blocks_mask, lock->input_id, block_words), lock->egress_block)) {
+      clos->last_locked_demands++;
+    }
+  }
+
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    int owner = clos->desired_owner[p];
+    if (owner <= 0) continue;
+    int e = get_block(clos, p);
+    if (clos->lock_spine_for[owner][e] >= 0) {
+      clos->last_locked_outputs++;
+    }
+  }
+}
+
+// --- LOCK HELPERS -----------------------------------------------------------
+static void clear_lock_conflicts(clos_ctx *clos) {
+  clos->lock_conflict_count = 0;
+}
+
+static void add_lock_conflict(clos_ctx *clos, int input_id, int egress_block, int spine, const char *reason) {
+  if (clos->lock_conflict_count >= clos->lock_conflict_cap) {
+    int new_cap = clos->lock_conflict_cap == 0 ? 8 : clos->lock_conflict_cap * 2;
+    LockConflict *next = realloc(clos->lock_conflicts, sizeof(LockConflict) * (size_t)new_cap);
+    if (!next) return;
+    clos->lock_conflicts = next;
+    clos->lock_conflict_cap = new_cap;
+  }
+  clos->lock_conflicts[clos->lock_conflict_count++] = (LockConflict){
+    .input_id = input_id,
+    .egress_block = egress_block,
+    .spine = spine,
+    .reason = reason
+  };
+}
+
+static void reset_locks(clos_ctx *clos) {
+  free_int_matrix(clos->lock_spine_for, clos->lock_spine_for_storage);
+  clos->lock_spine_for = alloc_int_matrix(MAX_PORTS + 1, TOTAL_BLOCKS, &clos->lock_spine_for_storage);
+  if (!clos->lock_spine_for) return;
+  for (int i = 0; i <= MAX_PORTS; i++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      clos->lock_spine_for[i][e] = -1;
+    }
+  }
+  clos->have_locks = false;
+  clos->lock_list_count = 0;
+  clos->lock_trunks_shared = false;
+}
+
+// Compacts lock_spine_for into lock_list and notes whether any two locks share a trunk
+static bool compile_locks(clos_ctx *clos) {
+  clos->lock_conflict_load_count = clos->lock_conflict_count;
+  clos->lock_list_count = 0;
+  clos->lock_trunks_shared = false;
+  if (!clos->have_locks) return true;
+
+  int count = 0;
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (clos->lock_spine_for[in_id][e] >= 0) count++;
+    }
+  }
+
+  LockEntry *list = realloc(clos->lock_list, sizeof(LockEntry) * (size_t)(count > 0 ? count : 1));
+  if (!list) return false;
+  clos->lock_list = list;
+  if (!clos->lock_claim_storage) {
+    clos->lock_claim_storage = malloc(sizeof(int) * 2 * (size_t)N * (size_t)TOTAL_BLOCKS);
+    if (!clos->lock_claim_storage) return false;
+  }
+
+  int *claim_s2 = clos->lock_claim_storage;
+  int *claim_s1 = clos->lock_claim_storage + (size_t)N * (size_t)TOTAL_BLOCKS;
+  memset(clos->lock_claim_storage, 0, sizeof(int) * 2 * (size_t)N * (size_t)TOTAL_BLOCKS);
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      int s = clos->lock_spine_for[in_id][e];
+      if (s < 0) continue;
+      clos->lock_list[clos->lock_list_count++] = (LockEntry){ .input_id = in_id, .egress_block = e, .spine = s };
+
+      int *s2_owner = &claim_s2[s * TOTAL_BLOCKS + e];
+      int *s1_owner = &claim_s1[get_block(clos, in_id) * N + s];
+      if ((*s2_owner != 0 && *s2_owner != in_id) || (*s1_owner != 0 && *s1_owner != in_id)) clos->lock_trunks_shared = true;
+      if (*s2_owner == 0) *s2_owner = in_id;
+      if (*s1_owner == 0) *s1_owner = in_id;
+    }
+  }
+  return true;
+}
+
+static bool parse_int_after_key(const char *start, const char *key, int *out) {
+  char *k = strstr((char *)start, key);
+  if (!k) return false;
+  char *colon = strchr(k, ':');
+  if (!colon) return false;
+  char *p = colon + 1;
+  while (*p && isspace((unsigned char)*p)) p++;
+  int sign = 1;
+  if (*p == '-') { sign = -1; p++; }
+  if (*p < '0' || *p > '9') return false;
+  int val = 0;
+  while (*p >= '0' && *p <= '9') {
+    val = val * 10 + (*p - '0');
+    p++;
+  }
+  *out = sign * val;
+  return true;
+}
+
+// Records one lock; out-of-range or contradictory locks become lock conflicts instead
+static void add_lock(clos_ctx *clos, int input_id, int egress_block, int spine) {
+  if (!is_valid_port(clos, input_id) || egress_block < 0 || egress_block >= TOTAL_BLOCKS || spine < 0 || spine >= N) {
+    add_lock_conflict(clos, input_id, egress_block, spine, "RANGE");
+    return;
+  }
+
+  int existing = clos->lock_spine_for[input_id][egress_block];
+  if (existing >= 0 && existing != spine) {
+    add_lock_conflict(clos, input_id, egress_block, spine, "CONFLICT");
+    return;
+  }
+
+  clos->lock_spine_for[input_id][egress_block] = spine;
+  clos->have_locks = true;
+}
+
+static bool set_locks(clos_ctx *clos, const clos_lock *locks, int num_locks) {
+  clear_lock_conflicts(clos);
+  reset_locks(clos);
+  for (int i = 0; i < num_locks; i++) add_lock(clos, locks[i].input_id, locks[i].egress_block, locks[i].spine);
+  return compile_locks(clos);
+}
+
+static bool load_locks(clos_ctx *clos, const char *path) {
+  clear_lock_conflicts(clos);
+  reset_locks(clos);
+  if (!path) return true;
+
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror("locks file");
+    return false;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char *buf = malloc((size_t)len + 1);
+  if (!buf) {
+    fclose(f);
+    return false;
+  }
+
+  size_t read_len = fread(buf, 1, (size_t)len, f);
+  buf[read_len] = '\0';
+  fclose(f);
+
+  char *p = buf;
+  while ((p = strstr(p, "\"input\"")) != NULL) {
+    int input_id = -1;
+    int egress_block = -1;
+    int spine = -1;
+
+    if (!parse_int_after_key(p, "\"input\"", &input_id)) { p += 6; continue; }
+    if (!parse_int_after_key(p, "\"egressBlock\"", &egress_block)) {
+      if (!parse_int_after_key(p, "\"egress\"", &egress_block)) { p += 6; continue; }
+    }
+    if (!parse_int_after_key(p, "\"spine\"", &spine)) { p += 6; continue; }
+
+    add_lock(clos, input_id, egress_block, spine);
+    p += 6;
+  }
+
+  free(buf);
+  return compile_locks(clos);
+}
+
+// With report false nothing is recorded or logged, and conflicts left by earlier demands are ignored:
+// route candidates probe in place of the rejected route without committing
+static bool validate_locks_against_demands(clos_ctx *clos, const uint64_t *need_blocks_mask, int block_words,
+                                           bool report) {
+  int standing = report ? clos->lock_conflict_count : clos->lock_conflict_load_count;
+  // Locks that never share a trunk cannot conflict, whatever the demands
+  if (!clos->have_locks || !clos->lock_trunks_shared) return standing == 0;
+
+  int *locked_s2 = clos->lock_claim_storage;
+  int *locked_s1 = clos->lock_claim_storage + (size_t)N * (size_t)TOTAL_BLOCKS;
+  memset(clos->lock_claim_storage, 0, sizeof(int) * 2 * (size_t)N * (size_t)TOTAL_BLOCKS);
+
+  bool ok = true;
+  for (int i = 0; i < clos->lock_list_count; i++) {
+    int in_id = clos->lock_list[i].input_id;
+    int e = clos->lock_list[i].egress_block;
+    int s = clos->lock_list[i].spine;
+
+    if (!bitset_test(bitset_row_const(need_blocks_mask, in_id, block_words), e)) {
+      continue; // lock applies only when the demand exists
+    }
+
+    int ingress = get_block(clos, in_id);
+    int s2_owner = locked_s2[s * TOTAL_BLOCKS + e];
+    if (s2_owner != 0 && s2_owner != in_id) {
+      if (!report) return false;
+      add_lock_conflict(clos, in_id, e, s, "CONFLICT");
+      fprintf(clos->out, "  LOCK CONFLICT: input %d egress %d spine %d (CONFLICT)\n", in_id, e + 1, s + 1);
+      ok = false;
+    } else {
+      locked_s2[s * TOTAL_BLOCKS + e] = in_id;
+    }
+
+    int s1_owner = locked_s1[ingress * N + s];
+    if (s1_owner != 0 && s1_owner != in_id) {
+      if (!report) return false;
+      add_lock_conflict(clos, in_id, e, s, "CONFLICT");
+      fprintf(clos->out, "  LOCK CONFLICT: input %d egress %d spine %d (CONFLICT)\n", in_id, e + 1, s + 1);
+      ok = false;
+    } else {
+      locked_s1[ingress * N + s] = in_id;
+    }
+  }
+
+  return ok && standing == 0;
+}
+
+static void free_solution_cache(clos_ctx *clos);
+static void free_prefix_cache(clos_ctx *clos);
+
+// Per-command and cumulative counters reported in the summary and the JSON
+static void reset_session_metrics(clos_ctx *clos) {
+  clos->last_stability_cost = 0;
+  clos->last_reroute_cost = 0;
+  clos->cumulative_reroutes = 0;
+  clos->initial_route_count = 0;
+  clos->tracked_initial = false;
+  clos->last_locked_demands = 0;
+  clos->last_locked_outputs = 0;
+  clos->last_rerouted_outputs = 0;
+  clos->cumulative_output_reroutes = 0;
+  clos->total_solve_us = 0;
+  clos->last_solve_us = 0;
+  clos->repack_count = 0;
+  clos->last_solve_nodes = 0;
+  clos->total_solve_nodes = 0;
+  clos->last_branch_nodes = 0;
+  clos->total_branch_nodes = 0;
+  clos->solution_cache_hits = 0;
+  clos->solution_cache_misses = 0;
+  clos->failed_commands = 0;
+  clos->total_repair_us = 0;
+  clos->last_repair_us = 0;
+  clos->repair_count = 0;
+  clos->repair_attempts = 0;
+  clos->repair_failures = 0;
+  clos->last_repair_nodes = 0;
+  clos->total_repair_nodes = 0;
+}
+
+static void free_fabric(clos_ctx *clos) {
+  free_solver_scratch(clos);
+  free_solution_cache(clos);
+  free_prefix_cache(clos);
+  free(clos->desired_owner);
+  free(clos->prev_s3_port_spine);
+  free(clos->s3_port_owner);
+  free(clos->s3_port_spine);
+  free_int_matrix(clos->s1_to_s2, clos->s1_to_s2_storage);
+  free_int_matrix(clos->s2_to_s3, clos->s2_to_s3_storage);
+  free_int_matrix(clos->demand_count, clos->demand_count_storage);
+  free_int_matrix(clos->current_spine_for, clos->current_spine_for_storage);
+  free(clos->outputs_per_input);
+  free(clos->input_spine_use);
+  free(clos->input_spine_count);
+  free(clos->egress_load);
+  free(clos->egress_load_hist);
+  free(clos->spine_load);
+  free_int_matrix(clos->repair_s2, clos->repair_s2_storage);
+  free_int_matrix(clos->repair_s1_owner, clos->repair_s1_owner_storage);
+  free(clos->repair_spines_mask);
+  free(clos->touched_trunks);
+  free(clos->trunk_touched);
+  free(clos->touched_ports);
+  free(clos->port_touched);
+  free_int_matrix(clos->lock_spine_for, clos->lock_spine_for_storage);
+  free(clos->lock_conflicts);
+  free(clos->lock_list);
+  free(clos->lock_claim_storage);
+  free(clos->unsat_core);
+  for (int i = 0; i < clos->route_alternative_count; i++) free(clos->route_alternatives[i].targets);
+  free(clos->route_alternatives);
+  clos->desired_owner = NULL;
+  clos->prev_s3_port_spine = NULL;
+  clos->s3_port_owner = NULL;
+  clos->s3_port_spine = NULL;
+  clos->s1_to_s2 = NULL;
+  clos->s1_to_s2_storage = NULL;
+  clos->s2_to_s3 = NULL;
+  clos->s2_to_s3_storage = NULL;
+  clos->demand_count = NULL;
+  clos->demand_count_storage = NULL;
+  clos->current_spine_for = NULL;
+  clos->current_spine_for_storage = NULL;
+  clos->outputs_per_input = NULL;
+  clos->input_spine_use = NULL;
+  clos->input_spine_count = NULL;
+  clos->egress_load = NULL;
+  clos->egress_load_hist = NULL;
+  clos->spine_load = NULL;
+  clos->live_stats = (FabricStats){0};
+  clos->touched_trunks = NULL;
+  clos->repair_s2 = NULL;
+  clos->repair_s2_storage = NULL;
+  clos->repair_s1_owner = NULL;
+  clos->repair_s1_owner_storage = NULL;
+  clos->repair_spines_mask = NULL;
+  clos->repair_spine_words = 0;
+  clos->trunk_touched = NULL;
+  clos->touched_ports = NULL;
+  clos->port_touched = NULL;
+  clos->touched_trunk_count = 0;
+  clos->touched_port_count = 0;
+  clos->commits_since_full_check = 0;
+  clos->lock_spine_for = NULL;
+  clos->lock_spine_for_storage = NULL;
+  clos->lock_conflicts = NULL;
+  clos->lock_conflict_count = 0;
+  clos->lock_conflict_load_count = 0;
+  clos->lock_conflict_cap = 0;
+  clos->lock_list = NULL;
+  clos->lock_list_count = 0;
+  clos->lock_trunks_shared = false;
+  clos->lock_claim_storage = NULL;
+  clos->unsat_core = NULL;
+  clos->unsat_core_count = 0;
+  clos->unsat_core_input = 0;
+  clos->core_focus_input = 0;
+  clos->route_alternatives = NULL;
+  clos->route_alternative_count = 0;
+  reset_session_metrics(clos);
+}
+
+static bool init_fabric(clos_ctx *clos, int size) {
+  if (size < 2) {
+    fprintf(stderr, "Invalid size %d (must be >= 2)\n", size);
+    return false;
+  }
+
+  long long max_ports = (long long)size * (long long)size;
+  if (max_ports > INT_MAX - 1) {
+    fprintf(stderr, "Invalid size %d (MAX_PORTS would overflow int)\n", size);
+    return false;
+  }
+
+  clos->n = size;
+  clos->total_blocks = size;
+  clos->max_ports = (int)max_ports;
+  clos->max_demands = (size_t)clos->max_ports * (size_t)clos->total_blocks;
+  if (clos->max_demands > (size_t)INT_MAX) {
+    fprintf(stderr, "Invalid size %d (max demands exceed int range)\n", size);
+    return false;
+  }
+
+  clos->desired_owner = calloc((size_t)clos->max_ports + 1, sizeof(int));
+  clos->prev_s3_port_spine = malloc(sizeof(int) * ((size_t)clos->max_ports + 1));
+  clos->s3_port_owner = calloc((size_t)clos->max_ports + 1, sizeof(int));
+  clos->s3_port_spine = malloc(sizeof(int) * ((size_t)clos->max_ports + 1));
+  clos->s1_to_s2 = alloc_int_matrix(clos->total_blocks, clos->n, &clos->s1_to_s2_storage);
+  clos->s2_to_s3 = alloc_int_matrix(clos->n, clos->total_blocks, &clos->s2_to_s3_storage);
+  clos->demand_count = alloc_int_matrix(clos->max_ports + 1, clos->total_blocks, &clos->demand_count_storage);
+  clos->current_spine_for = alloc_int_matrix(clos->max_ports + 1, clos->total_blocks, &clos->current_spine_for_storage);
+  clos->outputs_per_input = calloc((size_t)clos->max_ports + 1, sizeof(int));
+  clos->input_spine_use = calloc(((size_t)clos->max_ports + 1) * (size_t)clos->n, sizeof(int));
+  clos->input_spine_count = calloc((size_t)clos->max_ports + 1, sizeof(int));
+  clos->egress_load = calloc((size_t)clos->total_blocks, sizeof(int));
+  clos->egress_load_hist = calloc((size_t)clos->n + 1, sizeof(int));
+  clos->spine_load = calloc((size_t)clos->n, sizeof(int));
+  clos->repair_s2 = alloc_int_matrix(clos->n, clos->total_blocks, &clos->repair_s2_storage);
+  clos->repair_s1_owner = alloc_int_matrix(clos->total_blocks, clos->n, &clos->repair_s1_owner_storage);
+  clos->repair_spine_words = bitset_words(clos->n);
+  clos->repair_spines_mask = calloc(((size_t)clos->max_ports + 1) * (size_t)clos->repair_spine_words, sizeof(uint64_t));
+  clos->touched_trunks = calloc((size_t)clos->n * (size_t)clos->total_blocks, sizeof(int));
+  clos->trunk_touched = calloc((size_t)clos->n * (size_t)clos->total_blocks, sizeof(bool));
+  clos->touched_ports = calloc((size_t)clos->max_ports + 1, sizeof(int));
+  clos->port_touched = calloc((size_t)clos->max_ports + 1, sizeof(bool));
+
+  if (!clos->desired_owner || !clos->prev_s3_port_spine || !clos->s3_port_owner || !clos->s3_port_spine ||
+      !clos->s1_to_s2 || !clos->s2_to_s3 || !clos->demand_count || !clos->current_spine_for ||
+      !clos->outputs_per_input || !clos->input_spine_use || !clos->input_spine_count || !clos->egress_load ||
+      !clos->egress_load_hist || !clos->spine_load || !clos->touched_trunks || !clos->trunk_touched ||
+      !clos->touched_ports || !clos->port_touched || !clos->repair_s2 || !clos->repair_s1_owner ||
+      !clos->repair_spines_mask) {
+    fprintf(stderr, "Out of memory initializing fabric\n");
+    free_fabric(clos);
+    return false;
+  }
+
+  reset_locks(clos);
+  if (!clos->lock_spine_for) {
+    fprintf(stderr, "Out of memory initializing locks\n");
+    free_fabric(clos);
+    return false;
+  }
+
+  if (!init_solver_scratch(clos)) {
+    fprintf(stderr, "Out of memory initializing solver scratch\n");
+    free_fabric(clos);
+    return false;
+  }
+
+  for (int p = 0; p <= MAX_PORTS; p++) {
+    clos->prev_s3_port_spine[p] = -1;
+    clos->s3_port_spine[p] = -1;
+  }
+  for (int in_id = 0; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      clos->current_spine_for[in_id][e] = -1;
+    }
+  }
+  recount_fabric_stats(clos);
+
+  return true;
+}
+
+// --- JSON OUTPUT ------------------------------------------------------------
+static void json_write_int_array(FILE *f, const int *arr, int len) {
+  fputc('[', f);
+  for (int i = 0; i < len; i++) {
+    fprintf(f, "%d", arr[i]);
+    if (i + 1 < len) fputc(',', f);
+  }
+  fputc(']', f);
+}
+
+static void json_write_matrix_s1(clos_ctx *clos, FILE *f) {
+  fputc('[', f);
+  for (int r = 0; r < TOTAL_BLOCKS; r++) {
+    fputc('[', f);
+    for (int c = 0; c < N; c++) {
+      fprintf(f, "%d", clos->s1_to_s2[r][c]);
+      if (c + 1 < N) fputc(',', f);
+    }
+    fputc(']', f);
+    if (r + 1 < TOTAL_BLOCKS) fputc(',', f);
+  }
+  fputc(']', f);
+}
+
+static void json_write_matrix_s2(clos_ctx *clos, FILE *f) {
+  fputc('[', f);
+  for (int r = 0; r < N; r++) {
+    fputc('[', f);
+    for (int c = 0; c < TOTAL_BLOCKS; c++) {
+      fprintf(f, "%d", clos->s2_to_s3[r][c]);
+      if (c + 1 < TOTAL_BLOCKS) fputc(',', f);
+    }
+    fputc(']', f);
+    if (r + 1 < N) fputc(',', f);
+  }
+  fputc(']', f);
+}
+
+static void json_write_lock_conflicts(clos_ctx *clos, FILE *f) {
+  fputc('[', f);
+  for (int i = 0; i < clos->lock_conflict_count; i++) {
+    const LockConflict *c = &clos->lock_conflicts[i];
+    fprintf(f, "{\"input\":%d,\"egress_block\":%d,\"spine\":%d,\"reason\":\"%s\"}",
+            c->input_id, c->egress_block, c->spine, c->reason);
+    if (i + 1 < clos->lock_conflict_count) fputc(',', f);
+  }
+  fputc(']', f);
+}
+
+static void json_write_unsat_core(clos_ctx *clos, FILE *f) {
+  fputc('[', f);
+  for (int i = 0; i < clos->unsat_core_count; i++) {
+    fprintf(f, "{\"input\":%d,\"egress_block\":%d}", clos->unsat_core[i].input_id, clos->unsat_core[i].egress_block);
+    if (i + 1 < clos->unsat_core_count) fputc(',', f);
+  }
+  fputc(']', f);
+}
+
+static void json_write_route_alternatives(clos_ctx *clos, FILE *f) {
+  fputc('[', f);
+  for (int i = 0; i < clos->route_alternative_count; i++) {
+    const RouteAlternative *alt = &clos->route_alternatives[i];
+    fprintf(f, "{\"input\":%d,\"targets\":", alt->input_id);
+    json_write_int_array(f, alt->targets, alt->num_targets);
+    fprintf(f, ",\"reroutes\":%d}", alt->reroutes);
+    if (i + 1 < clos->route_alternative_count) fputc(',', f);
+  }
+  fputc(']', f);
+}
+
+static FabricStats compute_fabric_stats(clos_ctx *clos);  // Forward declaration
+
+static void write_state_json_stream(clos_ctx *clos, FILE *f) {
+  // Compute stats for JSON
+  FabricStats stats = compute_fabric_stats(clos);
+  double stability_reuse_pct = 100.0;
+  if (clos->initial_route_count > 0) {
+    int kept = clos->initial_route_count - clos->cumulative_reroutes;
+    if (kept < 0) kept = 0;
+    stability_reuse_pct = (kept * 100.0) / clos->initial_route_count;
+  }
+
+  fprintf(f, "{");
+  fprintf(f, "\"version\":1,");
+  fprintf(f, "\"N\":%d,", N);
+  fprintf(f, "\"TOTAL_BLOCKS\":%d,", TOTAL_BLOCKS);
+  fprintf(f, "\"MAX_PORTS\":%d,", MAX_PORTS);
+
+  fprintf(f, "\"s1_to_s2\":");
+  json_write_matrix_s1(clos, f);
+  fprintf(f, ",");
+
+  fprintf(f, "\"s2_to_s3\":");
+  json_write_matrix_s2(clos, f);
+  fprintf(f, ",");
+
+  fprintf(f, "\"s3_port_owner\":");
+  json_write_int_array(f, clos->s3_port_owner, MAX_PORTS + 1);
+  fprintf(f, ",");
+
+  fprintf(f, "\"s3_port_spine\":");
+  json_write_int_array(f, clos->s3_port_spine, MAX_PORTS + 1);
+  fprintf(f, ",");
+
+  fprintf(f, "\"desired_owner\":");
+  json_write_int_array(f, clos->desired_owner, MAX_PORTS + 1);
+  fprintf(f, ",");
+
+  // Legacy stability field
+  fprintf(f, "\"stability_changes\":%d,", clos->last_stability_cost);
+  fprintf(f, "\"strict_stability\":%s,", clos->strict_stability ? "true" : "false");
+  fprintf(f, "\"max_reroutes\":%d,", reroute_budget(clos));
+  fprintf(f, "\"incremental\":%s,", clos->incremental_mode ? "true" : "false");
+  fprintf(f, "\"lock_conflicts\":");
+  json_write_lock_conflicts(clos, f);
+  fprintf(f, ",");
+  fprintf(f, "\"unsat_core\":");
+  json_write_unsat_core(clos, f);
+  fprintf(f, ",");
+  fprintf(f, "\"unsat_core_input\":%d,", clos->unsat_core_input);
+  fprintf(f, "\"alternatives\":");
+  json_write_route_alternatives(clos, f);
+  fprintf(f, ",");
+  fprintf(f, "\"solve_ms\":%.3f,", clos->last_solve_us / 1000.0);
+  fprintf(f, "\"solve_total_ms\":%.3f,", clos->total_solve_us / 1000.0);
+  fprintf(f, "\"solve_nodes\":%lld,", clos->last_solve_nodes);
+  fprintf(f, "\"solve_nodes_total\":%lld,", clos->total_solve_nodes);
+  fprintf(f, "\"min_branches\":%s,", clos->min_branches_mode ? "true" : "false");
+  fprintf(f, "\"branch_nodes\":%lld,", clos->last_branch_nodes);
+  fprintf(f, "\"branch_nodes_total\":%lld,", clos->total_branch_nodes);
+  fprintf(f, "\"repack_count\":%d,", clos->repack_count);
+  fprintf(f, "\"cache_hits\":%d,", clos->solution_cache_hits);
+  fprintf(f, "\"cache_misses\":%d,", clos->solution_cache_misses);
+  fprintf(f, "\"repair_count\":%d,", clos->repair_count);
+  fprintf(f, "\"repair_attempts\":%d,", clos->repair_attempts);
+  fprintf(f, "\"repair_failures\":%d,", clos->repair_failures);
+  fprintf(f, "\"repair_ms\":%.3f,", clos->last_repair_us / 1000.0);
+  fprintf(f, "\"repair_total_ms\":%.3f,", clos->total_repair_us / 1000.0);
+  fprintf(f, "\"repair_nodes\":%lld,", clos->last_repair_nodes);
+  fprintf(f, "\"repair_nodes_total\":%lld,", clos->total_repair_nodes);
+  fprintf(f, "\"reroutes_demands\":%d,", clos->last_stability_cost);
+  fprintf(f, "\"reroutes_outputs\":%d,", clos->last_rerouted_outputs);
+  fprintf(f, "\"output_weighted\":%s,", clos->output_weighted ? "true" : "false");
+  fprintf(f, "\"reroute_cost\":%d,", clos->last_reroute_cost);
+  fprintf(f, "\"locked_demands\":%d,", clos->last_locked_demands);
+  fprintf(f, "\"locked_outputs\":%d,", clos->last_locked_outputs);
+
+  // New metrics
+  fprintf(f, "\"routes_active\":%d,", stats.routes_active);
+  fprintf(f, "\"routes_preserved\":%d,", stats.routes_preserved);
+  fprintf(f, "\"routes_new\":%d,", stats.routes_new);
+  fprintf(f, "\"routes_removed\":%d,", stats.routes_removed);
+  fprintf(f, "\"stability_reroutes\":%d,", clos->cumulative_reroutes);
+  fprintf(f, "\"stability_reuse_pct\":%.1f,", stability_reuse_pct);
+  fprintf(f, "\"inputs_with_mult\":%d,", stats.inputs_with_mult);
+  fprintf(f, "\"inputs_multi_spine\":%d,", stats.inputs_multi_spine);
+  fprintf(f, "\"egress_with_mult\":%d,", stats.egress_with_mult);
+  fprintf(f, "\"max_egress_load\":%d,", stats.max_egress_load);
+  fprintf(f, "\"active_spines\":%d,", stats.active_spines);
+  fprintf(f, "\"total_branches\":%d", stats.total_branches);
+
+  fprintf(f, "}\n");
+}
+
+static bool write_state_json(clos_ctx *clos, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror("json output file");
+    return false;
+  }
+
+  write_state_json_stream(clos, f);
+  fclose(f);
+  return true;
+}
+
+// --- PREVIOUS STATE LOADING -------------------------------------------------
+// Whole file as a NUL-terminated string (NULL on error)
+static char *read_text_file(const char *path, const char *what) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(what);
+    return NULL;
+  }
+
+  // Read entire file
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char *buf = malloc(len + 1);
+  if (!buf) {
+    fclose(f);
+    return NULL;
+  }
+
+  size_t read_len = fread(buf, 1, len, f);
+  buf[read_len] = '\0';
+  fclose(f);
+  return buf;
+}
+
+// Simple JSON parser for an int array under key (e.g. "\"s3_port_spine\":"): stores at most cap
+// values into out and returns how many, or -1 if the key or its array is missing
+static int parse_json_int_array(const char *buf, const char *key, int *out, int cap) {
+  const char *start = strstr(buf, key);
+  if (!start) return -1;
+
+  start = strchr(start, '[');
+  if (!start) return -1;
+  start++;  // skip '['
+
+  int idx = 0;
+  while (idx < cap && *start) {
+    // Skip whitespace
+    while (*start && (*start == ' ' || *start == '\n' || *start == '\r' || *start == '\t')) start++;
+
+    if (*start == ']') break;
+
+    // Parse number (may be negative)
+    int val = 0;
+    int sign = 1;
+    if (*start == '-') {
+      sign = -1;
+      start++;
+    }
+    while (*start >= '0' && *start <= '9') {
+      val = val * 10 + (*start - '0');
+      start++;
+    }
+    out[idx++] = sign * val;
+
+    // Skip comma and whitespace
+    while (*start && (*start == ',' || *start == ' ' || *start == '\n' || *start == '\r' || *start == '\t')) start++;
+  }
+  return idx;
+}
+
+// Extracts the s3_port_spine array from previous state JSON
+static bool parse_previous_state(clos_ctx *clos, const char *buf) {
+  // Initialize to -1 (no previous assignment)
+  for (int i = 0; i <= MAX_PORTS; i++) {
+    clos->prev_s3_port_spine[i] = -1;
+  }
+
+  if (parse_json_int_array(buf, "\"s3_port_spine\":", clos->prev_s3_port_spine, MAX_PORTS + 1) < 0) return false;
+
+  clos->have_previous_state = true;
+  recount_fabric_stats(clos);  // preserved/new/removed are relative to the previous state
+  return true;
+}
+
+static bool load_previous_state(clos_ctx *clos, const char *path) {
+  char *buf = read_text_file(path, "previous state file");
+  if (!buf) return false;
+
+  bool ok = parse_previous_state(clos, buf);
+  free(buf);
+  return ok;
+}
+
+// --- DEBUG / VISUALIZATION --------------------------------------------------
+static void print_heatmap(clos_ctx *clos) {
+  fprintf(clos->out, "\n--- SPINE-TO-EGRESS UTILIZATION HEATMAP (s2_to_s3) ---\n");
+  fprintf(clos->out, "       ");
+  for (int s = 0; s < N; s++) {
+    fprintf(clos->out, "S%02d ", s + 1);
+  }
+  fprintf(clos->out, "\n");
+  for (int e = 0; e < TOTAL_BLOCKS; e++) {
+    fprintf(clos->out, "Egr %2d: ", e + 1);
+    for (int s = 0; s < N; s++) {
+      if (clos->s2_to_s3[s][e] != 0) fprintf(clos->out, "[%02d] ", clos->s2_to_s3[s][e]);
+      else fprintf(clos->out, "[  ] ");
+    }
+    fprintf(clos->out, "\n");
+  }
+  fprintf(clos->out, "-----------------------------------------------------\n");
+}
+
+static void print_port_map_summary(clos_ctx *clos) {
+  fprintf(clos->out, "\n--- OUTPUT PORT SELECTIONS (Stage3) ---\n");
+  int shown = 0;
+  int total = 0;
+
+  for (int p = 1; p <= MAX_PORTS; p++) if (clos->s3_port_owner[p] != 0) total++;
+
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    if (clos->s3_port_owner[p] == 0) continue;
+
+    fprintf(clos->out, "Out %3d -> Input %3d via Spine %2d (EgrBlock %2d)\n",
+      p,
+      clos->s3_port_owner[p],
+      clos->s3_port_spine[p] + 1,
+      get_block(clos, p) + 1
+    );
+
+    shown++;
+    if (shown >= 40 && total > shown) {
+      fprintf(clos->out, "... (%d more)\n", total - shown);
+      break;
+    }
+  }
+
+  if (total == 0) fprintf(clos->out, "(none)\n");
+  fprintf(clos->out, "--------------------------------------\n");
+}
+
+// --- FABRIC STATISTICS (implementation) -------------------------------------
+// Every write to the realized fabric goes through fabric_claim_trunk(), fabric_release_trunk() or
+// fabric_set_port(), which keep s1_to_s2, current_spine_for and the FabricStats counters in step.
+// Commit and repair touch only what changed, so statistics never need a full-fabric pass.
+// The same writes feed the touched set that validate_fabric() checks.
+
+static void touch_trunk(clos_ctx *clos, int s, int e) {
+  int idx = s * TOTAL_BLOCKS + e;
+  if (clos->trunk_touched[idx]) return;
+  clos->trunk_touched[idx] = true;
+  clos->touched_trunks[clos->touched_trunk_count++] = idx;
+}
+
+static void touch_port(clos_ctx *clos, int p) {
+  if (p == 0 || clos->port_touched[p]) return;  // Port 0 is unused
+  clos->port_touched[p] = true;
+  clos->touched_ports[clos->touched_port_count++] = p;
+}
+
+static void clear_touched(clos_ctx *clos) {
+  for (int i = 0; i < clos->touched_trunk_count; i++) clos->trunk_touched[clos->touched_trunks[i]] = false;
+  for (int i = 0; i < clos->touched_port_count; i++) clos->port_touched[clos->touched_ports[i]] = false;
+  clos->touched_trunk_count = 0;
+  clos->touched_port_count = 0;
+}
+
+static void stats_account_port(clos_ctx *clos, int p, int sign) {
+  if (p == 0) return;  // Port 0 is unused
+  int owner = clos->s3_port_owner[p];
+  int spine = clos->s3_port_spine[p];
+  int prev_spine = clos->prev_s3_port_spine[p];
+
+  if (owner > 0 && spine >= 0) {
+    clos->live_stats.routes_active += sign;
+    if (!clos->have_previous_state || prev_spine < 0) {
+      clos->live_stats.routes_new += sign;  // No previous state means all are "new"
+    } else if (prev_spine == spine) {
+      clos->live_stats.routes_preserved += sign;
+    }
+    // Routes that existed but changed spine are tracked by cumulative_reroutes, not here
+
+    int before = clos->outputs_per_input[owner];
+    clos->outputs_per_input[owner] += sign;
+    if (before < 2 && clos->outputs_per_input[owner] >= 2) clos->live_stats.inputs_with_mult++;
+    if (before >= 2 && clos->outputs_per_input[owner] < 2) clos->live_stats.inputs_with_mult--;
+  }
+
+  // Removed: had a previous spine but is now disconnected
+  if (clos->have_previous_state && prev_spine >= 0 && spine < 0) clos->live_stats.routes_removed += sign;
+}
+
+static void stats_account_trunk(clos_ctx *clos, int s, int e, int in_id, int sign) {
+  int before = clos->egress_load[e];
+  int after = before + sign;
+  clos->egress_load[e] = after;
+  clos->egress_load_hist[before]--;
+  clos->egress_load_hist[after]++;
+  if (after > clos->live_stats.max_egress_load) clos->live_stats.max_egress_load = after;
+  if (before == clos->live_stats.max_egress_load && clos->egress_load_hist[before] == 0) clos->live_stats.max_egress_load = after;
+  if (before < 2 && after >= 2) clos->live_stats.egress_with_mult++;
+  if (before >= 2 && after < 2) clos->live_stats.egress_with_mult--;
+
+  if (clos->spine_load[s] == 0 && sign > 0) clos->live_stats.active_spines++;
+  clos->spine_load[s] += sign;
+  if (clos->spine_load[s] == 0 && sign < 0) clos->live_stats.active_spines--;
+
+  int *use = &clos->input_spine_use[(size_t)in_id * (size_t)N + (size_t)s];
+  int spines_before = clos->input_spine_count[in_id];
+  if (*use == 0 && sign > 0) clos->input_spine_count[in_id]++;
+  *use += sign;
+  if (*use == 0 && sign < 0) clos->input_spine_count[in_id]--;
+  clos->live_stats.total_branches += clos->input_spine_count[in_id] - spines_before;
+  if (spines_before < 2 && clos->input_spine_count[in_id] >= 2) clos->live_stats.inputs_multi_spine++;
+  if (spines_before >= 2 && clos->input_spine_count[in_id] < 2) clos->live_stats.inputs_multi_spine--;
+}
+
+static void fabric_release_trunk(clos_ctx *clos, int s, int e) {
+  int in_id = clos->s2_to_s3[s][e];
+  if (in_id == 0) return;
+  touch_trunk(clos, s, e);
+  stats_account_trunk(clos, s, e, in_id, -1);
+  clos->s2_to_s3[s][e] = 0;
+  clos->repair_s2[s][e] = 0;
+  if (clos->current_spine_for[in_id][e] == s) clos->current_spine_for[in_id][e] = -1;
+  if (clos->input_spine_use[(size_t)in_id * (size_t)N + (size_t)s] == 0) {
+    clos->s1_to_s2[get_block(clos, in_id)][s] = 0;
+    clos->repair_s1_owner[get_block(clos, in_id)][s] = 0;
+    bitset_clear(bitset_row(clos->repair_spines_mask, in_id, clos->repair_spine_words), s);
+  }
+}
+
+// The trunk must be free; release changed trunks before claiming new ones
+static void fabric_claim_trunk(clos_ctx *clos, int s, int e, int in_id) {
+  touch_trunk(clos, s, e);
+  clos->s2_to_s3[s][e] = in_id;
+  clos->repair_s2[s][e] = in_id;
+  clos->current_spine_for[in_id][e] = s;
+  clos->s1_to_s2[get_block(clos, in_id)][s] = in_id;
+  clos->repair_s1_owner[get_block(clos, in_id)][s] = in_id;
+  bitset_set(bitset_row(clos->repair_spines_mask, in_id, clos->repair_spine_words), s);
+  stats_account_trunk(clos, s, e, in_id, +1);
+}
+
+static void fabric_set_port(clos_ctx *clos, int p, int owner, int spine) {
+  touch_port(clos, p);
+  stats_account_port(clos, p, -1);
+  clos->s3_port_owner[p] = owner;
+  clos->s3_port_spine[p] = spine;
+  stats_account_port(clos, p, +1);
+}
+
+// Rebuilds the counters from the fabric arrays (init and previous-state load)
+static void recount_fabric_stats(clos_ctx *clos) {
+  clos->live_stats = (FabricStats){0};
+  memset(clos->outputs_per_input, 0, sizeof(int) * ((size_t)MAX_PORTS + 1));
+  memset(clos->input_spine_use, 0, sizeof(int) * ((size_t)MAX_PORTS + 1) * (size_t)N);
+  memset(clos->input_spine_count, 0, sizeof(int) * ((size_t)MAX_PORTS + 1));
+  memset(clos->egress_load, 0, sizeof(int) * (size_t)TOTAL_BLOCKS);
+  memset(clos->egress_load_hist, 0, sizeof(int) * ((size_t)N + 1));
+  memset(clos->spine_load, 0, sizeof(int) * (size_t)N);
+  clos->egress_load_hist[0] = TOTAL_BLOCKS;
+
+  for (int s = 0; s < N; s++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (clos->s2_to_s3[s][e] != 0) stats_account_trunk(clos, s, e, clos->s2_to_s3[s][e], +1);
+    }
+  }
+  for (int p = 1; p <= MAX_PORTS; p++) stats_account_port(clos, p, +1);
+}
+
+static FabricStats compute_fabric_stats(clos_ctx *clos) {
+  FabricStats stats = clos->live_stats;
+  if (stats.max_egress_load > 0) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (clos->egress_load[e] == stats.max_egress_load) {
+        stats.max_egress_block = e + 1;  // 1-indexed for display
+        break;
+      }
+    }
+  }
+  return stats;
+}
+
+static void print_fabric_summary(clos_ctx *clos) {
+  FabricStats stats = compute_fabric_stats(clos);
+
+  fprintf(clos->out, "\n=== Fabric Summary ===\n");
+
+  // Routes section
+  fprintf(clos->out, "Routes: %d active", stats.routes_active);
+  if (clos->have_previous_state || stats.routes_new > 0) {
+    fprintf(clos->out, " (%d preserved, %d new", stats.routes_preserved, stats.routes_new);
+    if (stats.routes_removed > 0) {
+      fprintf(clos->out, ", %d removed", stats.routes_removed);
+    }
+    fprintf(clos->out, ")");
+  }
+  fprintf(clos->out, "\n");
+
+  // Stability section
+  if (clos->plan_mode) {
+    fprintf(clos->out, "Stability: rerouted demands %d, outputs %d across the session (each command against the one before)\n",
+           clos->cumulative_reroutes, clos->cumulative_output_reroutes);
+  } else if (clos->initial_route_count > 0) {
+    int total_existing = clos->initial_route_count;
+    int kept = total_existing - clos->cumulative_reroutes;
+    if (kept < 0) kept = 0;  // sanity
+    double pct = (total_existing > 0) ? (kept * 100.0 / total_existing) : 100.0;
+    fprintf(clos->out, "Stability: %.1f%% reuse", pct);
+    if (clos->cumulative_reroutes > 0 || clos->cumulative_output_reroutes > 0) {
+      fprintf(clos->out, " (rerouted demands %d, outputs %d across all commands)", clos->cumulative_reroutes,
+              clos->cumulative_output_reroutes);
+    }
+    fprintf(clos->out, "\n");
+  }
+
+  if (clos->repack_count > 0) {
+    fprintf(clos->out, "Solve time: last %.3f ms, total %.3f ms (%d repack%s)\n",
+           clos->last_solve_us / 1000.0, clos->total_solve_us / 1000.0, clos->repack_count, clos->repack_count == 1 ? "" : "s");
+  }
+  if (clos->repair_attempts > 0) {
+    int repaired = clos->repair_attempts - clos->repair_failures;
+    fprintf(clos->out, "Incremental repair: %d/%d edits repaired in place (%.1f%%), %d fell back to a repack\n",
+           repaired, clos->repair_attempts, repaired * 100.0 / clos->repair_attempts, clos->repair_failures);
+  }
+  {
+    long long total_nodes = clos->total_solve_nodes + clos->total_repair_nodes;
+    long long total_us = clos->total_solve_us + clos->total_repair_us;
+    if (total_nodes > 0 && total_us > 0) {
+      double total_nodes_per_sec = (double)total_nodes * 1000000.0 / (double)total_us;
+      double last_nodes_per_sec = 0.0;
+      const char *last_label = "n/a";
+      if (clos->last_solve_us > 0) {
+        last_label = "solve";
+        last_nodes_per_sec = (double)clos->last_solve_nodes * 1000000.0 / (double)clos->last_solve_us;
+      } else if (clos->last_repair_us > 0) {
+        last_label = "repair";
+        last_nodes_per_sec = (double)clos->last_repair_nodes * 1000000.0 / (double)clos->last_repair_us;
+      }
+      fprintf(clos->out, "Backtracking throughput: last %s %.1f nodes/sec, total %.1f nodes/sec\n",
+             last_label, last_nodes_per_sec, total_nodes_per_sec);
+    } else {
+      fprintf(clos->out, "Backtracking throughput: n/a (no backtracking nodes)\n");
+    }
+  }
+
+  // Multicast section
+  fprintf(clos->out, "\nMulticast:\n");
+  fprintf(clos->out, "  Inputs with mult fanout: %d (inputs using 2+ outputs)\n", stats.inputs_with_mult);
+  fprintf(clos->out, "  Inputs using 2+ spines: %d (branching in middle layer)\n", stats.inputs_multi_spine);
+  fprintf(clos->out, "  Egress blocks with 2+ inputs: %d (mult in egress)\n", stats.egress_with_mult);
+
+  if (clos->last_locked_demands > 0 || clos->last_locked_outputs > 0) {
+    fprintf(clos->out, "  Locked demands: %d (locked outputs: %d)\n", clos->last_locked_demands, clos->last_locked_outputs);
+  }
+
+  // Capacity section
+  fprintf(clos->out, "\nCapacity:\n");
+  if (stats.max_egress_load > 0) {
+    fprintf(clos->out, "  Most loaded egress block: %d/%d inputs (block %d)\n",
+           stats.max_egress_load, N, stats.max_egress_block);
+  } else {
+    fprintf(clos->out, "  Most loaded egress block: 0/%d inputs\n", N);
+  }
+  fprintf(clos->out, "  Active spines: %d/%d\n", stats.active_spines, N);
+  fprintf(clos->out, "  Total branches: %d\n", stats.total_branches);
+}
+
+// --- INVARIANT CHECKER ------------------------------------------------------
+// 1) s2_to_s3 trunks imply corresponding s1_to_s2 ownership
+static bool validate_trunk(clos_ctx *clos, int **s1, int **s2, int s, int e, bool verbose) {
+  int in_id = s2[s][e];
+  if (in_id == 0) return true;
+  if (!is_valid_port(clos, in_id)) {
+    if (verbose) fprintf(clos->out, "VALIDATION FAIL: s2_to_s3[%d][%d]=%d out of range\n", s, e, in_id);
+    return false;
+  }
+  int ingress = get_block(clos, in_id);
+  if (s1[ingress][s] != in_id) {
+    if (verbose) fprintf(clos->out, "VALIDATION FAIL: trunk s2_to_s3[%d][%d]=%d but s1_to_s2[%d][%d]=%d\n",
+      s, e, in_id, ingress, s, s1[ingress][s]);
+    return false;
+  }
+  return true;
+}
+
+// 2) Stage3 port selections must match s2_to_s3
+// 3) Fabric should realize desired_owner exactly
+static bool validate_port(clos_ctx *clos, int **s2, const int *port_owner, const int *port_spine, int p, bool verbose) {
+  int owner = port_owner[p];
+  int spine = port_spine[p];
+
+  if (owner == 0) {
+    if (spine != -1) {
+      if (verbose) fprintf(clos->out, "VALIDATION FAIL: port %d owner=0 but spine=%d\n", p, spine);
+      return false;
+    }
+  } else {
+    if (!is_valid_port(clos, owner) || spine < 0 || spine >= N) {
+      if (verbose) fprintf(clos->out, "VALIDATION FAIL: port %d has invalid owner/spine (%d/%d)\n", p, owner, spine);
+      return false;
+    }
+
+    int e = get_block(clos, p);
+    if (s2[spine][e] != owner) {
+      if (verbose) fprintf(clos->out, "VALIDATION FAIL: port %d wants (spine %d,egr %d) but trunk holds %d\n",
+        p, spine + 1, e + 1, s2[spine][e]);
+      return false;
+    }
+  }
+
+  if (clos->desired_owner[p] != owner) {
+    if (verbose) fprintf(clos->out, "VALIDATION FAIL: desired_owner[%d]=%d but s3_port_owner[%d]=%d\n",
+      p, clos->desired_owner[p], p, owner);
+    return false;
+  }
+  return true;
+}
+
+static bool validate_fabric_state(clos_ctx *clos, int **s1, int **s2, const int *port_owner, const int *port_spine,
+                                  bool verbose) {
+  for (int s = 0; s < N; s++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (!validate_trunk(clos, s1, s2, s, e, verbose)) return false;
+    }
+  }
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    if (!validate_port(clos, s2, port_owner, port_spine, p, verbose)) return false;
+  }
+  return true;
+}
+
+// Checks only what changed since the last validation. A touched trunk also re-checks the ports of
+// its egress block that select its spine, so a released trunk cannot leave a port dangling.
+static bool validate_touched(clos_ctx *clos, bool verbose) {
+  for (int i = 0; i < clos->touched_trunk_count; i++) {
+    int s = clos->touched_trunks[i] / TOTAL_BLOCKS;
+    int e = clos->touched_trunks[i] % TOTAL_BLOCKS;
+    if (!validate_trunk(clos, clos->s1_to_s2, clos->s2_to_s3, s, e, verbose)) return false;
+    for (int p = e * N + 1; p <= (e + 1) * N; p++) {
+      if (clos->s3_port_spine[p] == s &&
+          !validate_port(clos, clos->s2_to_s3, clos->s3_port_owner, clos->s3_port_spine, p, verbose)) {
+        return false;
+      }
+    }
+  }
+  for (int i = 0; i < clos->touched_port_count; i++) {
+    if (!validate_port(clos, clos->s2_to_s3, clos->s3_port_owner, clos->s3_port_spine, clos->touched_ports[i], verbose)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Called after every commit: touched-only in release runs, with a full pass every
+// FULL_VALIDATION_INTERVAL commits and on every commit under --paranoid.
+static bool validate_fabric(clos_ctx *clos, bool verbose) {
+  bool full = clos->paranoid_mode || ++clos->commits_since_full_check >= FULL_VALIDATION_INTERVAL;
+  bool ok = full ? validate_fabric_state(clos, clos->s1_to_s2, clos->s2_to_s3, clos->s3_port_owner, clos->s3_port_spine, verbose)
+                 : validate_touched(clos, verbose);
+  if (full) clos->commits_since_full_check = 0;
+  clear_touched(clos);
+  return ok;
+}
+
+// --- COMPLETE GLOBAL SOLVER --------------------------------------------------
+//
+// We solve the constraint problem by building one variable per (input_id, egress_block) demand:
+// - demand exists if any output port in that egress block is owned by that input in desired_owner[]
+//
+// Assigning a spine to (input_id, egress_block) means:
+// - reserve (spine, egress_block) trunk for that input (Stage2)
+// - reserve (ingress_block(input_id), spine) trunk for that input (Stage1)
+//
+// Constraints:
+// - each (spine, egress_block) trunk can be owned by at most one input
+// - each (ingress_block, spine) trunk can be owned by at most one input
+//
+// Then Stage3 selection is trivial: each output port picks the spine assigned to its (input, egress_block).
+//
+
+typedef struct {
+  int port;
+  int prev_owner;
+} PortEdit;
+
+typedef struct {
+  // candidate solution buffers
+  int **s1;
+  int *s1_storage;
+  int **s2;
+  int *s2_storage;
+  int *s3_owner;
+  int *s3_spine;
+} FabricSolution;
+
+static void free_solution(FabricSolution *sol) {
+  if (!sol) return;
+  free_int_matrix(sol->s1, sol->s1_storage);
+  free_int_matrix(sol->s2, sol->s2_storage);
+  free(sol->s3_owner);
+  free(sol->s3_spine);
+  *sol = (FabricSolution){0};
+}
+
+static void free_solver_scratch(clos_ctx *clos) {
+  SolverScratch *sc = &clos->solver_scratch;
+  free(sc->demands);
+  free(sc->demands_backup);
+  free(sc->active_inputs);
+  free(sc->need_blocks_mask);
+  free_int_matrix(sc->tmp_s2, sc->tmp_s2_storage);
+  free_int_matrix(sc->tmp_s1_owner, sc->tmp_s1_owner_storage);
+  free(sc->used_spines_mask);
+  free(sc->assignment);
+  free(sc->best_assignment);
+  free(sc->best_demands);
+  free(sc->spine_use_count);
+  free(sc->lock_spines_mask);
+  free_int_matrix(sc->prev_spine_for, sc->prev_spine_for_storage);
+  free_int_matrix(sc->unset_spine_for, sc->unset_spine_for_storage);
+  free_int_matrix(sc->reroute_weight, sc->reroute_weight_storage);
+  free_int_matrix(sc->kernel_s2_claim, sc->kernel_s2_claim_storage);
+  free_int_matrix(sc->kernel_s1_claim, sc->kernel_s1_claim_storage);
+  free(sc->kernel_hot_egress);
+  free(sc->kernel_hot_ingress);
+  free_int_matrix(sc->ls_s2_count, sc->ls_s2_count_storage);
+  free_int_matrix(sc->ls_s1_count, sc->ls_s1_count_storage);
+  free_int_matrix(sc->ls_input_use, sc->ls_input_use_storage);
+  free_int_matrix(sc->demand_activity, sc->demand_activity_storage);
+  free_int_matrix(sc->plan_hint, sc->plan_hint_storage);
+  *sc = (SolverScratch){0};
+}
+
+static bool init_solver_scratch(clos_ctx *clos) {
+  SolverScratch *sc = &clos->solver_scratch;
+  free_solver_scratch(clos);
+
+  sc->max_demands = (int)clos->max_demands;
+  sc->block_words = bitset_words(TOTAL_BLOCKS);
+  sc->spine_words = bitset_words(N);
+
+  int max_demands = sc->max_demands;
+  int block_words = sc->block_words;
+  int spine_words = sc->spine_words;
+
+  sc->demands = malloc(sizeof(Demand) * (size_t)max_demands);
+  sc->demands_backup = malloc(sizeof(Demand) * (size_t)max_demands);
+  sc->active_inputs = malloc(sizeof(int) * ((size_t)MAX_PORTS + 1));
+  sc->need_blocks_mask = malloc(sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)block_words);
+  sc->tmp_s2 = alloc_int_matrix(N, TOTAL_BLOCKS, &sc->tmp_s2_storage);
+  sc->tmp_s1_owner = alloc_int_matrix(TOTAL_BLOCKS, N, &sc->tmp_s1_owner_storage);
+  sc->used_spines_mask = malloc(sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)spine_words);
+  sc->assignment = malloc(sizeof(int) * (size_t)max_demands);
+  sc->best_assignment = malloc(sizeof(int) * (size_t)max_demands);
+  sc->best_demands = malloc(sizeof(Demand) * (size_t)max_demands);
+  sc->spine_use_count = calloc(((size_t)MAX_PORTS + 1) * (size_t)N, sizeof(int));
+  sc->lock_spines_mask = malloc(sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)spine_words);
+  sc->prev_spine_for = alloc_int_matrix(MAX_PORTS + 1, TOTAL_BLOCKS, &sc->prev_spine_for_storage);
+  sc->unset_spine_for = alloc_int_matrix(MAX_PORTS + 1, TOTAL_BLOCKS, &sc->unset_spine_for_storage);
+  sc->reroute_weight = alloc_int_matrix(MAX_PORTS + 1, TOTAL_BLOCKS, &sc->reroute_weight_storage);
+  sc->kernel_s2_claim = alloc_int_matrix(N, TOTAL_BLOCKS, &sc->kernel_s2_claim_storage);
+  sc->kernel_s1_claim = alloc_int_matrix(TOTAL_BLOCKS, N, &sc->kernel_s1_claim_storage);
+  sc->kernel_hot_egress = calloc((size_t)TOTAL_BLOCKS, sizeof(bool));
+  sc->kernel_hot_ingress = calloc((size_t)TOTAL_BLOCKS, sizeof(bool));
+  sc->ls_s2_count = alloc_int_matrix(N, TOTAL_BLOCKS, &sc->ls_s2_count_storage);
+  sc->ls_s1_count = alloc_int_matrix(TOTAL_BLOCKS, N, &sc->ls_s1_count_storage);
+  sc->ls_input_use = alloc_int_matrix(MAX_PORTS + 1, N, &sc->ls_input_use_storage);
+  sc->demand_activity = alloc_int_matrix(MAX_PORTS + 1, TOTAL_BLOCKS, &sc->demand_activity_storage);
+  sc->plan_hint = alloc_int_matrix(MAX_PORTS + 1, TOTAL_BLOCKS, &sc->plan_hint_storage);
+
+  if (!sc->demands || !sc->demands_backup || !sc->active_inputs || !sc->need_blocks_mask ||
+      !sc->tmp_s2 || !sc->tmp_s1_owner || !sc->used_spines_mask ||
+      !sc->assignment || !sc->best_assignment || !sc->best_demands ||
+      !sc->spine_use_count || !sc->lock_spines_mask || !sc->prev_spine_for ||
+      !sc->unset_spine_for || !sc->reroute_weight || !sc->kernel_s2_claim ||
+      !sc->kernel_s1_claim || !sc->kernel_hot_egress || !sc->kernel_hot_ingress ||
+      !sc->ls_s2_count || !sc->ls_s1_count || !sc->ls_input_use ||
+      !sc->demand_activity || !sc->plan_hint) {
+    free_solver_scratch(clos);
+    return false;
+  }
+
+  for (size_t i = 0; i < ((size_t)MAX_PORTS + 1) * (size_t)TOTAL_BLOCKS; i++) {
+    sc->unset_spine_for_storage[i] = -1;
+  }
+
+  sc->initialized = true;
+  return true;
+}
+
+// Builds demands from desired_owner and returns count
+static int build_demands(clos_ctx *clos, Demand *demands, int max_demands, int *active_inputs, int *active_count,
+                         uint64_t *need_blocks_mask, int block_words) {
+  // need_blocks_mask[input_id] is a bitset of egress blocks required by that input
+  memset(need_blocks_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)block_words);
+
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    int in_id = clos->desired_owner[p];
+    if (in_id == 0) continue;
+    int e = get_block(clos, p);
+    bitset_set(bitset_row(need_blocks_mask, in_id, block_words), e);
+  }
+
+  int a = 0;
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    if (bitset_any(bitset_row_const(need_blocks_mask, in_id, block_words), block_words)) {
+      active_inputs[a++] = in_id;
+    }
+  }
+  *active_count = a;
+
+  int d = 0;
+  for (int idx = 0; idx < a; idx++) {
+    int in_id = active_inputs[idx];
+    int ingress = get_block(clos, in_id);
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (bitset_test(bitset_row_const(need_blocks_mask, in_id, block_words), e)) {
+        if (d >= max_demands) {
+          fprintf(stderr, "INTERNAL ERROR: demand overflow (%d >= %d)\n", d, max_demands);
+          return -1;
+        }
+        demands[d++] = (Demand){ .input_id = in_id, .ingress_block = ingress, .egress_block = e };
+      }
+    }
+  }
+
+  return d;
+}
+
+static void print_unsat_reason(clos_ctx *clos, const uint64_t *need_blocks_mask, int block_words) {
+  // Count distinct inputs per egress block and per ingress block
+  int *inputs_per_egress = calloc((size_t)TOTAL_BLOCKS, sizeof(int));
+  int *inputs_per_ingress = calloc((size_t)TOTAL_BLOCKS, sizeof(int));
+  if (!inputs_per_egress || !inputs_per_ingress) {
+    free(inputs_per_egress);
+    free(inputs_per_ingress);
+    return;
+  }
+
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    if (!bitset_any(bitset_row_const(need_blocks_mask, in_id, block_words), block_words)) continue;
+    inputs_per_ingress[get_block(clos, in_id)]++;
+
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (bitset_test(bitset_row_const(need_blocks_mask, in_id, block_words), e)) inputs_per_egress[e]++;
+    }
+  }
+
+  fprintf(clos->out, "  UNSAT DETAILS:\n");
+  for (int e = 0; e < TOTAL_BLOCKS; e++) {
+    if (inputs_per_egress[e] > 0) {
+      fprintf(clos->out, "    Egress block %2d needs %2d distinct inputs (capacity %d)\n", e + 1, inputs_per_egress[e], N);
+    }
+  }
+  for (int i = 0; i < TOTAL_BLOCKS; i++) {
+    if (inputs_per_ingress[i] > 0) {
+      fprintf(clos->out, "    Ingress block %2d has %2d active inputs (capacity %d spines)\n", i + 1, inputs_per_ingress[i], N);
+    }
+  }
+
+  free(inputs_per_egress);
+  free(inputs_per_ingress);
+}
+
+static bool quick_capacity_check(clos_ctx *clos, const uint64_t *need_blocks_mask, int block_words) {
+  // Egress capacity: each egress block has N trunks (one per spine)
+  for (int e = 0; e < TOTAL_BLOCKS; e++) {
+    int count = 0;
+    for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+      if (bitset_test(bitset_row_const(need_blocks_mask, in_id, block_words), e)) count++;
+    }
+    if (count > N) return false;
+  }
+
+  // Ingress capacity: each ingress block has N spines; each active input needs at least 1 spine
+  // (In this model, an input cannot share a spine with another input from the same ingress block.)
+  for (int i = 0; i < TOTAL_BLOCKS; i++) {
+    int count = 0;
+    for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+      if (!bitset_any(bitset_row_const(need_blocks_mask, in_id, block_words), block_words)) continue;
+      if (get_block(clos, in_id) == i) count++;
+    }
+    if (count > N) return false;
+  }
+
+  return true;
+}
+
+// --- MATCHING PRE-CHECK ----------------------------------------------------
+//
+// quick_capacity_check() only counts inputs per block. When it passes on an infeasible state,
+// backtrack() has to prove UNSAT exhaustively. Before that happens (i.e. when the greedy seed fails)
+// we run a polynomial check over spine domains, one uint64_t mask per demand (N <= 64):
+//
+// - a locked demand has a single spine
+// - a demand down to a single spine owns both its trunks: the spine leaves every other input's
+//   domain in that egress block (Stage2) and in that ingress block (Stage1)
+// - inputs of one ingress block use disjoint spine sets, so if a block has exactly as many usable
+//   spines as active inputs, each input is limited to one spine: its demands share the intersection
+// - Hall's condition by bipartite matching, per egress block (demands -> distinct spines) and per
+//   ingress block (inputs -> private spines)
+//
+// Rules run to a fixpoint. Any failure proves UNSAT; the check is sound but not complete.
+
+typedef enum {
+  PRECHECK_OK = 0,
+  PRECHECK_EMPTY_DOMAIN,
+  PRECHECK_EGRESS_HALL,
+  PRECHECK_INGRESS_HALL
+} PrecheckFailureKind;
+
+typedef struct {
+  PrecheckFailureKind kind;
+  int input_id;       // PRECHECK_EMPTY_DOMAIN
+  int block;          // egress or ingress block (0-based)
+  int items;          // demands / inputs in the deficient Hall set
+  int spines;         // spines available to that set
+} PrecheckFailure;
+
+static bool hall_augment(const uint64_t *masks, int item, int *spine_owner, uint64_t *visited) {
+  uint64_t cand = masks[item];
+  while (cand) {
+    int s = __builtin_ctzll(cand);
+    cand &= cand - 1;
+    if (*visited & (1ULL << s)) continue;
+    *visited |= 1ULL << s;
+    if (spine_owner[s] < 0 || hall_augment(masks, spine_owner[s], spine_owner, visited)) {
+      spine_owner[s] = item;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Kuhn matching of items to distinct spines. On failure, reports a deficient Hall set:
+// the items reached from the unmatched one versus the spines they can use.
+static bool hall_match(const uint64_t *masks, int count, int *out_items, int *out_spines) {
+  int spine_owner[64];
+  for (int s = 0; s < 64; s++) spine_owner[s] = -1;
+
+  for (int item = 0; item < count; item++) {
+    uint64_t visited = 0;
+    if (!hall_augment(masks, item, spine_owner, &visited)) {
+      *out_spines = __builtin_popcountll(visited);
+      *out_items = *out_spines + 1;
+      return false;
+    }
+  }
+  return true;
+}
+
+// demands must be in build_demands() order (grouped by input, inputs ascending)
+static bool matching_precheck(clos_ctx *clos, const Demand *demands, int num_demands, PrecheckFailure *failure) {
+  *failure = (PrecheckFailure){0};
+  if (N > 64 || num_demands == 0) return true;
+
+  uint64_t full = (N == 64) ? ~0ULL : ((1ULL << N) - 1);
+  uint64_t *dom = malloc(sizeof(uint64_t) * (size_t)num_demands);
+  bool *propagated = calloc((size_t)num_demands, sizeof(bool));
+  int *input_start = malloc(sizeof(int) * ((size_t)num_demands + 1));  // demand ranges per input
+  int *egress_items = malloc(sizeof(int) * (size_t)num_demands);        // demand indices by egress block
+  int *egress_start = calloc((size_t)TOTAL_BLOCKS + 1, sizeof(int));
+  uint64_t *masks = malloc(sizeof(uint64_t) * (size_t)(num_demands > N ? num_demands : N));
+  if (!dom || !propagated || !input_start || !egress_items || !egress_start || !masks) {
+    free(dom); free(propagated); free(input_start); free(egress_items); free(egress_start); free(masks);
+    return true;  // no verdict; the search stays complete
+  }
+
+  int input_count = 0;
+  for (int i = 0; i < num_demands; i++) {
+    if (i == 0 || demands[i].input_id != demands[i - 1].input_id) input_start[input_count++] = i;
+    int locked = clos->have_locks ? clos->lock_spine_for[demands[i].input_id][demands[i].egress_block] : -1;
+    dom[i] = locked >= 0 ? (1ULL << locked) : full;
+    egress_start[demands[i].egress_block + 1]++;
+  }
+  input_start[input_count] = num_demands;
+  for (int e = 0; e < TOTAL_BLOCKS; e++) egress_start[e + 1] += egress_start[e];
+  {
+    int *fill = calloc((size_t)TOTAL_BLOCKS, sizeof(int));
+    if (!fill) {
+      free(dom); free(propagated); free(input_start); free(egress_items); free(egress_start); free(masks);
+      return true;
+    }
+    for (int i = 0; i < num_demands; i++) {
+      int e = demands[i].egress_block;
+      egress_items[egress_start[e] + fill[e]++] = i;
+    }
+    free(fill);
+  }
+
+  bool ok = true;
+  bool changed = true;
+  while (ok && changed) {
+    changed = false;
+
+    // Singletons own their Stage2 and Stage1 trunks
+    for (int i = 0; i < num_demands; i++) {
+      if (propagated[i] || __builtin_popcountll(dom[i]) != 1) continue;
+      propagated[i] = true;
+      changed = true;
+
+      uint64_t bit = dom[i];
+      int in_id = demands[i].input_id;
+      int e = demands[i].egress_block;
+      for (int k = egress_start[e]; k < egress_start[e + 1]; k++) {
+        int j = egress_items[k];
+        if (demands[j].input_id != in_id) dom[j] &= ~bit;
+      }
+      for (int k = 0; k < input_count; k++) {
+        int first = input_start[k];
+        if (demands[first].ingress_block != demands[i].ingress_block || demands[first].input_id == in_id) continue;
+        for (int j = first; j < input_start[k + 1]; j++) dom[j] &= ~bit;
+      }
+    }
+
+    for (int i = 0; i < num_demands; i++) {
+      if (dom[i] == 0) {
+        *failure = (PrecheckFailure){ .kind = PRECHECK_EMPTY_DOMAIN, .input_id = demands[i].input_id,
+                                      .block = demands[i].egress_block };
+        ok = false;
+        break;
+      }
+    }
+    if (!ok) break;
+
+    // Per ingress block: private spines (Hall) and the one-spine-per-input squeeze
+    for (int k = 0; k < input_count && ok; ) {
+      int ingress = demands[input_start[k]].ingress_block;
+      int block_first = k;
+      uint64_t usable = 0;
+      for (; k < input_count && demands[input_start[k]].ingress_block == ingress; k++) {
+        uint64_t u = 0;
+        for (int j = input_start[k]; j < input_start[k + 1]; j++) u |= dom[j];
+        masks[k - block_first] = u;
+        usable |= u;
+      }
+      int inputs_here = k - block_first;
+
+      int items = 0, spines = 0;
+      if (!hall_match(masks, inputs_here, &items, &spines)) {
+        *failure = (PrecheckFailure){ .kind = PRECHECK_INGRESS_HALL, .block = ingress, .items = items, .spines = spines };
+        ok = false;
+        break;
+      }
+
+      if (__builtin_popcountll(usable) == inputs_here) {
+        for (int b = block_first; b < k; b++) {
+          uint64_t common = full;
+          for (int j = input_start[b]; j < input_start[b + 1]; j++) common &= dom[j];
+          for (int j = input_start[b]; j < input_start[b + 1]; j++) {
+            if (dom[j] != common) {
+              dom[j] = common;
+              changed = true;
+            }
+          }
+        }
+      }
+    }
+    if (!ok) break;
+
+    // Per egress block: distinct spines for distinct inputs (Hall)
+    for (int e = 0; e < TOTAL_BLOCKS && ok; e++) {
+      int count = egress_start[e + 1] - egress_start[e];
+      for (int k = 0; k < count; k++) masks[k] = dom[egress_items[egress_start[e] + k]];
+      int items = 0, spines = 0;
+      if (!hall_match(masks, count, &items, &spines)) {
+        *failure = (PrecheckFailure){ .kind = PRECHECK_EGRESS_HALL, .block = e, .items = items, .spines = spines };
+        ok = false;
+      }
+    }
+  }
+
+  free(dom);
+  free(propagated);
+  free(input_start);
+  free(egress_items);
+  free(egress_start);
+  free(masks);
+  return ok;
+}
+
+static void print_precheck_failure(clos_ctx *clos, const PrecheckFailure *failure) {
+  fprintf(clos->out, "  UNSAT DETAILS:\n");
+  switch (failure->kind) {
+    case PRECHECK_EMPTY_DOMAIN:
+      fprintf(clos->out, "    Input %d has no usable spine into Egress block %2d (locks and forced trunks)\n",
+             failure->input_id, failure->block + 1);
+      break;
+    case PRECHECK_EGRESS_HALL:
+      fprintf(clos->out, "    Egress block %2d: %d demand(s) compete for %d usable spine(s)\n",
+             failure->block + 1, failure->items, failure->spines);
+      break;
+    case PRECHECK_INGRESS_HALL:
+      fprintf(clos->out, "    Ingress block %2d: %d input(s) compete for %d private spine(s)\n",
+             failure->block + 1, failure->items, failure->spines);
+      break;
+    case PRECHECK_OK:
+      break;
+  }
+}
+
+// Backtracking context (kept small and stack-friendly)
+typedef struct {
+  clos_ctx *clos;
+
+  Demand *demands;
+  int num_demands;
+
+  // Locked demands sit in demands[0, locked_count), pre-applied to the trunks by apply_locked_base();
+  // the search only branches on demands[locked_count, num_demands)
+  int locked_count;
+  int locked_cost;          // reroute cost of the locked demands (constant, not in stability_cost)
+  // Uncontested demands pinned to their previous spine sit in demands[locked_count, +pinned_count)
+  // while the conflict kernel is searched; zero otherwise
+  int pinned_count;
+  // A solution this cheap is known to be optimal, so the search stops on finding one
+  int stop_cost;
+  // Limited discrepancy search: each demand placed on anything but its first feasible spine in
+  // the 3-pass order spends one of discrepancies_left; discrepancy_cut records a skipped branch
+  bool lds_active;
+  int discrepancies_left;
+  bool discrepancy_cut;
+
+  // Partial ownership constraints:
+  // tmp_s2[spine][egress_block] = input_id (0 free)
+  // tmp_s1_owner[ingress_block][spine] = input_id (0 free)
+  int **tmp_s2;
+  int *tmp_s2_storage;
+  int **tmp_s1_owner;
+  int *tmp_s1_owner_storage;
+
+  // Spine usage per input (for pass 1 ordering - prefer reusing spines)
+  uint64_t *used_spines_mask;
+  int spine_words;
+
+  // Assignment: chosen spine for each demand index
+  int *assignment;
+  int *best_assignment;
+  // MRV swaps keep permuting demands[] after a best is recorded, so the best
+  // solution keeps its own copy of the demand order it was found with.
+  Demand *best_demands;
+
+  // Stability: previous spine for each (input, egress_block)
+  // -1 = new route (no previous), 0..N-1 = previous spine assignment
+  int **prev_spine_for;
+  int *prev_spine_for_storage;
+
+  // Cost of rerouting each (input, egress_block) demand; NULL = 1 per demand.
+  // With --output-weighted this is the number of previously-routed outputs behind the demand.
+  int **reroute_weight;
+
+  // Stability cost tracking (branch cost removed for speed - see WOL-598)
+  int stability_cost;       // current (weighted) cost of spine changes from previous state
+  int best_stability_cost;  // best solution's stability cost
+
+  // Secondary branch phase (--min-branches): minimize total branches with
+  // stability cost held at the proven optimum
+  const uint64_t *lock_spines_mask; // per-input spines forced by locks
+  int branch_lb;            // admissible lower bound on total branches
+  int best_branch_cost;     // branches of best_assignment
+  int stability_limit;      // stability cost may not exceed this
+  long long branch_nodes;
+  long long branch_node_budget;
+  bool branch_budget_hit;
+
+  // Optional search cap (0 = exhaustive); backtrack() unwinds once it is hit
+  long long node_limit;
+  bool node_limit_hit;
+
+  // Progress reporting (per-solve)
+  long long solve_attempts;
+  long long last_report_attempts;
+  struct timeval last_report;
+} SolverCtx;
+
+
+static inline int reroute_cost(const SolverCtx *ctx, int in_id, int egress) {
+  return ctx->reroute_weight ? ctx->reroute_weight[in_id][egress] : 1;
+}
+
+static int domain_size(const SolverCtx *ctx, const Demand *d) {
+  clos_ctx *clos = ctx->clos;
+  int in_id = d->input_id;
+  int ingress = d->ingress_block;
+  int egress = d->egress_block;
+
+  int size = 0;
+  for (int s = 0; s < N; s++) {
+    int s2_owner = ctx->tmp_s2[s][egress];
+    if (s2_owner != in_id && s2_owner != 0) continue;
+    int owner = ctx->tmp_s1_owner[ingress][s];
+    if (owner != 0 && owner != in_id) continue;
+    size++;
+  }
+  return size;
+}
+
+// First spine to try for a demand with no previous spine. Lowest-index first-fit scatters inputs
+// across spines and fragments the blocks, so this packs instead: among admissible spines, one the
+// input already uses (no new Stage1 trunk), then the one with the most busy trunks, so the free
+// (ingress, spine, egress) paths stay together on the emptier spines for later inserts.
+static int packed_spine(const SolverCtx *ctx, int in_id, int ingress, int egress) {
+  clos_ctx *clos = ctx->clos;
+  const uint64_t *used_row = bitset_row_const(ctx->used_spines_mask, in_id, ctx->spine_words);
+  int best = -1;
+  bool best_used = false;
+  int best_load = -1;
+  for (int s = 0; s < N; s++) {
+    if (ctx->tmp_s2[s][egress] != 0 && ctx->tmp_s2[s][egress] != in_id) continue;
+    int owner = ctx->tmp_s1_owner[ingress][s];
+    if (owner != 0 && owner != in_id) continue;
+
+    bool used = bitset_test(used_row, s);
+    if (best_used && !used) continue;
+    int load = 0;
+    for (int b = 0; b < TOTAL_BLOCKS; b++) {
+      load += (ctx->tmp_s2[s][b] != 0) + (ctx->tmp_s1_owner[b][s] != 0);
+    }
+    if ((used && !best_used) || load > best_load) {
+      best = s;
+      best_used = used;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
+// First spine to try for a demand with no previous spine: its hinted spine if that is admissible
+// now (--plan: where the demand ends up later in the session; --scene: its spine in the scene),
+// else the packed spine
+static int new_demand_spine(const SolverCtx *ctx, int in_id, int ingress, int egress) {
+  clos_ctx *clos = ctx->clos;
+  if (clos->placement_hints) {
+    int hint = clos->solver_scratch.plan_hint[in_id][egress];
+    if (hint >= 0 && (ctx->tmp_s2[hint][egress] == 0 || ctx->tmp_s2[hint][egress] == in_id) &&
+        (ctx->tmp_s1_owner[ingress][hint] == 0 || ctx->tmp_s1_owner[ingress][hint] == in_id)) {
+      return hint;
+    }
+  }
+  return packed_spine(ctx, in_id, ingress, egress);
+}
+
+// MRV: move the demand with the smallest domain into position depth; ties go to the higher
+// conflict score (all zero unless --learn).
+// Returns false if some remaining demand has an empty domain.
+static inline bool select_mrv_demand(SolverCtx *ctx, int depth) {
+  clos_ctx *clos = ctx->clos;
+  int best_idx = -1;
+  int best_dom = 999;
+  int best_activity = -1;
+  int **activity = clos->solver_scratch.demand_activity;
+
+  for (int i = depth; i < ctx->num_demands; i++) {
+    const Demand *d = &ctx->demands[i];
+    int dom = domain_size(ctx, d);
+    if (dom == 0) return false;
+    int act = activity[d->input_id][d->egress_block];
+    if (dom < best_dom || (dom == best_dom && act > best_activity)) {
+      best_dom = dom;
+      best_idx = i;
+      best_activity = act;
+      if (dom == 1) break;
+    }
+  }
+
+  if (best_idx < 0) return false;
+
+  // Swap chosen demand into position depth
+  if (best_idx != depth) {
+    Demand tmp = ctx->demands[depth];
+    ctx->demands[depth] = ctx->demands[best_idx];
+    ctx->demands[best_idx] = tmp;
+
+    // Keep assignment aligned with demand ordering during search
+    int atmp = ctx->assignment[depth];
+    ctx->assignment[depth] = ctx->assignment[best_idx];
+    ctx->assignment[best_idx] = atmp;
+  }
+  return true;
+}
+
+static void record_best(SolverCtx *ctx) {
+  for (int i = 0; i < ctx->num_demands; i++) ctx->best_assignment[i] = ctx->assignment[i];
+  memcpy(ctx->best_demands, ctx->demands, sizeof(Demand) * (size_t)ctx->num_demands);
+}
+
+// Moves locked demands to the front; returns how many there are
+static int partition_locked_demands(clos_ctx *clos, Demand *demands, int num_demands) {
+  if (!clos->have_locks) return 0;
+  int locked_count = 0;
+  for (int i = 0; i < num_demands; i++) {
+    if (clos->lock_spine_for[demands[i].input_id][demands[i].egress_block] < 0) continue;
+    Demand tmp = demands[locked_count];
+    demands[locked_count] = demands[i];
+    demands[i] = tmp;
+    locked_count++;
+  }
+  return locked_count;
+}
+
+// Pins demands[0, locked_count) to their locked spines on top of the current working trunks.
+// Returns false if a locked demand's trunk is already taken.
+static bool apply_locked_base(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  ctx->locked_cost = 0;
+  for (int i = 0; i < ctx->locked_count; i++) {
+    const Demand *d = &ctx->demands[i];
+    int s = clos->lock_spine_for[d->input_id][d->egress_block];
+    if (ctx->tmp_s2[s][d->egress_block] != 0 && ctx->tmp_s2[s][d->egress_block] != d->input_id) return false;
+    int owner = ctx->tmp_s1_owner[d->ingress_block][s];
+    if (owner != 0 && owner != d->input_id) return false;
+
+    ctx->tmp_s2[s][d->egress_block] = d->input_id;
+    ctx->tmp_s1_owner[d->ingress_block][s] = d->input_id;
+    bitset_set(bitset_row(ctx->used_spines_mask, d->input_id, ctx->spine_words), s);
+    ctx->assignment[i] = s;
+
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    if (prev_spine >= 0 && s != prev_spine) ctx->locked_cost += reroute_cost(ctx, d->input_id, d->egress_block);
+  }
+  return true;
+}
+
+static bool greedy_seed(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  ctx->stability_cost = 0;
+
+  for (int depth = ctx->locked_count + ctx->pinned_count; depth < ctx->num_demands; depth++) {
+    if (!select_mrv_demand(ctx, depth)) return false;
+
+    Demand d = ctx->demands[depth];
+    int in_id = d.input_id;
+    int ingress = d.ingress_block;
+    int egress = d.egress_block;
+
+    int prev_spine = ctx->prev_spine_for[in_id][egress];
+    int first_spine = prev_spine >= 0 ? prev_spine : new_demand_spine(ctx, in_id, ingress, egress);
+    uint64_t *used_row = bitset_row(ctx->used_spines_mask, in_id, ctx->spine_words);
+
+    int chosen = -1;
+    for (int pass = 0; pass < 3 && chosen < 0; pass++) {
+      for (int s = 0; s < N; s++) {
+        bool is_first = (first_spine >= 0 && s == first_spine);
+        bool already_used = bitset_test(used_row, s);
+
+        if (pass == 0 && !is_first) continue;
+        if (pass == 1 && (is_first || !already_used)) continue;
+        if (pass == 2 && (is_first || already_used)) continue;
+
+        if (ctx->tmp_s2[s][egress] != 0 && ctx->tmp_s2[s][egress] != in_id) continue;
+        int owner = ctx->tmp_s1_owner[ingress][s];
+        if (owner != 0 && owner != in_id) continue;
+
+        chosen = s;
+        break;
+      }
+    }
+
+    if (chosen < 0) return false;
+
+    ctx->tmp_s2[chosen][egress] = in_id;
+    ctx->tmp_s1_owner[ingress][chosen] = in_id;
+    ctx->assignment[depth] = chosen;
+
+    int word_index = chosen >> 6;
+    uint64_t prev_word = used_row[word_index];
+    used_row[word_index] = prev_word | (1ULL << (chosen & 63));
+
+    bool is_change = (prev_spine >= 0 && chosen != prev_spine);
+    if (is_change) {
+      ctx->stability_cost += reroute_cost(ctx, in_id, egress);
+    }
+  }
+
+  record_best(ctx);
+  ctx->best_stability_cost = ctx->stability_cost;
+  return true;
+}
+
+static bool backtrack(SolverCtx *ctx, int depth) {
+  clos_ctx *clos = ctx->clos;
+  // Time-based progress reporting (every 5 seconds)
+  ctx->solve_attempts++;
+  if (ctx->node_limit > 0 && ctx->solve_attempts > ctx->node_limit) {
+    ctx->node_limit_hit = true;
+    return true;
+  }
+
+  if ((ctx->solve_attempts & PROGRESS_CHECK_MASK) == 0) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long elapsed_ms = (now.tv_sec - ctx->last_report.tv_sec) * 1000 +
+                      (now.tv_usec - ctx->last_report.tv_usec) / 1000;
+    if (elapsed_ms >= 5000) {  // Every 5 seconds
+      long long attempts_since = ctx->solve_attempts - ctx->last_report_attempts;
+      fprintf(clos->out, "[S] PROGRESS: %lld attempts in %lds (depth=%d/%d, best_cost=%d)\n",
+             attempts_since, elapsed_ms / 1000, depth, ctx->num_demands, ctx->best_stability_cost);
+      if (clos->progress) {
+        clos_progress progress = {
+          .attempts = attempts_since,
+          .elapsed_ms = elapsed_ms,
+          .depth = depth,
+          .num_demands = ctx->num_demands,
+          .best_cost = ctx->best_stability_cost
+        };
+        clos->progress(clos->progress_user, &progress);
+      }
+      ctx->last_report = now;
+      ctx->last_report_attempts = ctx->solve_attempts;
+    }
+  }
+
+  // Optimize for stability only (branch cost removed for speed - see WOL-598)
+  if (ctx->stability_cost >= ctx->best_stability_cost) return false;
+
+  if (depth == ctx->num_demands) {
+    // Found a valid assignment; record if best by stability cost
+    if (ctx->stability_cost < ctx->best_stability_cost) {
+      ctx->best_stability_cost = ctx->stability_cost;
+      record_best(ctx);
+    }
+    // If we hit the known lower bound (zero unless deepening), we can stop
+    if (ctx->best_stability_cost <= ctx->stop_cost) return true;
+    return false; // keep searching for better
+  }
+
+  // Choose next variable with MRV (smallest domain) for strong pruning
+  if (!select_mrv_demand(ctx, depth)) return false;
+
+  Demand d = ctx->demands[depth];
+  int in_id = d.input_id;
+  int ingress = d.ingress_block;
+  int egress = d.egress_block;
+
+  // Value ordering (3 passes for stability):
+  // Pass 0: Try previous spine first (if exists) - preserves existing routes; a new demand
+  //         tries its planned or packed spine instead (keeps headroom for later inserts)
+  // Pass 1: Try spines already used by this input (reduces additional branches)
+  // Pass 2: Try remaining spines
+  int prev_spine = ctx->prev_spine_for[in_id][egress];
+  int first_spine = prev_spine >= 0 ? prev_spine : new_demand_spine(ctx, in_id, ingress, egress);
+  uint64_t *used_row = bitset_row(ctx->used_spines_mask, in_id, ctx->spine_words);
+  bool deviating = false;  // past the heuristic's first choice (LDS only)
+
+  for (int pass = 0; pass < 3; pass++) {
+    for (int s = 0; s < N; s++) {
+      bool is_first = (first_spine >= 0 && s == first_spine);
+      bool already_used = bitset_test(used_row, s);
+
+      // Pass 0: only try the first choice
+      if (pass == 0 && !is_first) continue;
+      // Pass 1: try already-used spines (but not the first choice, already tried)
+      if (pass == 1 && (is_first || !already_used)) continue;
+      // Pass 2: try remaining spines
+      if (pass == 2 && (is_first || already_used)) continue;
+
+      // Check constraints
+      if (ctx->tmp_s2[s][egress] != 0 && ctx->tmp_s2[s][egress] != in_id) continue;
+
+      int owner = ctx->tmp_s1_owner[ingress][s];
+      if (owner != 0 && owner != in_id) continue;
+
+      if (ctx->lds_active && deviating) {
+        if (ctx->discrepancies_left == 0) {
+          ctx->discrepancy_cut = true;
+          return false;
+        }
+        ctx->discrepancies_left--;
+      }
+
+      // Commit (with minimal undo info)
+      int prev_s2 = ctx->tmp_s2[s][egress];
+      int prev_s1 = ctx->tmp_s1_owner[ingress][s];
+
+      // Track spine usage for pass 1 ordering (but don't optimize branch cost)
+      bool added_spine = !already_used;
+      int word_index = s >> 6;
+      uint64_t prev_word = used_row[word_index];
+      int prev_stab_cost = ctx->stability_cost;
+
+      ctx->tmp_s2[s][egress] = in_id;
+      ctx->tmp_s1_owner[ingress][s] = in_id;
+      ctx->assignment[depth] = s;
+
+      if (added_spine) {
+        used_row[word_index] = prev_word | (1ULL << (s & 63));
+      }
+
+      // Add stability cost if changing from previous assignment
+      bool is_change = (prev_spine >= 0 && s != prev_spine);
+      if (is_change) {
+        ctx->stability_cost += reroute_cost(ctx, in_id, egress);
+      }
+
+      bool stop = backtrack(ctx, depth + 1);
+      if (stop) return true;  // perfect stability, or node limit hit
+
+      // Undo
+      ctx->tmp_s2[s][egress] = prev_s2;
+      ctx->tmp_s1_owner[ingress][s] = prev_s1;
+      used_row[word_index] = prev_word;
+      ctx->stability_cost = prev_stab_cost;
+      if (ctx->lds_active && deviating) ctx->discrepancies_left++;
+      deviating = true;
+    }
+  }
+
+  return false;
+}
+
+// --- BRANCH PHASE (lexicographic secondary objective) -----------------------
+//
+// Branch cost was removed from backtrack() for speed (WOL-598). With --min-branches it runs as a
+// second phase instead: once the stability optimum is proven, a node-budgeted search looks for an
+// assignment with the same stability cost and fewer total branches (distinct spines per input).
+//
+// Lower bound: every active input needs at least one spine, plus every spine its locks force on it,
+// so sum(max(1, |used | locked|)) over active inputs is admissible, and exact at a leaf.
+
+static int count_best_branches(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  memset(ctx->used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+  for (int i = 0; i < ctx->num_demands; i++) {
+    bitset_set(bitset_row(ctx->used_spines_mask, ctx->best_demands[i].input_id, ctx->spine_words),
+               ctx->best_assignment[i]);
+  }
+
+  int branches = 0;
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    branches += bitset_popcount(bitset_row_const(ctx->used_spines_mask, in_id, ctx->spine_words), ctx->spine_words);
+  }
+  return branches;
+}
+
+static int init_branch_bound(SolverCtx *ctx, uint64_t *lock_mask, const int *active_inputs, int active_count) {
+  clos_ctx *clos = ctx->clos;
+  memset(lock_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+  for (int i = 0; i < ctx->locked_count; i++) {
+    const Demand *d = &ctx->demands[i];
+    bitset_set(bitset_row(lock_mask, d->input_id, ctx->spine_words), clos->lock_spine_for[d->input_id][d->egress_block]);
+  }
+
+  int lb = 0;
+  for (int idx = 0; idx < active_count; idx++) {
+    int forced = bitset_popcount(bitset_row_const(lock_mask, active_inputs[idx], ctx->spine_words), ctx->spine_words);
+    lb += forced > 1 ? forced : 1;
+  }
+  return lb;
+}
+
+// Returns true to stop the search (bound reached or node budget spent)
+static bool backtrack_branches(SolverCtx *ctx, int depth, int root_lb) {
+  clos_ctx *clos = ctx->clos;
+  if (++ctx->branch_nodes > ctx->branch_node_budget) {
+    ctx->branch_budget_hit = true;
+    return true;
+  }
+
+  if (ctx->stability_cost > ctx->stability_limit) return false;
+  if (ctx->branch_lb >= ctx->best_branch_cost) return false;
+
+  if (depth == ctx->num_demands) {
+    ctx->best_branch_cost = ctx->branch_lb;
+    record_best(ctx);
+    return ctx->best_branch_cost <= root_lb;
+  }
+
+  if (!select_mrv_demand(ctx, depth)) return false;
+
+  Demand d = ctx->demands[depth];
+  int in_id = d.input_id;
+  int ingress = d.ingress_block;
+  int egress = d.egress_block;
+
+  int prev_spine = ctx->prev_spine_for[in_id][egress];
+  uint64_t *used_row = bitset_row(ctx->used_spines_mask, in_id, ctx->spine_words);
+  const uint64_t *lock_row = bitset_row_const(ctx->lock_spines_mask, in_id, ctx->spine_words);
+  bool input_has_floor = bitset_any(used_row, ctx->spine_words) || bitset_any(lock_row, ctx->spine_words);
+
+  // Same 3-pass ordering as backtrack()
+  for (int pass = 0; pass < 3; pass++) {
+    for (int s = 0; s < N; s++) {
+      bool is_prev = (prev_spine >= 0 && s == prev_spine);
+      bool already_used = bitset_test(used_row, s);
+
+      if (pass == 0 && !is_prev) continue;
+      if (pass == 1 && (is_prev || !already_used)) continue;
+      if (pass == 2 && (is_prev || already_used)) continue;
+
+      if (ctx->tmp_s2[s][egress] != 0 && ctx->tmp_s2[s][egress] != in_id) continue;
+      int owner = ctx->tmp_s1_owner[ingress][s];
+      if (owner != 0 && owner != in_id) continue;
+
+      int prev_s2 = ctx->tmp_s2[s][egress];
+      int prev_s1 = ctx->tmp_s1_owner[ingress][s];
+      int word_index = s >> 6;
+      uint64_t prev_word = used_row[word_index];
+      int prev_stab_cost = ctx->stability_cost;
+      int prev_lb = ctx->branch_lb;
+
+      ctx->tmp_s2[s][egress] = in_id;
+      ctx->tmp_s1_owner[ingress][s] = in_id;
+      ctx->assignment[depth] = s;
+      if (!already_used) {
+        used_row[word_index] = prev_word | (1ULL << (s & 63));
+        // A spine outside the lock set only raises the bound once the input already has a floor
+        if (!bitset_test(lock_row, s) && input_has_floor) ctx->branch_lb += 1;
+      }
+      if (prev_spine >= 0 && s != prev_spine) ctx->stability_cost += reroute_cost(ctx, in_id, egress);
+
+      if (backtrack_branches(ctx, depth + 1, root_lb)) return true;
+
+      ctx->tmp_s2[s][egress] = prev_s2;
+      ctx->tmp_s1_owner[ingress][s] = prev_s1;
+      used_row[word_index] = prev_word;
+      ctx->stability_cost = prev_stab_cost;
+      ctx->branch_lb = prev_lb;
+    }
+  }
+
+  return false;
+}
+
+// Runs the branch phase on a ctx holding a proven stability optimum in best_assignment
+static void run_branch_phase(SolverCtx *ctx, const int *active_inputs, int active_count) {
+  clos_ctx *clos = ctx->clos;
+  ctx->best_branch_cost = count_best_branches(ctx);
+  ctx->lock_spines_mask = clos->solver_scratch.lock_spines_mask;
+  int root_lb = init_branch_bound(ctx, clos->solver_scratch.lock_spines_mask, active_inputs, active_count);
+  int start_branches = ctx->best_branch_cost;
+
+  ctx->branch_nodes = 0;
+  ctx->branch_node_budget = clos->branch_node_budget;
+  ctx->branch_budget_hit = false;
+
+  if (root_lb < start_branches) {
+    memset(ctx->tmp_s2_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+    memset(ctx->tmp_s1_owner_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+    memset(ctx->used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+    (void)apply_locked_base(ctx);
+    ctx->stability_cost = 0;
+    ctx->stability_limit = ctx->best_stability_cost;
+    if (clos->defrag_reroutes >= 0) {
+      // Defragmentation: trade up to the budget in reroutes for fewer branches (never past --max-reroutes)
+      int limit = clos->defrag_reroutes - ctx->locked_cost;
+      int budget = reroute_budget(clos);
+      if (budget >= 0 && budget - ctx->locked_cost < limit) limit = budget - ctx->locked_cost;
+      if (limit > ctx->stability_limit) ctx->stability_limit = limit;
+    }
+    ctx->branch_lb = root_lb;
+    (void)backtrack_branches(ctx, ctx->locked_count, root_lb);
+
+    fprintf(clos->out, "  %s: branches %d -> %d (lower bound %d, %lld nodes%s)\n",
+           clos->defrag_reroutes >= 0 ? "DEFRAG" : "BRANCH PHASE", start_branches, ctx->best_branch_cost, root_lb,
+           ctx->branch_nodes, ctx->branch_budget_hit ? ", budget hit" : "");
+  }
+
+  clos->last_branch_nodes = ctx->branch_nodes;
+  clos->total_branch_nodes += ctx->branch_nodes;
+}
+
+// Puts back the repair base entries a repair over these demands may have written: the Stage2
+// trunks into each demand's egress block, its input's Stage1 trunks and spine mask row.
+static void restore_incremental_base(clos_ctx *clos, const Demand *added, int added_count, const Demand *removed,
+                                     int removed_count) {
+  for (int i = 0; i < added_count + removed_count; i++) {
+    const Demand *d = i < added_count ? &added[i] : &removed[i - added_count];
+    uint64_t *mask_row = bitset_row(clos->repair_spines_mask, d->input_id, clos->repair_spine_words);
+    const int *use = &clos->input_spine_use[(size_t)d->input_id * (size_t)N];
+    for (int s = 0; s < N; s++) {
+      clos->repair_s2[s][d->egress_block] = clos->s2_to_s3[s][d->egress_block];
+      clos->repair_s1_owner[d->ingress_block][s] = clos->s1_to_s2[d->ingress_block][s];
+      if (use[s] > 0) {
+        bitset_set(mask_row, s);
+      } else {
+        bitset_clear(mask_row, s);
+      }
+    }
+  }
+}
+
+// Resets ctx (bound to the repair base) to the committed fabric minus the removed demands
+static bool init_incremental_base(SolverCtx *ctx, const Demand *removed, int removed_count) {
+  clos_ctx *clos = ctx->clos;
+  restore_incremental_base(clos, ctx->demands, ctx->num_demands, removed, removed_count);
+
+  // Removals per (input, spine), compared against the live use count; zero between calls
+  int *pending = clos->solver_scratch.spine_use_count;
+  bool ok = true;
+  int applied = 0;
+  for (; applied < removed_count; applied++) {
+    int in_id = removed[applied].input_id;
+    int e = removed[applied].egress_block;
+    int s = clos->current_spine_for[in_id][e];
+    if (s < 0 || ctx->tmp_s2[s][e] != in_id) {
+      ok = false;
+      break;
+    }
+
+    ctx->tmp_s2[s][e] = 0;
+
+    size_t idx = (size_t)in_id * (size_t)N + (size_t)s;
+    if (++pending[idx] == clos->input_spine_use[idx]) {
+      ctx->tmp_s1_owner[get_block(clos, in_id)][s] = 0;
+      bitset_clear(bitset_row(ctx->used_spines_mask, in_id, ctx->spine_words), s);
+    }
+  }
+  for (int i = 0; i < applied; i++) {
+    int in_id = removed[i].input_id;
+    int s = clos->current_spine_for[in_id][removed[i].egress_block];
+    pending[(size_t)in_id * (size_t)N + (size_t)s] = 0;
+  }
+
+  return ok;
+}
+
+// Builds candidate fabric arrays from a spine per demand; Stage3 follows desired_owner
+static bool build_solution_from_assignment(clos_ctx *clos, const Demand *demands, const int *spines, int num_demands,
+                                           FabricSolution *out_solution) {
+  FabricSolution sol;
+  memset(&sol, 0, sizeof(sol));
+  sol.s1 = alloc_int_matrix(TOTAL_BLOCKS, N, &sol.s1_storage);
+  sol.s2 = alloc_int_matrix(N, TOTAL_BLOCKS, &sol.s2_storage);
+  sol.s3_owner = calloc((size_t)MAX_PORTS + 1, sizeof(int));
+  sol.s3_spine = calloc((size_t)MAX_PORTS + 1, sizeof(int));
+  if (!sol.s1 || !sol.s2 || !sol.s3_owner || !sol.s3_spine) {
+    free_solution(&sol);
+    return false;
+  }
+  for (int p = 1; p <= MAX_PORTS; p++) sol.s3_spine[p] = -1;
+
+  // Map for quick Stage3 spine lookup: spine_for[input_id][egress_block]
+  int *spine_for_storage = NULL;
+  int **spine_for = alloc_int_matrix(MAX_PORTS + 1, TOTAL_BLOCKS, &spine_for_storage);
+  if (!spine_for) {
+    free_solution(&sol);
+    return false;
+  }
+  for (int in_id = 0; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) spine_for[in_id][e] = -1;
+  }
+
+  // Apply each (input, egress) demand to trunks
+  for (int i = 0; i < num_demands; i++) {
+    Demand d = demands[i];
+    int s = spines[i];
+    int in_id = d.input_id;
+
+    sol.s2[s][d.egress_block] = in_id;
+    sol.s1[d.ingress_block][s] = in_id;
+    spine_for[in_id][d.egress_block] = s;
+  }
+
+  // Apply Stage3 selections exactly as desired_owner
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    int in_id = clos->desired_owner[p];
+    if (in_id == 0) {
+      sol.s3_owner[p] = 0;
+      sol.s3_spine[p] = -1;
+      continue;
+    }
+
+    int e = get_block(clos, p);
+    int s = spine_for[in_id][e];
+    if (s < 0) {
+      // Should never happen: if desired_owner has in_id in this egress block,
+      // we must have created a demand and assigned it.
+      fprintf(clos->out, "  FAIL: Internal error: missing spine assignment for input %d egrblock %d\n", in_id, e + 1);
+      free_int_matrix(spine_for, spine_for_storage);
+      free_solution(&sol);
+      return false;
+    }
+
+    sol.s3_owner[p] = in_id;
+    sol.s3_spine[p] = s;
+  }
+
+  free_int_matrix(spine_for, spine_for_storage);
+  *out_solution = sol;
+  return true;
+}
+
+// --- MIN-CONFLICTS LOCAL SEARCH ---------------------------------------------
+//
+// When the greedy seed dead-ends on a dense fabric, the exact search starts without an incumbent,
+// and at N=32-64 it can take seconds to find any solution at all. Local search usually gets there
+// in milliseconds. Every demand starts on its previous spine (a new demand on its least conflicted
+// spine), then a conflicted demand is repeatedly moved to the spine where it conflicts least.
+// Moving a demand back to a spine it just left is tabu for a few moves unless that reaches a new
+// best, and one move in LOCAL_SEARCH_WALK_ODDS goes to a random spine to get off plateaus.
+// Occupancy counters (demands per Stage2 trunk, inputs per Stage1 trunk) change in O(1) per move,
+// and the conflict total is the number of clashing pairs, so a move changes it by exactly the
+// difference of the two spines' scores. A conflict-free assignment becomes the incumbent, and the
+// exact pipeline still polishes its reroutes.
+
+#define LOCAL_SEARCH_MAX_MOVES 200000
+#define LOCAL_SEARCH_TABU_TENURE 5
+#define LOCAL_SEARCH_WALK_ODDS 100
+
+static uint32_t ls_random(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Other demands/inputs that spine s would clash with for d, when d currently sits on cur (-1: unplaced)
+static int ls_conflicts(clos_ctx *clos, const Demand *d, int s, int cur) {
+  int self = s == cur ? 1 : 0;
+  int stage2 = clos->solver_scratch.ls_s2_count[s][d->egress_block] - self;
+  bool shared = clos->solver_scratch.ls_input_use[d->input_id][s] - self > 0;  // input already holds the Stage1 trunk
+  int stage1 = shared ? 0 : clos->solver_scratch.ls_s1_count[d->ingress_block][s] - self;
+  return stage2 + stage1;
+}
+
+// d clashes where it sits: another input on its Stage2 trunk, or on its input's Stage1 trunk
+static bool ls_clashing(clos_ctx *clos, const Demand *d, int s) {
+  return clos->solver_scratch.ls_s2_count[s][d->egress_block] > 1 || clos->solver_scratch.ls_s1_count[d->ingress_block][s] > 1;
+}
+
+static void ls_place(clos_ctx *clos, const Demand *d, int s, int sign, int *conflicts) {
+  int *stage2 = &clos->solver_scratch.ls_s2_count[s][d->egress_block];
+  int *stage1 = &clos->solver_scratch.ls_s1_count[d->ingress_block][s];
+  int *use = &clos->solver_scratch.ls_input_use[d->input_id][s];
+  if (sign > 0) {
+    *conflicts += (*stage2)++;
+    if ((*use)++ == 0) *conflicts += (*stage1)++;
+  } else {
+    *conflicts -= --(*stage2);
+    if (--(*use) == 0) *conflicts -= --(*stage1);
+  }
+}
+
+// Fills ctx->assignment for every demand; returns the clashing pairs left (0 = feasible)
+static int min_conflicts_search(SolverCtx *ctx, int *moves_out) {
+  clos_ctx *clos = ctx->clos;
+  int nd = ctx->num_demands;
+  int first = ctx->locked_count;
+  int free_count = nd - first;
+  memset(clos->solver_scratch.ls_s2_count_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+  memset(clos->solver_scratch.ls_s1_count_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+  memset(clos->solver_scratch.ls_input_use_storage, 0, sizeof(int) * ((size_t)MAX_PORTS + 1) * (size_t)N);
+  int *tabu_until = calloc((size_t)(free_count > 0 ? free_count : 1) * (size_t)N, sizeof(int));
+  if (!tabu_until) return -1;
+
+  int conflicts = 0;
+  for (int i = 0; i < nd; i++) {
+    const Demand *d = &ctx->demands[i];
+    int s = i < first ? clos->lock_spine_for[d->input_id][d->egress_block] : ctx->prev_spine_for[d->input_id][d->egress_block];
+    if (s < 0) {
+      int best_score = INT_MAX;
+      for (int sp = 0; sp < N; sp++) {
+        int score = ls_conflicts(clos, d, sp, -1);
+        if (score < best_score) {
+          best_score = score;
+          s = sp;
+        }
+      }
+    }
+    ctx->assignment[i] = s;
+    ls_place(clos, d, s, +1, &conflicts);
+  }
+
+  uint32_t rng = 0x9E3779B9u ^ (uint32_t)nd;
+  int best_conflicts = conflicts;
+  int moves = 0;
+  while (conflicts > 0 && moves < LOCAL_SEARCH_MAX_MOVES && free_count > 0 && N > 1) {
+    // A conflicted free demand, scanning from a random start
+    int pick = -1;
+    int start = (int)(ls_random(&rng) % (uint32_t)free_count);
+    for (int k = 0; k < free_count; k++) {
+      int i = first + (start + k) % free_count;
+      if (ls_clashing(clos, &ctx->demands[i], ctx->assignment[i])) {
+        pick = i;
+        break;
+      }
+    }
+    if (pick < 0) break;  // only locked demands clash
+
+    const Demand *d = &ctx->demands[pick];
+    int cur = ctx->assignment[pick];
+    int cur_score = ls_conflicts(clos, d, cur, cur);
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    int *tabu = &tabu_until[(size_t)(pick - first) * (size_t)N];
+    int target = -1;
+    if (ls_random(&rng) % LOCAL_SEARCH_WALK_ODDS != 0) {
+      int best_score = INT_MAX;
+      for (int sp = 0; sp < N; sp++) {
+        if (sp == cur) continue;
+        int score = ls_conflicts(clos, d, sp, cur);
+        bool aspires = conflicts - cur_score + score < best_conflicts;
+        if (tabu[sp] > moves && !aspires) continue;
+        if (score < best_score || (score == best_score && sp == prev_spine)) {
+          best_score = score;
+          target = sp;
+        }
+      }
+    }
+    if (target < 0) {
+      target = (int)(ls_random(&rng) % (uint32_t)(N - 1));
+      if (target >= cur) target++;
+    }
+
+    ls_place(clos, d, cur, -1, &conflicts);
+    ls_place(clos, d, target, +1, &conflicts);
+    ctx->assignment[pick] = target;
+    tabu[cur] = moves + LOCAL_SEARCH_TABU_TENURE;
+    moves++;
+    if (conflicts < best_conflicts) best_conflicts = conflicts;
+  }
+
+  free(tabu_until);
+  *moves_out = moves;
+  return conflicts;
+}
+
+// --- CONFLICT KERNEL --------------------------------------------------------
+//
+// After an edit most demands can keep their previous spine without competing with anything:
+// no other demand's previous spine (and no lock) wants the same Stage2 trunk or Stage1 trunk.
+// Those are pinned, and only the contested kernel (rerouted candidates and new demands) is
+// searched. Any assignment found is valid for the whole problem, so it becomes the incumbent;
+// a kernel cost of 0 is optimal outright, otherwise the full search still proves optimality
+// but starts from a tight bound. A kernel with no solution grows into every egress and ingress
+// block it touches, unpinning the demands there, until a solution appears or nothing is pinned.
+
+#define KERNEL_NODE_LIMIT 200000  // per kernel round; the full search is the fallback
+
+static void kernel_claim(int *slot, int in_id) {
+  if (*slot == 0) {
+    *slot = in_id;
+  } else if (*slot != in_id) {
+    *slot = -1;
+  }
+}
+
+// Moves pinnable demands to just after the locked prefix and applies them to the trunks.
+// Expects ctx reset to the locked base; returns the number pinned.
+static int pin_uncontested_demands(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  int **s2_claim = clos->solver_scratch.kernel_s2_claim;
+  int **s1_claim = clos->solver_scratch.kernel_s1_claim;
+  const bool *hot_egress = clos->solver_scratch.kernel_hot_egress;
+  const bool *hot_ingress = clos->solver_scratch.kernel_hot_ingress;
+  memcpy(clos->solver_scratch.kernel_s2_claim_storage, ctx->tmp_s2_storage, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+  memcpy(clos->solver_scratch.kernel_s1_claim_storage, ctx->tmp_s1_owner_storage,
+         sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+
+  for (int i = ctx->locked_count; i < ctx->num_demands; i++) {
+    const Demand *d = &ctx->demands[i];
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    if (prev_spine < 0) continue;
+    kernel_claim(&s2_claim[prev_spine][d->egress_block], d->input_id);
+    kernel_claim(&s1_claim[d->ingress_block][prev_spine], d->input_id);
+  }
+
+  int pinned = 0;
+  for (int i = ctx->locked_count; i < ctx->num_demands; i++) {
+    Demand d = ctx->demands[i];
+    int s = ctx->prev_spine_for[d.input_id][d.egress_block];
+    if (s < 0 || hot_egress[d.egress_block] || hot_ingress[d.ingress_block]) continue;
+    if (s2_claim[s][d.egress_block] != d.input_id || s1_claim[d.ingress_block][s] != d.input_id) continue;
+
+    int at = ctx->locked_count + pinned++;
+    ctx->demands[i] = ctx->demands[at];
+    ctx->demands[at] = d;
+    ctx->tmp_s2[s][d.egress_block] = d.input_id;
+    ctx->tmp_s1_owner[d.ingress_block][s] = d.input_id;
+    bitset_set(bitset_row(ctx->used_spines_mask, d.input_id, ctx->spine_words), s);
+    ctx->assignment[at] = s;
+  }
+  return pinned;
+}
+
+// Searches kernels of growing size for an assignment cheaper than the incumbent in ctx. Leaves
+// ctx->best_* holding the better assignment, if any, and the working state dirty.
+static void solve_conflict_kernel(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  bool *hot_egress = clos->solver_scratch.kernel_hot_egress;
+  bool *hot_ingress = clos->solver_scratch.kernel_hot_ingress;
+  memset(hot_egress, 0, sizeof(bool) * (size_t)TOTAL_BLOCKS);
+  memset(hot_ingress, 0, sizeof(bool) * (size_t)TOTAL_BLOCKS);
+
+  int incumbent = ctx->best_stability_cost;
+  long long nodes = 0;
+  int rounds = 0;
+  for (;;) {
+    memset(ctx->tmp_s2_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+    memset(ctx->tmp_s1_owner_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+    memset(ctx->used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+    (void)apply_locked_base(ctx);
+    ctx->pinned_count = pin_uncontested_demands(ctx);
+    if (ctx->pinned_count == 0) break;  // nothing left to pin: the full search is the kernel
+    rounds++;
+
+    int base = ctx->locked_count + ctx->pinned_count;
+    ctx->stability_cost = 0;
+    ctx->solve_attempts = 0;
+    ctx->last_report_attempts = 0;
+    gettimeofday(&ctx->last_report, NULL);
+    ctx->node_limit = KERNEL_NODE_LIMIT;
+    ctx->node_limit_hit = false;
+    (void)backtrack(ctx, base);
+    nodes += ctx->solve_attempts;
+    if (ctx->best_stability_cost < incumbent || ctx->node_limit_hit) break;
+
+    // No solution with these pins: unpin everything sharing a block with the kernel
+    bool grew = false;
+    for (int i = base; i < ctx->num_demands; i++) {
+      const Demand *d = &ctx->demands[i];
+      grew |= !hot_egress[d->egress_block] || !hot_ingress[d->ingress_block];
+      hot_egress[d->egress_block] = true;
+      hot_ingress[d->ingress_block] = true;
+    }
+    if (!grew) break;
+  }
+
+  if (rounds > 0) {
+    int searched = ctx->num_demands - ctx->locked_count - ctx->pinned_count;
+    if (ctx->best_stability_cost < incumbent) {
+      fprintf(clos->out, "  KERNEL: %d demand(s) pinned, %d searched, cost %d (%lld nodes)\n",
+             ctx->pinned_count, searched, ctx->best_stability_cost, nodes);
+    } else {
+      fprintf(clos->out, "  KERNEL: no improvement after %d round(s) (%lld nodes), searching all demands\n", rounds, nodes);
+    }
+  }
+  ctx->pinned_count = 0;
+  ctx->node_limit = 0;
+  ctx->node_limit_hit = false;
+  ctx->solve_attempts = nodes;
+}
+
+// --- ITERATIVE DEEPENING ON REROUTES ---------------------------------------
+//
+// Branch-and-bound from a loose incumbent wanders through high-reroute assignments before the
+// bound tightens. Instead the search is repeated with reroute limits 0, 1, 2, ... below the
+// incumbent; each pass cuts every branch over its limit on entry (a limit of 0 means each
+// demand with a previous spine keeps it), and the first solution found is optimal because the
+// previous pass proved nothing cheaper exists. Typical edits need 0-2 reroutes, so the passes
+// stay small. Past DEEPENING_MAX_LIMIT one ordinary branch-and-bound run finishes the proof.
+
+#define DEEPENING_MAX_LIMIT 8
+
+// Leaves ctx->best_* and best_stability_cost holding the optimum (or the incumbent if nothing
+// beats it) and ctx->solve_attempts the nodes of all passes.
+static void deepen_reroute_search(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  int incumbent = ctx->best_stability_cost;
+  long long nodes = 0;
+  for (int limit = 0; limit < incumbent; limit++) {
+    bool last = limit == DEEPENING_MAX_LIMIT;
+    int bound = last ? incumbent : limit + 1;
+
+    memset(ctx->tmp_s2_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+    memset(ctx->tmp_s1_owner_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+    memset(ctx->used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+    (void)apply_locked_base(ctx);
+    ctx->stability_cost = 0;
+    ctx->best_stability_cost = bound;
+    ctx->stop_cost = limit;  // every cheaper limit already came up empty
+    ctx->solve_attempts = 0;
+    ctx->last_report_attempts = 0;
+    gettimeofday(&ctx->last_report, NULL);
+
+    (void)backtrack(ctx, ctx->locked_count);
+    nodes += ctx->solve_attempts;
+    if (ctx->best_stability_cost < bound) {
+      incumbent = ctx->best_stability_cost;
+      break;
+    }
+    if (last) break;
+  }
+
+  ctx->best_stability_cost = incumbent;
+  ctx->stop_cost = 0;
+  ctx->solve_attempts = nodes;
+}
+
+// --- LIMITED DISCREPANCY SEARCH (--search lds) ------------------------------
+//
+// The 3-pass value ordering is usually right, and when it is wrong it tends to be wrong at only a
+// few demands. Depth-first search revisits those mistakes only after exhausting everything below
+// them; LDS instead runs waves with 0, 1, 2, ... discrepancies allowed, where a discrepancy is a
+// demand placed on anything but its first feasible spine. The incumbent and its cost bound carry
+// across waves. A wave in which no branch was cut for want of discrepancies has covered the whole
+// tree, so its result is optimal; until then every wave still prunes on cost like DFS.
+
+// Same contract as deepen_reroute_search()
+static void lds_reroute_search(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  long long nodes = 0;
+  int waves = 0;
+  ctx->lds_active = true;
+  for (int limit = 0; ctx->best_stability_cost > ctx->stop_cost; limit++) {
+    memset(ctx->tmp_s2_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+    memset(ctx->tmp_s1_owner_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+    memset(ctx->used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+    (void)apply_locked_base(ctx);
+    ctx->stability_cost = 0;
+    ctx->discrepancies_left = limit;
+    ctx->discrepancy_cut = false;
+    ctx->solve_attempts = 0;
+    ctx->last_report_attempts = 0;
+    gettimeofday(&ctx->last_report, NULL);
+
+    (void)backtrack(ctx, ctx->locked_count);
+    nodes += ctx->solve_attempts;
+    waves++;
+    if (!ctx->discrepancy_cut) break;  // nothing was skipped: the wave was exhaustive
+  }
+
+  fprintf(clos->out, "  LDS: cost %d after %d wave(s) (%lld nodes)\n", ctx->best_stability_cost, waves, nodes);
+  ctx->lds_active = false;
+  ctx->solve_attempts = nodes;
+}
+
+// --- CDCL SAT ENGINE (--search sat) -----------------------------------------
+//
+// Near capacity backtrack() can thrash, rediscovering the same trunk conflict under every
+// permutation of unrelated choices. A CDCL solver learns each conflict once, as a clause.
+// Encoding, for demands i, spines s and active inputs in:
+//   x[i][s]   demand i uses spine s; each demand needs at least one (decoding picks one)
+//   u[in][s]  input in holds its ingress block's Stage1 trunk on spine s (x[i][s] -> u[in][s])
+//   at most one demand per (spine, egress block), at most one input per (ingress block, spine)
+//   locked demands are unit clauses
+// Reroutes are minimized from above. The first call assumes every previous spine (the cost-0
+// check). After that a totalizer over the reroute literals, each repeated by its weight, turns
+// "cost <= k" into a single assumption, and k is tightened below each solution until the solver
+// answers UNSAT, which proves the last solution optimal. The solver is self-contained: two
+// watched literals, 1UIP learning, VSIDS, phase saving and Luby restarts. Learnt clauses are
+// never deleted; SAT_CONFLICT_LIMIT bounds them, and when it is hit the deepening search
+// finishes the proof from the best solution so far.
+
+#define SAT_CONFLICT_LIMIT 200000   // per repack
+#define SAT_RESTART_BASE 100        // conflicts per Luby unit
+#define SAT_PAIRWISE_AMO_MAX 5      // larger at-most-one groups use the sequential encoding
+
+typedef struct {
+  int *data;
+  int len;
+  int cap;
+} SatVec;
+
+typedef struct {
+  int num_vars;
+  int var_cap;
+  SatVec arena;            // clauses as [size, lit0, lit1, ...]; a clause is its arena offset
+  SatVec *watches;         // per literal: clauses watching it, visited when it becomes false
+  signed char *value;      // per variable: -1 unassigned, 0 false, 1 true
+  signed char *phase;      // saved polarity, used for the next decision on the variable
+  signed char *model;      // last satisfying assignment
+  int *level;
+  int *reason;             // clause that implied the variable, -1 for decisions and root units
+  double *activity;
+  double var_inc;
+  int *heap;               // max-heap of variables on activity
+  int *heap_pos;           // -1 when not in the heap
+  int heap_len;
+  bool *seen;
+  SatVec trail;            // literals in assignment order
+  SatVec trail_lim;        // trail length at the start of each decision level
+  int qhead;
+  SatVec learnt;
+  SatVec tmp;
+  int num_clauses;
+  long long conflicts;
+  long long decisions;
+  bool unsat;              // the clauses alone are unsatisfiable
+  bool oom;
+} SatSolver;
+
+// Literals are 2 * var for the positive and 2 * var + 1 for the negative phase
+static inline int sat_lit(int v, bool positive) {
+  return 2 * v + (positive ? 0 : 1);
+}
+
+static inline int sat_value(const SatSolver *sat, int lit) {
+  int v = sat->value[lit >> 1];
+  return v < 0 ? -1 : v ^ (lit & 1);
+}
+
+static bool sat_push(SatSolver *sat, SatVec *vec, int x) {
+  if (vec->len == vec->cap) {
+    int new_cap = vec->cap == 0 ? 16 : vec->cap * 2;
+    int *next = realloc(vec->data, sizeof(int) * (size_t)new_cap);
+    if (!next) {
+      sat->oom = true;
+      return false;
+    }
+    vec->data = next;
+    vec->cap = new_cap;
+  }
+  vec->data[vec->len++] = x;
+  return true;
+}
+
+static void sat_heap_up(SatSolver *sat, int pos) {
+  int v = sat->heap[pos];
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (sat->activity[sat->heap[parent]] >= sat->activity[v]) break;
+    sat->heap[pos] = sat->heap[parent];
+    sat->heap_pos[sat->heap[pos]] = pos;
+    pos = parent;
+  }
+  sat->heap[pos] = v;
+  sat->heap_pos[v] = pos;
+}
+
+static void sat_heap_down(SatSolver *sat, int pos) {
+  int v = sat->heap[pos];
+  for (;;) {
+    int child = 2 * pos + 1;
+    if (child >= sat->heap_len) break;
+    if (child + 1 < sat->heap_len && sat->activity[sat->heap[child + 1]] > sat->activity[sat->heap[child]]) child++;
+    if (sat->activity[sat->heap[child]] <= sat->activity[v]) break;
+    sat->heap[pos] = sat->heap[child];
+    sat->heap_pos[sat->heap[pos]] = pos;
+    pos = child;
+  }
+  sat->heap[pos] = v;
+  sat->heap_pos[v] = pos;
+}
+
+static void sat_heap_insert(SatSolver *sat, int v) {
+  if (sat->heap_pos[v] >= 0) return;
+  sat->heap[sat->heap_len] = v;
+  sat->heap_pos[v] = sat->heap_len++;
+  sat_heap_up(sat, sat->heap_pos[v]);
+}
+
+static int sat_heap_pop(SatSolver *sat) {
+  int v = sat->heap[0];
+  sat->heap_pos[v] = -1;
+  if (--sat->heap_len > 0) {
+    sat->heap[0] = sat->heap[sat->heap_len];
+    sat->heap_pos[sat->heap[0]] = 0;
+    sat_heap_down(sat, 0);
+  }
+  return v;
+}
+
+#define SAT_GROW(array, count)                                         \
+  do {                                                                 \
+    void *next_ = realloc((array), sizeof(*(array)) * (size_t)(count)); \
+    if (!next_) {                                                      \
+      sat->oom = true;                                                 \
+      return -1;                                                       \
+    }                                                                  \
+    (array) = next_;                                                   \
+  } while (0)
+
+// Variables are only created at the root level, between solves
+static int sat_new_var(SatSolver *sat, bool phase, double activity) {
+  if (sat->oom) return -1;
+  if (sat->num_vars == sat->var_cap) {
+    int cap = sat->var_cap == 0 ? 1024 : sat->var_cap * 2;
+    SAT_GROW(sat->value, cap);
+    SAT_GROW(sat->phase, cap);
+    SAT_GROW(sat->model, cap);
+    SAT_GROW(sat->level, cap);
+    SAT_GROW(sat->reason, cap);
+    SAT_GROW(sat->activity, cap);
+    SAT_GROW(sat->heap, cap);
+    SAT_GROW(sat->heap_pos, cap);
+    SAT_GROW(sat->seen, cap);
+    SAT_GROW(sat->watches, 2 * cap);
+    memset(sat->watches + 2 * sat->var_cap, 0, sizeof(SatVec) * 2 * (size_t)(cap - sat->var_cap));
+    sat->var_cap = cap;
+  }
+  int v = sat->num_vars++;
+  sat->value[v] = -1;
+  sat->phase[v] = phase ? 1 : 0;
+  sat->level[v] = 0;
+  sat->reason[v] = -1;
+  sat->activity[v] = activity;
+  sat->heap_pos[v] = -1;
+  sat->seen[v] = false;
+  sat_heap_insert(sat, v);
+  return v;
+}
+
+static void sat_free(SatSolver *sat) {
+  for (int l = 0; l < 2 * sat->var_cap; l++) free(sat->watches[l].data);
+  free(sat->watches);
+  free(sat->arena.data);
+  free(sat->value);
+  free(sat->phase);
+  free(sat->model);
+  free(sat->level);
+  free(sat->reason);
+  free(sat->activity);
+  free(sat->heap);
+  free(sat->heap_pos);
+  free(sat->seen);
+  free(sat->trail.data);
+  free(sat->trail_lim.data);
+  free(sat->learnt.data);
+  free(sat->tmp.data);
+}
+
+static void sat_enqueue(SatSolver *sat, int lit, int reason) {
+  int v = lit >> 1;
+  sat->value[v] = (signed char)((lit & 1) ^ 1);
+  sat->level[v] = sat->trail_lim.len;
+  sat->reason[v] = reason;
+  (void)sat_push(sat, &sat->trail, lit);
+}
+
+// Stores a clause of two or more unassigned-or-false literals, watching the first two
+static int sat_attach(SatSolver *sat, const int *lits, int n) {
+  int cref = sat->arena.len;
+  if (!sat_push(sat, &sat->arena, n)) return -1;
+  for (int k = 0; k < n; k++) {
+    if (!sat_push(sat, &sat->arena, lits[k])) return -1;
+  }
+  if (!sat_push(sat, &sat->watches[lits[0]], cref) || !sat_push(sat, &sat->watches[lits[1]], cref)) return -1;
+  sat->num_clauses++;
+  return cref;
+}
+
+// Adds a problem clause at the root level, dropping literals already false there
+static void sat_add_clause(SatSolver *sat, const int *lits, int n) {
+  if (sat->unsat || sat->oom) return;
+  sat->tmp.len = 0;
+  for (int k = 0; k < n; k++) {
+    int val = sat_value(sat, lits[k]);
+    if (val == 1) return;
+    if (val == 0) continue;
+    bool dup = false;
+    for (int m = 0; m < sat->tmp.len; m++) {
+      if (sat->tmp.data[m] == (lits[k] ^ 1)) return;  // tautology
+      if (sat->tmp.data[m] == lits[k]) dup = true;
+    }
+    if (!dup && !sat_push(sat, &sat->tmp, lits[k])) return;
+  }
+  if (sat->tmp.len == 0) {
+    sat->unsat = true;
+  } else if (sat->tmp.len == 1) {
+    sat_enqueue(sat, sat->tmp.data[0], -1);
+  } else {
+    (void)sat_attach(sat, sat->tmp.data, sat->tmp.len);
+  }
+}
+
+static void sat_add_binary(SatSolver *sat, int a, int b) {
+  int lits[2] = {a, b};
+  sat_add_clause(sat, lits, 2);
+}
+
+static void sat_at_most_one(SatSolver *sat, const int *lits, int n) {
+  if (n <= SAT_PAIRWISE_AMO_MAX) {
+    for (int a = 0; a < n; a++) {
+      for (int b = a + 1; b < n; b++) sat_add_binary(sat, lits[a] ^ 1, lits[b] ^ 1);
+    }
+    return;
+  }
+  // Sequential counter: prefix k is true once any of lits[0..k] is
+  int prefix = sat_lit(sat_new_var(sat, false, 0.0), true);
+  if (sat->oom) return;
+  sat_add_binary(sat, lits[0] ^ 1, prefix);
+  for (int k = 1; k < n; k++) {
+    sat_add_binary(sat, lits[k] ^ 1, prefix ^ 1);
+    if (k == n - 1) break;
+    int next = sat_lit(sat_new_var(sat, false, 0.0), true);
+    if (sat->oom) return;
+    sat_add_binary(sat, lits[k] ^ 1, next);
+    sat_add_binary(sat, prefix ^ 1, next);
+    prefix = next;
+  }
+}
+
+// Returns the conflicting clause, or -1 once every enqueued literal has been propagated
+static int sat_propagate(SatSolver *sat) {
+  while (sat->qhead < sat->trail.len) {
+    int false_lit = sat->trail.data[sat->qhead++] ^ 1;
+    SatVec *ws = &sat->watches[false_lit];
+    int i = 0;
+    int j = 0;
+    while (i < ws->len) {
+      int cref = ws->data[i++];
+      int size = sat->arena.data[cref];
+      int *c = &sat->arena.data[cref + 1];
+      if (c[0] == false_lit) {
+        c[0] = c[1];
+        c[1] = false_lit;
+      }
+      if (sat_value(sat, c[0]) == 1) {
+        ws->data[j++] = cref;
+        continue;
+      }
+
+      bool moved = false;
+      for (int k = 2; k < size; k++) {
+        if (sat_value(sat, c[k]) != 0) {
+          c[1] = c[k];
+          c[k] = false_lit;
+          (void)sat_push(sat, &sat->watches[c[1]], cref);
+          moved = true;
+          break;
+        }
+      }
+      if (moved) continue;
+
+      ws->data[j++] = cref;
+      if (sat_value(sat, c[0]) == 0) {
+        while (i < ws->len) ws->data[j++] = ws->data[i++];
+        ws->len = j;
+        sat->qhead = sat->trail.len;
+        return cref;
+      }
+      sat_enqueue(sat, c[0], cref);  // c[0] stays the implied literal while it is assigned
+    }
+    ws->len = j;
+  }
+  return -1;
+}
+
+static void sat_bump(SatSolver *sat, int v) {
+  if ((sat->activity[v] += sat->var_inc) > 1e100) {
+    for (int k = 0; k < sat->num_vars; k++) sat->activity[k] *= 1e-100;
+    sat->var_inc *= 1e-100;
+  }
+  if (sat->heap_pos[v] >= 0) sat_heap_up(sat, sat->heap_pos[v]);
+}
+
+// 1UIP analysis: leaves the learnt clause in sat->learnt, asserting literal first and a literal
+// of the backjump level second, and returns the backjump level
+static int sat_analyze(SatSolver *sat, int confl) {
+  int current = sat->trail_lim.len;
+  int pending = 0;
+  int lit = -1;
+  int idx = sat->trail.len - 1;
+  sat->learnt.len = 0;
+  (void)sat_push(sat, &sat->learnt, -1);
+
+  do {
+    int size = sat->arena.data[confl];
+    for (int k = lit < 0 ? 0 : 1; k < size; k++) {
+      int q = sat->arena.data[confl + 1 + k];
+      int v = q >> 1;
+      if (sat->seen[v] || sat->level[v] == 0) continue;
+      sat->seen[v] = true;
+      sat_bump(sat, v);
+      if (sat->level[v] >= current) {
+        pending++;
+      } else {
+        (void)sat_push(sat, &sat->learnt, q);
+      }
+    }
+    while (!sat->seen[sat->trail.data[idx] >> 1]) idx--;
+    lit = sat->trail.data[idx--];
+    confl = sat->reason[lit >> 1];
+    sat->seen[lit >> 1] = false;
+    pending--;
+  } while (pending > 0);
+  sat->learnt.data[0] = lit ^ 1;
+
+  int back = 0;
+  for (int k = 1; k < sat->learnt.len; k++) {
+    int v = sat->learnt.data[k] >> 1;
+    sat->seen[v] = false;
+    if (sat->level[v] > back) {
+      back = sat->level[v];
+      int tmp = sat->learnt.data[1];
+      sat->learnt.data[1] = sat->learnt.data[k];
+      sat->learnt.data[k] = tmp;
+    }
+  }
+  return back;
+}
+
+static void sat_cancel_until(SatSolver *sat, int level) {
+  if (sat->trail_lim.len <= level) return;
+  int start = sat->trail_lim.data[level];
+  for (int k = sat->trail.len - 1; k >= start; k--) {
+    int v = sat->trail.data[k] >> 1;
+    sat->phase[v] = sat->value[v];
+    sat->value[v] = -1;
+    sat->reason[v] = -1;
+    sat_heap_insert(sat, v);
+  }
+  sat->trail.len = start;
+  sat->qhead = start;
+  sat->trail_lim.len = level;
+}
+
+// Luby sequence 1 1 2 1 1 2 4 1 1 2 ... for i = 0, 1, 2, ...
+static int sat_luby(int i) {
+  int size = 1;
+  int seq = 0;
+  while (size < i + 1) {
+    seq++;
+    size = 2 * size + 1;
+  }
+  while (size - 1 != i) {
+    size = (size - 1) >> 1;
+    seq--;
+    i %= size;
+  }
+  return 1 << seq;
+}
+
+// 1 = satisfiable (model saved), 0 = unsatisfiable under the assumptions, -1 = conflict limit
+// reached or out of memory. Always returns at the root level.
+static int sat_solve(SatSolver *sat, const int *assumptions, int num_assumptions, long long conflict_limit) {
+  if (sat->unsat) return 0;
+  if (sat->oom) return -1;
+  int restarts = 0;
+  long long restart_at = sat->conflicts + SAT_RESTART_BASE;
+
+  for (;;) {
+    int confl = sat_propagate(sat);
+    if (confl >= 0) {
+      sat->conflicts++;
+      if (sat->trail_lim.len == 0) {
+        sat->unsat = true;
+        return 0;
+      }
+      int back = sat_analyze(sat, confl);
+      sat_cancel_until(sat, back);
+      if (sat->learnt.len == 1) {
+        sat_enqueue(sat, sat->learnt.data[0], -1);
+      } else {
+        int cref = sat_attach(sat, sat->learnt.data, sat->learnt.len);
+        if (cref >= 0) sat_enqueue(sat, sat->learnt.data[0], cref);
+      }
+      sat->var_inc *= 1.0 / 0.95;
+
+      if (sat->oom || sat->conflicts >= conflict_limit) {
+        sat_cancel_until(sat, 0);
+        return -1;
+      }
+      if (sat->conflicts >= restart_at) {
+        sat_cancel_until(sat, 0);
+        restart_at = sat->conflicts + (long long)SAT_RESTART_BASE * sat_luby(++restarts);
+      }
+      continue;
+    }
+
+    // Assumptions are the first decisions; one already false means UNSAT under them
+    int next = -1;
+    while (sat->trail_lim.len < num_assumptions) {
+      int a = assumptions[sat->trail_lim.len];
+      int val = sat_value(sat, a);
+      if (val == 0) {
+        sat_cancel_until(sat, 0);
+        return 0;
+      }
+      if (val < 0) {
+        next = a;
+        break;
+      }
+      (void)sat_push(sat, &sat->trail_lim, sat->trail.len);  // already true: empty level
+    }
+    while (next < 0 && sat->heap_len > 0) {
+      int v = sat_heap_pop(sat);
+      if (sat->value[v] < 0) next = sat_lit(v, sat->phase[v] == 1);
+    }
+    if (next < 0) {
+      memcpy(sat->model, sat->value, (size_t)sat->num_vars);
+      sat_cancel_until(sat, 0);
+      return 1;
+    }
+
+    sat->decisions++;
+    (void)sat_push(sat, &sat->trail_lim, sat->trail.len);
+    sat_enqueue(sat, next, -1);
+  }
+}
+
+// Totalizer over lits[0, n): writes min(n, cap) outputs to out, where out[k] is forced true
+// whenever more than k inputs are. Returns the number written (0 when out of memory).
+static int sat_totalizer(SatSolver *sat, const int *lits, int n, int cap, int *out) {
+  if (n == 1) {
+    out[0] = lits[0];
+    return 1;
+  }
+  int half = n / 2;
+  int *left = malloc(sizeof(int) * (size_t)(half < cap ? half : cap));
+  int *right = malloc(sizeof(int) * (size_t)(n - half < cap ? n - half : cap));
+  int nl = left && right ? sat_totalizer(sat, lits, half, cap, left) : 0;
+  int nr = nl > 0 ? sat_totalizer(sat, lits + half, n - half, cap, right) : 0;
+  int m = 0;
+  if (nr > 0) {
+    m = nl + nr < cap ? nl + nr : cap;
+    for (int k = 0; k < m; k++) out[k] = sat_lit(sat_new_var(sat, false, 0.0), true);
+    // i inputs on the left and j on the right force out[i + j - 1]; sums past m are implied
+    for (int i = 0; i <= nl && !sat->oom; i++) {
+      for (int j = i == 0 ? 1 : 0; j <= nr && i + j <= m; j++) {
+        int clause[3];
+        int len = 0;
+        if (i > 0) clause[len++] = left[i - 1] ^ 1;
+        if (j > 0) clause[len++] = right[j - 1] ^ 1;
+        clause[len++] = out[i + j - 1];
+        sat_add_clause(sat, clause, len);
+      }
+    }
+  }
+  if (!left || !right) sat->oom = true;
+  free(left);
+  free(right);
+  return sat->oom ? 0 : m;
+}
+
+// Reads the model into ctx->assignment and returns its stability cost. A demand may have several
+// spine variables true (any one of them is valid); the lock, then the previous spine, wins.
+static int sat_decode(clos_ctx *clos, const SatSolver *sat, SolverCtx *ctx) {
+  int cost = 0;
+  for (int i = 0; i < ctx->num_demands; i++) {
+    const Demand *d = &ctx->demands[i];
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    int chosen = -1;
+    if (i < ctx->locked_count) {
+      chosen = clos->lock_spine_for[d->input_id][d->egress_block];
+    } else if (prev_spine >= 0 && sat->model[i * N + prev_spine] == 1) {
+      chosen = prev_spine;
+    }
+    for (int sp = 0; sp < N && chosen < 0; sp++) {
+      if (sat->model[i * N + sp] == 1) chosen = sp;
+    }
+    ctx->assignment[i] = chosen;
+    if (i >= ctx->locked_count && prev_spine >= 0 && chosen != prev_spine) {
+      cost += reroute_cost(ctx, d->input_id, d->egress_block);
+    }
+  }
+  return cost;
+}
+
+// Same contract as deepen_reroute_search(); ctx->solve_attempts counts SAT decisions
+static void sat_reroute_search(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  SatSolver sat;
+  memset(&sat, 0, sizeof(sat));
+  sat.var_inc = 1.0;
+
+  int nd = ctx->num_demands;
+  int *input_index = malloc(sizeof(int) * ((size_t)MAX_PORTS + 1));
+  int *lits = malloc(sizeof(int) * (size_t)(nd > N ? nd : N));
+  if (!input_index || !lits) {
+    free(input_index);
+    free(lits);
+    deepen_reroute_search(ctx);
+    return;
+  }
+
+  // x[i][s] = variable i * N + s, then u[in][s] = u_base + input_index[in] * N + s
+  for (int i = 0; i < nd; i++) {
+    const Demand *d = &ctx->demands[i];
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    for (int sp = 0; sp < N; sp++) (void)sat_new_var(&sat, sp == prev_spine, sp == prev_spine ? 1.0 : 0.0);
+  }
+  for (int in_id = 0; in_id <= MAX_PORTS; in_id++) input_index[in_id] = -1;
+  int active = 0;
+  for (int i = 0; i < nd; i++) {
+    if (input_index[ctx->demands[i].input_id] < 0) input_index[ctx->demands[i].input_id] = active++;
+  }
+  int u_base = sat.num_vars;
+  for (int k = 0; k < active * N; k++) (void)sat_new_var(&sat, false, 0.0);
+
+  for (int i = 0; i < nd && !sat.oom; i++) {
+    const Demand *d = &ctx->demands[i];
+    for (int sp = 0; sp < N; sp++) {
+      lits[sp] = sat_lit(i * N + sp, true);
+      sat_add_binary(&sat, lits[sp] ^ 1, sat_lit(u_base + input_index[d->input_id] * N + sp, true));
+    }
+    sat_add_clause(&sat, lits, N);
+    if (i < ctx->locked_count) {
+      int unit = sat_lit(i * N + clos->lock_spine_for[d->input_id][d->egress_block], true);
+      sat_add_clause(&sat, &unit, 1);
+    }
+  }
+  for (int e = 0; e < TOTAL_BLOCKS && !sat.oom; e++) {
+    for (int sp = 0; sp < N; sp++) {
+      int n = 0;
+      for (int i = 0; i < nd; i++) {
+        if (ctx->demands[i].egress_block == e) lits[n++] = sat_lit(i * N + sp, true);
+      }
+      sat_at_most_one(&sat, lits, n);
+    }
+  }
+  for (int b = 0; b < TOTAL_BLOCKS && !sat.oom; b++) {
+    for (int sp = 0; sp < N; sp++) {
+      int n = 0;
+      for (int in_id = b * N + 1; in_id <= (b + 1) * N; in_id++) {
+        if (input_index[in_id] >= 0) lits[n++] = sat_lit(u_base + input_index[in_id] * N + sp, true);
+      }
+      sat_at_most_one(&sat, lits, n);
+    }
+  }
+
+  // Cost 0 check: every free demand with a previous spine keeps it
+  int n_assume = 0;
+  int weight_total = 0;
+  for (int i = ctx->locked_count; i < nd; i++) {
+    const Demand *d = &ctx->demands[i];
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    if (prev_spine < 0) continue;
+    lits[n_assume++] = sat_lit(i * N + prev_spine, true);
+    weight_total += reroute_cost(ctx, d->input_id, d->egress_block);
+  }
+  long long limit = SAT_CONFLICT_LIMIT;
+  int calls = 1;
+  int result = sat_solve(&sat, lits, n_assume, limit);
+  if (result == 1) {
+    ctx->best_stability_cost = sat_decode(clos, &sat, ctx);
+    record_best(ctx);
+  }
+
+  // No incumbent to tighten from: any solution first
+  if (result == 0 && ctx->best_stability_cost == 999999) {
+    calls++;
+    result = sat_solve(&sat, NULL, 0, limit);
+    if (result == 1) {
+      ctx->best_stability_cost = sat_decode(clos, &sat, ctx);
+      record_best(ctx);
+      result = 0;  // tighten below it
+    } else if (result == 0) {
+      result = 1;  // no solution at all: nothing left to prove
+    }
+  }
+
+  // Tighten: out[k] is true once more than k reroute units are spent
+  int *reroute_lits = NULL;
+  int *out = NULL;
+  int outputs = 0;
+  int cap = ctx->best_stability_cost;
+  if (result == 0 && cap > 1 && n_assume > 0) {
+    int units = 0;
+    reroute_lits = malloc(sizeof(int) * (size_t)weight_total);
+    out = malloc(sizeof(int) * (size_t)cap);
+    if (reroute_lits && out) {
+      for (int k = 0; k < n_assume; k++) {
+        const Demand *d = &ctx->demands[lits[k] / 2 / N];
+        int w = reroute_cost(ctx, d->input_id, d->egress_block);
+        for (int r = 0; r < w && r < cap; r++) reroute_lits[units++] = lits[k] ^ 1;
+      }
+      outputs = sat_totalizer(&sat, reroute_lits, units, cap, out);
+    }
+    if (outputs == 0) result = -1;
+  }
+  while (result == 0 && ctx->best_stability_cost > 1 && outputs > 0) {
+    int k = ctx->best_stability_cost - 1;  // look for cost <= k
+    int assume = out[k < outputs ? k : outputs - 1] ^ 1;
+    calls++;
+    result = sat_solve(&sat, &assume, k < outputs ? 1 : 0, limit);
+    if (result == 1) {
+      ctx->best_stability_cost = sat_decode(clos, &sat, ctx);
+      record_best(ctx);
+      result = 0;
+    } else if (result == 0) {
+      result = 1;  // proven: nothing at or below k
+    }
+  }
+  free(reroute_lits);
+  free(out);
+  free(input_index);
+  free(lits);
+
+  long long nodes = sat.decisions;
+  fprintf(clos->out, "  SAT: %d vars, %d clauses, %lld conflicts in %d call(s), ", sat.num_vars, sat.num_clauses,
+          sat.conflicts, calls);
+  if (result < 0) {
+    fprintf(clos->out, "limit hit, finishing with depth-first search\n");
+  } else if (ctx->best_stability_cost == 999999) {
+    fprintf(clos->out, "no solution\n");
+  } else {
+    fprintf(clos->out, "cost %d\n", ctx->best_stability_cost);
+  }
+  sat_free(&sat);
+
+  if (result < 0) {
+    deepen_reroute_search(ctx);
+    nodes += ctx->solve_attempts;
+  }
+  ctx->solve_attempts = nodes;
+}
+
+// --- LARGE NEIGHBOURHOOD SEARCH (--lns-budget MS) ---------------------------
+//
+// The optimality proof is most of the time on a hard edit. --lns-budget trades it for bounded
+// latency. Starting from the incumbent, each round frees a neighbourhood around a rerouted demand:
+// every free demand into its egress block, or out of its ingress block, or a random handful.
+// The rest stay pinned at their current spines while backtrack() re-solves the neighbourhood
+// exactly under a node cap, and a cheaper result becomes the new incumbent. Rounds stop at the
+// time budget, at a lower bound (the reroutes forced because a lock holds a previous trunk), or
+// after LNS_STALE_ROUNDS rounds in a row without improvement.
+
+#define LNS_NODE_LIMIT 20000  // per round
+#define LNS_RANDOM_SIZE 8     // expected demands freed by a random round
+#define LNS_STALE_ROUNDS 60   // rounds in a row without improvement that end the search early
+
+// Expects ctx reset to the locked base
+static int lns_lower_bound(const SolverCtx *ctx) {
+  int lb = 0;
+  for (int i = ctx->locked_count; i < ctx->num_demands; i++) {
+    const Demand *d = &ctx->demands[i];
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    if (prev_spine < 0) continue;
+    int s2_owner = ctx->tmp_s2[prev_spine][d->egress_block];
+    int s1_owner = ctx->tmp_s1_owner[d->ingress_block][prev_spine];
+    if ((s2_owner != 0 && s2_owner != d->input_id) || (s1_owner != 0 && s1_owner != d->input_id)) {
+      lb += reroute_cost(ctx, d->input_id, d->egress_block);
+    }
+  }
+  return lb;
+}
+
+static void lns_reset_base(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  memset(ctx->tmp_s2_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+  memset(ctx->tmp_s1_owner_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+  memset(ctx->used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+  (void)apply_locked_base(ctx);
+}
+
+// Needs an incumbent in ctx->best_*; leaves the improved one there and ctx->solve_attempts the
+// nodes of all rounds
+static void lns_reroute_search(SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  long long deadline = now_us() + (long long)clos->lns_budget_ms * 1000;
+  int nd = ctx->num_demands;
+  int first = ctx->locked_count;
+  int free_count = nd - first;
+  lns_reset_base(ctx);
+  int lb = lns_lower_bound(ctx);
+
+  uint32_t rng = 0x2545F491u ^ (uint32_t)nd;
+  int start_cost = ctx->best_stability_cost;
+  int rounds = 0;
+  int improvements = 0;
+  int stale = 0;
+  long long nodes = 0;
+  while (ctx->best_stability_cost > lb && stale < LNS_STALE_ROUNDS && now_us() < deadline) {
+    memcpy(ctx->demands, ctx->best_demands, sizeof(Demand) * (size_t)nd);
+    memcpy(ctx->assignment, ctx->best_assignment, sizeof(int) * (size_t)nd);
+
+    // Centre the neighbourhood on a random rerouted demand
+    int rerouted = 0;
+    for (int i = first; i < nd; i++) {
+      int prev_spine = ctx->prev_spine_for[ctx->demands[i].input_id][ctx->demands[i].egress_block];
+      if (prev_spine >= 0 && ctx->assignment[i] != prev_spine) rerouted++;
+    }
+    if (rerouted == 0) break;  // cost sits entirely in the locked demands
+    int pick = (int)(ls_random(&rng) % (uint32_t)rerouted);
+    Demand centre = ctx->demands[first];
+    for (int i = first; i < nd; i++) {
+      int prev_spine = ctx->prev_spine_for[ctx->demands[i].input_id][ctx->demands[i].egress_block];
+      if (prev_spine >= 0 && ctx->assignment[i] != prev_spine && pick-- == 0) centre = ctx->demands[i];
+    }
+
+    // Pinned demands move to just after the locked prefix, freed ones after them
+    int kind = rounds % 3;
+    int pinned = 0;
+    for (int i = first; i < nd; i++) {
+      const Demand *d = &ctx->demands[i];
+      bool freed;
+      if (kind == 0) {
+        freed = d->egress_block == centre.egress_block;
+      } else if (kind == 1) {
+        freed = d->ingress_block == centre.ingress_block;
+      } else {
+        freed = (d->input_id == centre.input_id && d->egress_block == centre.egress_block) ||
+                ls_random(&rng) % (uint32_t)free_count < LNS_RANDOM_SIZE;
+      }
+      if (freed) continue;
+      int at = first + pinned++;
+      Demand tmp = ctx->demands[at];
+      ctx->demands[at] = ctx->demands[i];
+      ctx->demands[i] = tmp;
+      int atmp = ctx->assignment[at];
+      ctx->assignment[at] = ctx->assignment[i];
+      ctx->assignment[i] = atmp;
+    }
+
+    lns_reset_base(ctx);
+    int pinned_cost = 0;
+    for (int i = first; i < first + pinned; i++) {
+      const Demand *d = &ctx->demands[i];
+      int sp = ctx->assignment[i];
+      ctx->tmp_s2[sp][d->egress_block] = d->input_id;
+      ctx->tmp_s1_owner[d->ingress_block][sp] = d->input_id;
+      bitset_set(bitset_row(ctx->used_spines_mask, d->input_id, ctx->spine_words), sp);
+      int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+      if (prev_spine >= 0 && sp != prev_spine) pinned_cost += reroute_cost(ctx, d->input_id, d->egress_block);
+    }
+
+    int before = ctx->best_stability_cost;
+    ctx->stability_cost = pinned_cost;
+    ctx->stop_cost = pinned_cost > lb ? pinned_cost : lb;
+    ctx->solve_attempts = 0;
+    ctx->node_limit = LNS_NODE_LIMIT;
+    ctx->node_limit_hit = false;
+    (void)backtrack(ctx, first + pinned);
+    nodes += ctx->solve_attempts;
+    if (ctx->best_stability_cost < before) {
+      improvements++;
+      stale = 0;
+    } else {
+      stale++;
+    }
+    rounds++;
+  }
+
+  fprintf(clos->out, "  LNS: cost %d -> %d in %d round(s), %d improvement(s) (%lld nodes)%s\n", start_cost,
+         ctx->best_stability_cost, rounds, improvements, nodes,
+         ctx->best_stability_cost > lb ? ", not proven optimal" : "");
+  ctx->stop_cost = 0;
+  ctx->node_limit = 0;
+  ctx->node_limit_hit = false;
+  ctx->solve_attempts = nodes;
+}
+
+// --- SOLVER MEMORY (--learn FILE) ------------------------------------------
+//
+// Consecutive commands differ by a handful of demands, and the demands that had to be rerouted
+// last time sit where the fabric is contested, which is where the next proof spends its nodes.
+// Each of them gets a conflict score (+LEARN_REROUTE_BUMP per reroute), and MRV branches on the
+// highest score among equally constrained demands, so the search settles the contested region
+// first. The UI runs one process per edit, so the scores live in FILE between runs: they are
+// halved on load and dropped on save when their demand is gone. Off by default: it changes which
+// of several equally cheap routings is found, so results stop being reproducible from the routes
+// file alone.
+
+#define LEARN_REROUTE_BUMP 8
+
+static void learn_from_solution(const SolverCtx *ctx) {
+  clos_ctx *clos = ctx->clos;
+  for (int i = 0; i < ctx->num_demands; i++) {
+    const Demand *d = &ctx->best_demands[i];
+    int prev_spine = ctx->prev_spine_for[d->input_id][d->egress_block];
+    if (prev_spine >= 0 && ctx->best_assignment[i] != prev_spine) {
+      clos->solver_scratch.demand_activity[d->input_id][d->egress_block] += LEARN_REROUTE_BUMP;
+    }
+  }
+}
+
+static bool save_solver_memory(clos_ctx *clos, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror("solver memory file");
+    return false;
+  }
+
+  // Scores of demands that no longer exist are dropped
+  bool *present = calloc(((size_t)MAX_PORTS + 1) * (size_t)TOTAL_BLOCKS, sizeof(bool));
+  if (!present) {
+    fclose(f);
+    return false;
+  }
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    int owner = clos->desired_owner[p];
+    if (owner > 0) present[(size_t)owner * (size_t)TOTAL_BLOCKS + (size_t)get_block(clos, p)] = true;
+  }
+  int **activity = clos->solver_scratch.demand_activity;
+  int live = 0;
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (!present[(size_t)in_id * (size_t)TOTAL_BLOCKS + (size_t)e]) activity[in_id][e] = 0;
+      if (activity[in_id][e] > 0) live++;
+    }
+  }
+  free(present);
+
+  fprintf(f, "clos-solver-memory 1 %d %d\n", N, live);
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (activity[in_id][e] > 0) fprintf(f, "%d %d %d\n", in_id, e, activity[in_id][e]);
+    }
+  }
+
+  fclose(f);
+  return true;
+}
+
+static bool load_solver_memory(clos_ctx *clos, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) return false;  // first run: nothing learned yet
+
+  int version = 0, size = 0, count = 0;
+  if (fscanf(f, "clos-solver-memory %d %d %d", &version, &size, &count) != 3 || version != 1 || size != N) {
+    fclose(f);
+    return false;
+  }
+
+  for (int c = 0; c < count; c++) {
+    int in_id = 0, e = 0, score = 0;
+    if (fscanf(f, "%d %d %d", &in_id, &e, &score) != 3) break;
+    if (in_id < 1 || in_id > MAX_PORTS || e < 0 || e >= TOTAL_BLOCKS || score < 0) break;
+    clos->solver_scratch.demand_activity[in_id][e] = score >> 1;
+  }
+
+  fclose(f);
+  return true;
+}
+
+// --- SOLUTION CACHE ---------------------------------------------------------
+//
+// UI sessions toggle, undo and redo constantly, so the same solver input comes back again and again.
+// Each successful solve is remembered as a spine per demand (in build_demands() order), keyed by a
+// 64-bit hash of everything the search reads: the demand set, previous spines, reroute weights,
+// locks and the objective flags. A hit rebuilds the fabric in O(demands) and is re-validated before
+// use, so a hash collision can only cost a miss. Eviction is LRU; --solution-cache persists entries.
+
+struct SolutionCacheEntry {
+  uint64_t key;
+  int num_demands;
+  int stability_cost;       // demand reroutes (last_stability_cost)
+  int reroute_cost;         // optimized, possibly weighted, cost (last_reroute_cost)
+  unsigned long long last_used;
+  int *spines;              // spine per demand, build_demands() order
+};
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t v) {
+  // splitmix64 finalizer over (h ^ v)
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+static uint64_t solution_cache_key(clos_ctx *clos, const Demand *demands, int num_demands, int **prev_spine_for,
+                                   int **reroute_weight) {
+  uint64_t h = hash_mix(0, (uint64_t)N);
+  h = hash_mix(h, (uint64_t)(clos->output_weighted ? 1 : 0) | (uint64_t)(clos->min_branches_mode ? 2 : 0));
+  if (clos->min_branches_mode) h = hash_mix(h, (uint64_t)clos->branch_node_budget ^ (uint64_t)(clos->defrag_reroutes + 1) << 48);
+  // Searches that stop early (a reroute cap, LNS time budget, LDS/SAT engines) can settle on
+  // different solutions, so each setting keeps its own entries
+  h = hash_mix(h, (uint64_t)clos->search_engine << 32 | (uint32_t)(clos->max_reroutes + 1));
+  h = hash_mix(h, (uint64_t)(uint32_t)clos->lns_budget_ms);
+  h = hash_mix(h, (uint64_t)num_demands);
+
+  for (int i = 0; i < num_demands; i++) {
+    int in_id = demands[i].input_id;
+    int e = demands[i].egress_block;
+    int locked = clos->have_locks ? clos->lock_spine_for[in_id][e] : -1;
+    int weight = reroute_weight ? reroute_weight[in_id][e] : 1;
+    h = hash_mix(h, (uint64_t)(uint32_t)in_id << 32 | (uint32_t)e);
+    h = hash_mix(h, (uint64_t)(uint32_t)(prev_spine_for[in_id][e] + 1) << 32 | (uint32_t)(locked + 1));
+    h = hash_mix(h, (uint64_t)(uint32_t)weight);
+    if (clos->placement_hints) h = hash_mix(h, (uint64_t)(uint32_t)(clos->solver_scratch.plan_hint[in_id][e] + 1));
+  }
+  return h;
+}
+
+static void free_solution_cache(clos_ctx *clos) {
+  for (int i = 0; i < clos->solution_cache_count; i++) free(clos->solution_cache[i].spines);
+  free(clos->solution_cache);
+  clos->solution_cache = NULL;
+  clos->solution_cache_count = 0;
+  clos->solution_cache_tick = 0;
+}
+
+static SolutionCacheEntry *solution_cache_find(clos_ctx *clos, uint64_t key, int num_demands) {
+  for (int i = 0; i < clos->solution_cache_count; i++) {
+    SolutionCacheEntry *entry = &clos->solution_cache[i];
+    if (entry->key == key && entry->num_demands == num_demands) {
+      entry->last_used = ++clos->solution_cache_tick;
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Reserves a slot for key (evicting the least recently used entry if full)
+static SolutionCacheEntry *solution_cache_slot(clos_ctx *clos, uint64_t key, int num_demands) {
+  if (clos->solution_cache_cap <= 0) return NULL;
+  if (!clos->solution_cache) {
+    clos->solution_cache = calloc((size_t)clos->solution_cache_cap, sizeof(SolutionCacheEntry));
+    if (!clos->solution_cache) return NULL;
+  }
+
+  SolutionCacheEntry *entry = NULL;
+  for (int i = 0; i < clos->solution_cache_count; i++) {
+    if (clos->solution_cache[i].key == key) {
+      entry = &clos->solution_cache[i];
+      break;
+    }
+  }
+  if (!entry && clos->solution_cache_count < clos->solution_cache_cap) {
+    entry = &clos->solution_cache[clos->solution_cache_count++];
+  }
+  if (!entry) {
+    entry = &clos->solution_cache[0];
+    for (int i = 1; i < clos->solution_cache_count; i++) {
+      if (clos->solution_cache[i].last_used < entry->last_used) entry = &clos->solution_cache[i];
+    }
+  }
+
+  if (entry->num_demands != num_demands || !entry->spines) {
+    int *spines = realloc(entry->spines, sizeof(int) * (size_t)(num_demands > 0 ? num_demands : 1));
+    if (!spines) return NULL;
+    entry->spines = spines;
+  }
+  entry->key = key;
+  entry->num_demands = num_demands;
+  entry->last_used = ++clos->solution_cache_tick;
+  return entry;
+}
+
+static void solution_cache_store(clos_ctx *clos, uint64_t key, const Demand *demands, int num_demands, int **s2) {
+  SolutionCacheEntry *entry = solution_cache_slot(clos, key, num_demands);
+  if (!entry) return;
+  for (int i = 0; i < num_demands; i++) {
+    entry->spines[i] = find_spine_for_input_egress(clos, demands[i].input_id, demands[i].egress_block, s2);
+  }
+  entry->stability_cost = clos->last_stability_cost;
+  entry->reroute_cost = clos->last_reroute_cost;
+}
+
+// On a hit, builds and validates the cached solution. Returns false on a miss (or a stale entry).
+static bool solution_cache_lookup(clos_ctx *clos, uint64_t key, const Demand *demands, int num_demands,
+                                  FabricSolution *out_solution) {
+  if (clos->solution_cache_cap <= 0) return false;
+
+  SolutionCacheEntry *entry = solution_cache_find(clos, key, num_demands);
+  if (!entry) {
+    clos->solution_cache_misses++;
+    return false;
+  }
+
+  FabricSolution sol;
+  if (!build_solution_from_assignment(clos, demands, entry->spines, num_demands, &sol)) return false;
+  if (!validate_fabric_state(clos, sol.s1, sol.s2, sol.s3_owner, sol.s3_spine, false)) {
+    free_solution(&sol);
+    entry->key = 0;
+    entry->last_used = 0;
+    clos->solution_cache_misses++;
+    return false;
+  }
+
+  clos->solution_cache_hits++;
+  clos->last_stability_cost = entry->stability_cost;
+  clos->last_reroute_cost = entry->reroute_cost;
+  *out_solution = sol;
+  return true;
+}
+
+static bool save_solution_cache(clos_ctx *clos, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror("solution cache file");
+    return false;
+  }
+
+  int live = 0;
+  for (int i = 0; i < clos->solution_cache_count; i++) {
+    if (clos->solution_cache[i].last_used > 0) live++;
+  }
+
+  // Oldest first, so reloading replays recency order (ticks are unique; 0 marks an invalidated slot)
+  fprintf(f, "clos-solution-cache 1 %d %d\n", N, live);
+  unsigned long long floor_tick = 0;
+  for (int written = 0; written < live; written++) {
+    SolutionCacheEntry *next = NULL;
+    for (int i = 0; i < clos->solution_cache_count; i++) {
+      SolutionCacheEntry *entry = &clos->solution_cache[i];
+      if (entry->last_used <= floor_tick) continue;
+      if (!next || entry->last_used < next->last_used) next = entry;
+    }
+    if (!next) break;
+    floor_tick = next->last_used;
+
+    fprintf(f, "%016llx %d %d %d", (unsigned long long)next->key, next->stability_cost, next->reroute_cost,
+            next->num_demands);
+    for (int i = 0; i < next->num_demands; i++) fprintf(f, " %d", next->spines[i]);
+    fputc('\n', f);
+  }
+
+  fclose(f);
+  return true;
+}
+
+static bool load_solution_cache(clos_ctx *clos, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) return false;  // first run: nothing cached yet
+
+  int version = 0, size = 0, count = 0;
+  if (fscanf(f, "clos-solution-cache %d %d %d", &version, &size, &count) != 3 || version != 1 || size != N) {
+    fclose(f);
+    return false;
+  }
+
+  for (int c = 0; c < count; c++) {
+    unsigned long long key = 0;
+    int stability = 0, reroute = 0, num = 0;
+    if (fscanf(f, "%llx %d %d %d", &key, &stability, &reroute, &num) != 4) break;
+    if (num < 0 || num > clos->solver_scratch.max_demands) break;
+
+    SolutionCacheEntry *entry = solution_cache_slot(clos, (uint64_t)key, num);
+    if (!entry) break;
+    bool ok = true;
+    for (int i = 0; i < num && ok; i++) {
+      ok = fscanf(f, "%d", &entry->spines[i]) == 1 && entry->spines[i] >= 0 && entry->spines[i] < N;
+    }
+    if (!ok) {
+      entry->key = 0;
+      entry->last_used = 0;
+      break;
+    }
+    entry->stability_cost = stability;
+    entry->reroute_cost = reroute;
+  }
+
+  fclose(f);
+  return true;
+}
+
+// --- SCRATCH SEARCH HELPERS -------------------------------------------------
+// Points a fresh SolverCtx at the shared solver scratch (search state not reset)
+static void bind_scratch_ctx(clos_ctx *clos, SolverCtx *ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->clos = clos;
+  ctx->demands = clos->solver_scratch.demands;
+  ctx->tmp_s2 = clos->solver_scratch.tmp_s2;
+  ctx->tmp_s2_storage = clos->solver_scratch.tmp_s2_storage;
+  ctx->tmp_s1_owner = clos->solver_scratch.tmp_s1_owner;
+  ctx->tmp_s1_owner_storage = clos->solver_scratch.tmp_s1_owner_storage;
+  ctx->used_spines_mask = clos->solver_scratch.used_spines_mask;
+  ctx->spine_words = clos->solver_scratch.spine_words;
+  ctx->assignment = clos->solver_scratch.assignment;
+  ctx->best_assignment = clos->solver_scratch.best_assignment;
+  ctx->best_demands = clos->solver_scratch.best_demands;
+  ctx->prev_spine_for = clos->solver_scratch.prev_spine_for;
+  ctx->prev_spine_for_storage = clos->solver_scratch.prev_spine_for_storage;
+}
+
+// Loads demands (must not alias ctx->demands), clears the partial assignment and pins locked
+// demands. Returns false if two locked demands collide.
+static bool reset_search_ctx(SolverCtx *ctx, const Demand *subset, int count) {
+  clos_ctx *clos = ctx->clos;
+  memcpy(ctx->demands, subset, sizeof(Demand) * (size_t)count);
+  ctx->num_demands = count;
+  memset(ctx->tmp_s2_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+  memset(ctx->tmp_s1_owner_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+  memset(ctx->used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)ctx->spine_words);
+  ctx->stability_cost = 0;
+  ctx->best_stability_cost = 999999;
+  ctx->locked_count = partition_locked_demands(clos, ctx->demands, count);
+  return apply_locked_base(ctx);
+}
+
+// --- UNSAT CORE EXTRACTION --------------------------------------------------
+//
+// UNSAT DETAILS only reports per-block counts, which rarely name the routes that are in the way.
+// After a rejection we shrink the demand set to an irreducible conflicting subset by deletion:
+// drop one input's demands at a time, then single demands, keeping every deletion whose remainder
+// is still UNSAT. The rejected route's input is tried last, so the core keeps it and names the
+// existing routes that block it.
+//
+// Re-checks go cheapest first: block counts and matching_precheck() prove UNSAT, the greedy seed
+// proves SAT, and only then a node-capped backtrack runs: each check may spend four times the nodes
+// of the failed solve (at least UNSAT_CORE_NODE_LIMIT), all checks together UNSAT_CORE_NODE_BUDGET.
+// A capped check counts as SAT, so the core is always UNSAT but may not be minimal.
+
+#define UNSAT_CORE_NODE_LIMIT 20000
+#define UNSAT_CORE_NODE_BUDGET 5000000
+
+static int compare_demands(const void *a, const void *b) {
+  const Demand *da = a;
+  const Demand *db = b;
+  if (da->input_id != db->input_id) return da->input_id - db->input_id;
+  return da->egress_block - db->egress_block;
+}
+
+// Same counts as quick_capacity_check(), on a sorted demand subset
+static bool core_counts_exceeded(clos_ctx *clos, const Demand *subset, int count) {
+  int *egress_load = calloc((size_t)TOTAL_BLOCKS, sizeof(int));
+  int *ingress_load = calloc((size_t)TOTAL_BLOCKS, sizeof(int));
+  bool exceeded = false;
+  if (egress_load && ingress_load) {
+    for (int i = 0; i < count && !exceeded; i++) {
+      if (++egress_load[subset[i].egress_block] > N) exceeded = true;
+      if (i == 0 || subset[i - 1].input_id != subset[i].input_id) {
+        if (++ingress_load[subset[i].ingress_block] > N) exceeded = true;
+      }
+    }
+  }
+  free(egress_load);
+  free(ingress_load);
+  return exceeded;
+}
+
+static bool core_subset_unsat(clos_ctx *clos, const Demand *subset, int count, long long node_limit, long long *nodes) {
+  if (count == 0) return false;
+  if (core_counts_exceeded(clos, subset, count)) return true;
+  if (N <= 64) {
+    PrecheckFailure failure;
+    if (!matching_precheck(clos, subset, count, &failure)) return true;
+  }
+
+  // prev_spine_for is all -1 here, so the first assignment found has cost 0 and ends the search
+  SolverCtx ctx;
+  bind_scratch_ctx(clos, &ctx);
+
+  if (!reset_search_ctx(&ctx, subset, count)) return true;
+  if (greedy_seed(&ctx)) return false;
+
+  if (node_limit <= 0) return false;
+  (void)reset_search_ctx(&ctx, subset, count);
+  ctx.node_limit = node_limit;
+  gettimeofday(&ctx.last_report, NULL);
+  (void)backtrack(&ctx, ctx.locked_count);
+  *nodes += ctx.solve_attempts;
+  return ctx.best_stability_cost == 999999 && !ctx.node_limit_hit;
+}
+
+// Tries to delete core[from, to); keeps the deletion if the rest is still UNSAT
+static bool core_try_delete(clos_ctx *clos, Demand *core, int *core_count, Demand *trial, int from, int to,
+                            long long check_limit, int *checks, long long *nodes) {
+  int t = 0;
+  for (int k = 0; k < *core_count; k++) {
+    if (k < from || k >= to) trial[t++] = core[k];
+  }
+  (*checks)++;
+  long long node_limit = check_limit;
+  if (node_limit > UNSAT_CORE_NODE_BUDGET - *nodes) node_limit = UNSAT_CORE_NODE_BUDGET - *nodes;
+  if (!core_subset_unsat(clos, trial, t, node_limit, nodes)) return false;
+  memcpy(core, trial, sizeof(Demand) * (size_t)t);
+  *core_count = t;
+  return true;
+}
+
+// Every route and clear request starts here, so the core always describes the latest command
+static void clear_unsat_core(clos_ctx *clos) {
+  clos->unsat_core_count = 0;
+  clos->unsat_core_input = 0;
+}
+
+// Clobbers the solver scratch (demands, prev_spine_for, ...); only call after a failed solve
+static void extract_unsat_core(clos_ctx *clos, const Demand *demands, int num_demands, long long failed_solve_nodes) {
+  clos->unsat_core_count = 0;
+  clos->unsat_core_input = clos->core_focus_input;
+  if (num_demands <= 0) return;
+
+  Demand *core = malloc(sizeof(Demand) * (size_t)num_demands);
+  Demand *trial = malloc(sizeof(Demand) * (size_t)num_demands);
+  if (!core || !trial) {
+    free(core);
+    free(trial);
+    return;
+  }
+  memcpy(core, demands, sizeof(Demand) * (size_t)num_demands);
+  qsort(core, (size_t)num_demands, sizeof(Demand), compare_demands);
+  int core_count = num_demands;
+
+  for (int in_id = 0; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) clos->solver_scratch.prev_spine_for[in_id][e] = -1;
+  }
+
+  long long start_us = now_us();
+  long long nodes = 0;
+  int checks = 0;
+  long long check_limit = 4 * failed_solve_nodes > UNSAT_CORE_NODE_LIMIT ? 4 * failed_solve_nodes : UNSAT_CORE_NODE_LIMIT;
+
+  // Whole inputs first, then single demands; round 0 skips the rejected route's input, round 1 does it
+  for (int round = 0; round < 4; round++) {
+    bool whole_inputs = round < 2;
+    bool focus_round = (round & 1) != 0;
+    for (int i = 0; i < core_count;) {
+      int end = i + 1;
+      while (whole_inputs && end < core_count && core[end].input_id == core[i].input_id) end++;
+      bool focus = core[i].input_id == clos->core_focus_input;
+      if (focus == focus_round && core_try_delete(clos, core, &core_count, trial, i, end, check_limit, &checks, &nodes)) {
+        continue;  // core[i] is now the next candidate
+      }
+      i = end;
+    }
+  }
+
+  UnsatCoreEntry *entries = realloc(clos->unsat_core, sizeof(UnsatCoreEntry) * (size_t)(core_count > 0 ? core_count : 1));
+  if (entries) {
+    clos->unsat_core = entries;
+    for (int i = 0; i < core_count; i++) {
+      clos->unsat_core[i] = (UnsatCoreEntry){ .input_id = core[i].input_id, .egress_block = core[i].egress_block };
+    }
+    clos->unsat_core_count = core_count;
+
+    fprintf(clos->out, "  UNSAT CORE: %d of %d demand(s) cannot coexist (%d checks, %lld nodes, %.3f ms%s)\n",
+           core_count, num_demands, checks, nodes, (now_us() - start_us) / 1000.0,
+           nodes >= UNSAT_CORE_NODE_BUDGET ? ", budget hit" : "");
+    for (int i = 0; i < core_count; i++) {
+      fprintf(clos->out, "    Input %3d -> Egress block %2d%s\n", core[i].input_id, core[i].egress_block + 1,
+             core[i].input_id == clos->core_focus_input ? " (rejected route)" : "");
+    }
+  }
+
+  free(core);
+  free(trial);
+}
+
+// rerouted < 0: the search was cut at the budget, so the actual requirement is unknown
+static void print_reroute_budget_failure(clos_ctx *clos, int rerouted) {
+  if (clos->strict_stability) {
+    if (rerouted >= 0) {
+      fprintf(clos->out, "  FAIL: Strict stability enabled - would require rerouting %d existing connections\n", rerouted);
+    } else {
+      fprintf(clos->out, "  FAIL: Strict stability enabled - no solution without rerouting existing connections\n");
+    }
+  } else if (rerouted >= 0) {
+    fprintf(clos->out, "  FAIL: Would require rerouting %d existing connections (--max-reroutes %d)\n", rerouted,
+            clos->max_reroutes);
+  } else {
+    fprintf(clos->out, "  FAIL: No solution within --max-reroutes %d\n", clos->max_reroutes);
+  }
+}
+
+static bool solve_and_build_solution(clos_ctx *clos, FabricSolution *out_solution, int *out_best_cost) {
+  int active_count = 0;
+  if (!clos->solver_scratch.initialized) return false;
+
+  int max_demands = clos->solver_scratch.max_demands;
+  int block_words = clos->solver_scratch.block_words;
+  int spine_words = clos->solver_scratch.spine_words;
+
+  Demand *demands = clos->solver_scratch.demands;
+  int *active_inputs = clos->solver_scratch.active_inputs;
+  uint64_t *need_blocks_mask = clos->solver_scratch.need_blocks_mask;
+
+  memset(need_blocks_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)block_words);
+
+  int num_demands = build_demands(clos, demands, max_demands, active_inputs, &active_count, need_blocks_mask, block_words);
+  if (num_demands < 0) {
+    return false;
+  }
+
+  compute_lock_counts(clos, need_blocks_mask, block_words);
+
+  if (!validate_locks_against_demands(clos, need_blocks_mask, block_words, true)) {
+    fprintf(clos->out, "  FAIL: Locked path conflict\n");
+    return false;
+  }
+
+  // Trivial: no routes
+  if (num_demands == 0) {
+    *out_solution = (FabricSolution){0};
+    out_solution->s1 = alloc_int_matrix(TOTAL_BLOCKS, N, &out_solution->s1_storage);
+    out_solution->s2 = alloc_int_matrix(N, TOTAL_BLOCKS, &out_solution->s2_storage);
+    out_solution->s3_owner = calloc((size_t)MAX_PORTS + 1, sizeof(int));
+    out_solution->s3_spine = calloc((size_t)MAX_PORTS + 1, sizeof(int));
+    if (!out_solution->s1 || !out_solution->s2 || !out_solution->s3_owner || !out_solution->s3_spine) {
+      free_int_matrix(out_solution->s1, out_solution->s1_storage);
+      free_int_matrix(out_solution->s2, out_solution->s2_storage);
+      free(out_solution->s3_owner);
+      free(out_solution->s3_spine);
+      return false;
+    }
+    for (int p = 1; p <= MAX_PORTS; p++) out_solution->s3_spine[p] = -1;
+    *out_best_cost = 0;
+    clos->last_stability_cost = 0;
+    clos->last_reroute_cost = 0;
+    clos->last_solve_nodes = 0;
+    clos->last_branch_nodes = 0;
+    return true;
+  }
+
+  if (!quick_capacity_check(clos, need_blocks_mask, block_words)) {
+    fprintf(clos->out, "  FAIL: No solution exists under Clos trunk capacity constraints\n");
+    print_unsat_reason(clos, need_blocks_mask, block_words);
+    extract_unsat_core(clos, demands, num_demands, 0);
+    return false;
+  }
+
+  SolverCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.clos = clos;
+
+  ctx.demands = demands;
+  ctx.num_demands = num_demands;
+  ctx.tmp_s2 = clos->solver_scratch.tmp_s2;
+  ctx.tmp_s2_storage = clos->solver_scratch.tmp_s2_storage;
+  ctx.tmp_s1_owner = clos->solver_scratch.tmp_s1_owner;
+  ctx.tmp_s1_owner_storage = clos->solver_scratch.tmp_s1_owner_storage;
+  ctx.used_spines_mask = clos->solver_scratch.used_spines_mask;
+  ctx.spine_words = spine_words;
+  ctx.assignment = clos->solver_scratch.assignment;
+  ctx.best_assignment = clos->solver_scratch.best_assignment;
+  ctx.best_demands = clos->solver_scratch.best_demands;
+  ctx.prev_spine_for = clos->solver_scratch.prev_spine_for;
+  ctx.prev_spine_for_storage = clos->solver_scratch.prev_spine_for_storage;
+
+  memset(ctx.tmp_s2_storage, 0, sizeof(int) * (size_t)N * (size_t)TOTAL_BLOCKS);
+  memset(ctx.tmp_s1_owner_storage, 0, sizeof(int) * (size_t)TOTAL_BLOCKS * (size_t)N);
+  memset(ctx.used_spines_mask, 0, sizeof(uint64_t) * ((size_t)MAX_PORTS + 1) * (size_t)spine_words);
+  memset(ctx.assignment, 0, sizeof(int) * (size_t)max_demands);
+  memset(ctx.best_assignment, 0, sizeof(int) * (size_t)max_demands);
+
+  // Initialize stability tracking (branch cost optimization removed - see WOL-598)
+  ctx.stability_cost = 0;
+  ctx.best_stability_cost = 999999;
+
+  // Build prev_spine_for map from previous state
+  for (int in_id = 0; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      ctx.prev_spine_for[in_id][e] = -1;
+    }
+  }
+
+  if (clos->output_weighted && clos->have_previous_state) {
+    ctx.reroute_weight = clos->solver_scratch.reroute_weight;
+    memset(clos->solver_scratch.reroute_weight_storage, 0, sizeof(int) * ((size_t)MAX_PORTS + 1) * (size_t)TOTAL_BLOCKS);
+  }
+
+  if (clos->have_previous_state) {
+    // For each output port that had a spine assignment AND is still desired
+    for (int p = 1; p <= MAX_PORTS; p++) {
+      int in_id = clos->desired_owner[p];
+      int prev_spine = clos->prev_s3_port_spine[p];
+      if (in_id > 0 && prev_spine >= 0) {
+        int e = get_block(clos, p);
+        ctx.prev_spine_for[in_id][e] = prev_spine;
+        if (ctx.reroute_weight) ctx.reroute_weight[in_id][e]++;
+      }
+    }
+  }
+
+  // Same solver input as a recent solve: reuse its assignment without searching
+  uint64_t cache_key = solution_cache_key(clos, demands, num_demands, ctx.prev_spine_for, ctx.reroute_weight);
+  if (solution_cache_lookup(clos, cache_key, demands, num_demands, out_solution)) {
+    if (!within_reroute_budget(clos, clos->last_reroute_cost)) {
+      free_solution(out_solution);
+      print_reroute_budget_failure(clos, clos->last_stability_cost);
+      return false;
+    }
+    fprintf(clos->out, "  CACHE HIT: reused assignment for %d demands\n", num_demands);
+    clos->last_solve_nodes = 0;
+    clos->last_branch_nodes = 0;
+    *out_best_cost = 0;
+    return true;
+  }
+
+  // Locked demands are pinned up front and never branched on
+  memcpy(clos->solver_scratch.demands_backup, demands, sizeof(Demand) * (size_t)num_demands);
+  ctx.locked_count = partition_locked_demands(clos, demands, num_demands);
+  if (!apply_locked_base(&ctx)) {
+    fprintf(clos->out, "  FAIL: Locked path conflict\n");
+    return false;
+  }
+
+  // A reroute budget starts the search with an incumbent of budget + 1, so every branch that
+  // would exceed it is cut on entry. Locked reroutes are fixed and come off the top.
+  int budget = reroute_budget(clos);
+  if (budget >= 0 && ctx.locked_cost > budget) {
+    print_reroute_budget_failure(clos, -1);
+    return false;
+  }
+  int bound = budget < 0 ? 999999 : budget - ctx.locked_cost + 1;
+
+  // Greedy seed to tighten initial bound (may reorder demands)
+  bool greedy_ok = greedy_seed(&ctx);
+  if (greedy_ok && ctx.best_stability_cost >= bound) {
+    ctx.best_stability_cost = bound;  // over budget: not an incumbent
+  }
+  if (!greedy_ok) {
+    memcpy(demands, clos->solver_scratch.demands_backup, sizeof(Demand) * (size_t)num_demands);
+    (void)partition_locked_demands(clos, demands, num_demands);
+    ctx.best_stability_cost = bound;
+
+    // About to search without an incumbent: rule out polynomially-provable UNSAT first
+    PrecheckFailure failure;
+    if (!matching_precheck(clos, clos->solver_scratch.demands_backup, num_demands, &failure)) {
+      fprintf(clos->out, "  FAIL: No solution exists under Clos trunk constraints (matching pre-check)\n");
+      print_precheck_failure(clos, &failure);
+      extract_unsat_core(clos, demands, num_demands, 0);
+      return false;
+    }
+
+    // Dense fabric: local search for any conflict-free assignment to start the exact search from
+    int moves = 0;
+    int left = min_conflicts_search(&ctx, &moves);
+    if (left == 0) {
+      int cost = 0;
+      for (int i = ctx.locked_count; i < num_demands; i++) {
+        int prev_spine = ctx.prev_spine_for[demands[i].input_id][demands[i].egress_block];
+        if (prev_spine >= 0 && ctx.assignment[i] != prev_spine) {
+          cost += reroute_cost(&ctx, demands[i].input_id, demands[i].egress_block);
+        }
+      }
+      fprintf(clos->out, "  LOCAL SEARCH: conflict-free after %d move(s), cost %d\n", moves, cost);
+      if (cost < ctx.best_stability_cost) {
+        ctx.best_stability_cost = cost;
+        record_best(&ctx);
+      }
+    } else if (left > 0) {
+      fprintf(clos->out, "  LOCAL SEARCH: %d clash(es) left after %d move(s)\n", left, moves);
+    }
+  }
+
+  // Greedy left reroutes on the table: search the contested kernel for a tighter incumbent
+  long long kernel_nodes = 0;
+  if (clos->have_previous_state && ctx.best_stability_cost != 0) {
+    solve_conflict_kernel(&ctx);
+    kernel_nodes = ctx.solve_attempts;
+  }
+
+  // Prove (or find) the stability optimum by deepening the reroute limit up to the incumbent
+  ctx.solve_attempts = 0;
+  if (ctx.best_stability_cost != 0) {
+    memset(ctx.assignment, 0, sizeof(int) * (size_t)max_demands);
+    if (clos->lns_budget_ms > 0 && ctx.best_stability_cost < bound) {
+      lns_reroute_search(&ctx);
+    } else if (clos->search_engine == CLOS_SEARCH_LDS) {
+      lds_reroute_search(&ctx);
+    } else if (clos->search_engine == CLOS_SEARCH_SAT) {
+      sat_reroute_search(&ctx);
+    } else {
+      deepen_reroute_search(&ctx);
+    }
+  }
+  ctx.solve_attempts += kernel_nodes;
+
+  if (bound != 999999 && ctx.best_stability_cost == bound) {
+    print_reroute_budget_failure(clos, -1);
+    clos->last_solve_nodes = ctx.solve_attempts;
+    clos->total_solve_nodes += ctx.solve_attempts;
+    return false;
+  }
+
+  if (ctx.best_stability_cost == 999999) {
+    fprintf(clos->out, "  FAIL: No solution found (unexpected after capacity check)\n");
+    print_unsat_reason(clos, need_blocks_mask, block_words);
+    extract_unsat_core(clos, demands, num_demands, ctx.solve_attempts);
+    return false;
+  }
+
+  clos->last_solve_nodes = ctx.solve_attempts;
+  clos->total_solve_nodes += ctx.solve_attempts;
+
+  clos->last_branch_nodes = 0;
+  if (clos->min_branches_mode) {
+    run_branch_phase(&ctx, active_inputs, active_count);
+  }
+
+  // Store stability cost for JSON output (demand count, whatever the weighting); counted after the
+  // branch phase, which may spend --defrag reroutes beyond the optimum
+  clos->last_reroute_cost = ctx.locked_cost;
+  clos->last_stability_cost = 0;
+  for (int i = 0; i < num_demands; i++) {
+    const Demand *d = &ctx.best_demands[i];
+    int prev_spine = ctx.prev_spine_for[d->input_id][d->egress_block];
+    if (prev_spine < 0 || ctx.best_assignment[i] == prev_spine) continue;
+    clos->last_stability_cost++;
+    if (i >= ctx.locked_count) clos->last_reroute_cost += reroute_cost(&ctx, d->input_id, d->egress_block);
+  }
+
+  // Rebuild solution from best_assignment (clean rebuild avoids any subtle solver-state coupling)
+  FabricSolution sol;
+  if (!build_solution_from_assignment(clos, ctx.best_demands, ctx.best_assignment, num_demands, &sol)) return false;
+
+  solution_cache_store(clos, cache_key, clos->solver_scratch.demands_backup, num_demands, sol.s2);
+  if (clos->learn_mode) learn_from_solution(&ctx);
+
+  *out_solution = sol;
+  *out_best_cost = clos->min_branches_mode ? ctx.best_branch_cost : 0;  // only optimized in the branch phase (WOL-598)
+  return true;
+}
+
+// Commits a newly built solution into the global fabric arrays
+// Moves the fabric's Stage2 trunks (and the Stage1 trunks behind them) to match s2.
+// Two passes: every changed trunk is released before any is claimed.
+static void commit_trunks(clos_ctx *clos, int **s2) {
+  for (int sp = 0; sp < N; sp++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (clos->s2_to_s3[sp][e] != 0 && clos->s2_to_s3[sp][e] != s2[sp][e]) fabric_release_trunk(clos, sp, e);
+    }
+  }
+  for (int sp = 0; sp < N; sp++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (s2[sp][e] != 0 && clos->s2_to_s3[sp][e] != s2[sp][e]) fabric_claim_trunk(clos, sp, e, s2[sp][e]);
+    }
+  }
+}
+
+static void commit_solution(clos_ctx *clos, const FabricSolution *sol) {
+  commit_trunks(clos, sol->s2);
+  // Port 0 is unused but part of the JSON arrays, so it is copied like the rest
+  for (int p = 0; p <= MAX_PORTS; p++) {
+    if (clos->s3_port_owner[p] != sol->s3_owner[p] || clos->s3_port_spine[p] != sol->s3_spine[p]) {
+      fabric_set_port(clos, p, sol->s3_owner[p], sol->s3_spine[p]);
+    }
+  }
+}
+
+static bool repack_fabric_and_commit(clos_ctx *clos) {
+  // Track initial route count (first time only, before any changes)
+  if (!clos->tracked_initial && clos->have_previous_state) {
+    for (int p = 1; p <= MAX_PORTS; p++) {
+      if (clos->prev_s3_port_spine[p] >= 0) clos->initial_route_count++;
+    }
+    clos->tracked_initial = true;
+  }
+
+  // Count routes before this solve (for per-solve logging)
+  int routes_before = 0;
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    if (clos->prev_s3_port_spine[p] >= 0) routes_before++;
+  }
+
+  FabricSolution sol;
+  int best_cost = 0;
+
+  long long solve_start_us = now_us();
+  if (!solve_and_build_solution(clos, &sol, &best_cost)) return false;
+  long long solve_us = now_us() - solve_start_us;
+  clos->last_solve_us = solve_us;
+  clos->total_solve_us += solve_us;
+  clos->repack_count++;
+  clos->last_repair_us = 0;
+  clos->last_repair_nodes = 0;
+  double solve_ms = solve_us / 1000.0;
+  double total_ms = clos->total_solve_us / 1000.0;
+
+  commit_solution(clos, &sol);
+  free_solution(&sol);
+
+  // Sanity check (also verifies fabric matches desired state exactly)
+  if (!validate_fabric(clos, true)) {
+    fprintf(clos->out, "  FATAL: Fabric validation failed after repack\n");
+    return false;
+  }
+
+  // Report success (compute branches from committed state for info)
+  FabricStats stats = compute_fabric_stats(clos);
+  if (clos->have_previous_state) {
+    clos->last_rerouted_outputs = 0;
+    for (int p = 1; p <= MAX_PORTS; p++) {
+      int prev_spine = clos->prev_s3_port_spine[p];
+      int spine = clos->s3_port_spine[p];
+      if (prev_spine >= 0 && spine >= 0 && spine != prev_spine) {
+        clos->last_rerouted_outputs++;
+      }
+    }
+    clos->cumulative_output_reroutes += clos->last_rerouted_outputs;
+  } else {
+    clos->last_rerouted_outputs = 0;
+  }
+
+  fprintf(clos->out, "  REPACK OK: total branches = %d (solve %.3f ms, total %.3f ms)\n",
+         stats.total_branches, solve_ms, total_ms);
+  fprintf(clos->out, "  STATS: reroutes demands=%d outputs=%d | locks demands=%d outputs=%d\n",
+         clos->last_stability_cost, clos->last_rerouted_outputs, clos->last_locked_demands, clos->last_locked_outputs);
+
+  // Per-solve stability logging (only when routes change)
+  if (clos->last_stability_cost > 0 && routes_before > 0) {
+    fprintf(clos->out, "  Stability: rerouted %d of %d existing routes\n",
+           clos->last_stability_cost, routes_before);
+  }
+
+  // Update cumulative reroutes
+  clos->cumulative_reroutes += clos->last_stability_cost;
+
+  return true;
+}
+
+static void compute_lock_counts_from_demands(clos_ctx *clos) {
+  clos->last_locked_demands = 0;
+  clos->last_locked_outputs = 0;
+  if (!clos->have_locks) return;
+
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      if (clos->demand_count[in_id][e] > 0 && clos->lock_spine_for[in_id][e] >= 0) {
+        clos->last_locked_demands++;
+      }
+    }
+  }
+
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    int owner = clos->desired_owner[p];
+    if (owner <= 0) continue;
+    int e = get_block(clos, p);
+    if (clos->lock_spine_for[owner][e] >= 0) {
+      clos->last_locked_outputs++;
+    }
+  }
+}
+
+static bool try_incremental_repair(clos_ctx *clos, Demand *added, int added_count, const Demand *removed, int removed_count,
+                                   const PortEdit *edits, int edit_count) {
+  clos->repair_attempts++;
+  long long start_us = now_us();
+  long long repair_nodes = 0;
+
+  // If locks exist, ensure current assignments satisfy them for existing demands
+  for (int i = 0; i < clos->lock_list_count; i++) {
+    const LockEntry *lock = &clos->lock_list[i];
+    int current = clos->current_spine_for[lock->input_id][lock->egress_block];
+    if (clos->demand_count[lock->input_id][lock->egress_block] > 0 && current >= 0 && current != lock->spine) {
+      clos->repair_failures++;
+      return false;
+    }
+  }
+
+  // The search runs on the repair base; no previous map, since existing trunks never move
+  SolverCtx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.clos = clos;
+  ctx.demands = added;
+  ctx.num_demands = added_count;
+  ctx.locked_count = partition_locked_demands(clos, ctx.demands, added_count);
+  ctx.tmp_s2 = clos->repair_s2;
+  ctx.tmp_s2_storage = clos->repair_s2_storage;
+  ctx.tmp_s1_owner = clos->repair_s1_owner;
+  ctx.tmp_s1_owner_storage = clos->repair_s1_owner_storage;
+  ctx.used_spines_mask = clos->repair_spines_mask;
+  ctx.spine_words = clos->repair_spine_words;
+  ctx.assignment = clos->solver_scratch.assignment;
+  ctx.best_assignment = clos->solver_scratch.best_assignment;
+  ctx.best_demands = clos->solver_scratch.best_demands;
+  ctx.prev_spine_for = clos->solver_scratch.unset_spine_for;
+  ctx.prev_spine_for_storage = clos->solver_scratch.unset_spine_for_storage;
+
+  memset(ctx.assignment, 0, sizeof(int) * (size_t)added_count);
+  memset(ctx.best_assignment, 0, sizeof(int) * (size_t)added_count);
+
+  if (!init_incremental_base(&ctx, removed, removed_count) || !apply_locked_base(&ctx)) {
+    clos->repair_failures++;
+    return false;
+  }
+
+  bool have_solution = true;
+  if (added_count > 0) {
+    ctx.stability_cost = 0;
+    ctx.best_stability_cost = 999999;
+    bool greedy_ok = greedy_seed(&ctx);
+
+    if (!(greedy_ok && ctx.best_stability_cost == 0)) {
+      if (!init_incremental_base(&ctx, removed, removed_count) || !apply_locked_base(&ctx)) {
+        clos->repair_failures++;
+        return false;
+      }
+
+      ctx.stability_cost = 0;
+      ctx.best_stability_cost = 999999;
+      ctx.solve_attempts = 0;
+      ctx.last_report_attempts = 0;
+      gettimeofday(&ctx.last_report, NULL);
+
+      (void)backtrack(&ctx, ctx.locked_count);
+      repair_nodes = ctx.solve_attempts;
+
+      if (ctx.best_stability_cost == 999999) {
+        clos->repair_failures++;
+        return false;
+      }
+
+      if (!init_incremental_base(&ctx, removed, removed_count) || !apply_locked_base(&ctx)) {
+        clos->repair_failures++;
+        return false;
+      }
+
+      for (int i = 0; i < added_count; i++) {
+        Demand d = ctx.best_demands[i];
+        int s = ctx.best_assignment[i];
+        ctx.tmp_s2[s][d.egress_block] = d.input_id;
+        ctx.tmp_s1_owner[d.ingress_block][s] = d.input_id;
+      }
+    }
+  }
+
+  if (!have_solution) {
+    clos->repair_failures++;
+    return false;
+  }
+
+  // Validate that all edited ports can be assigned
+  for (int i = 0; i < edit_count; i++) {
+    int p = edits[i].port;
+    int owner = clos->desired_owner[p];
+    if (owner == 0) continue;
+    int e = get_block(clos, p);
+    if (find_spine_for_input_egress(clos, owner, e, ctx.tmp_s2) < 0) {
+      clos->repair_failures++;
+      return false;
+    }
+  }
+
+  // Commit Stage1/Stage2: free the removed demands' trunks, then claim the new ones
+  for (int i = 0; i < removed_count; i++) {
+    int e = removed[i].egress_block;
+    fabric_release_trunk(clos, clos->current_spine_for[removed[i].input_id][e], e);
+  }
+  for (int i = 0; i < added_count; i++) {
+    const Demand *d = &ctx.best_demands[i];
+    fabric_claim_trunk(clos, ctx.best_assignment[i], d->egress_block, d->input_id);
+  }
+
+  // Update Stage3 for edited ports only (every owner was checked to have a trunk above)
+  for (int i = 0; i < edit_count; i++) {
+    int p = edits[i].port;
+    int owner = clos->desired_owner[p];
+    fabric_set_port(clos, p, owner, owner == 0 ? -1 : clos->current_spine_for[owner][get_block(clos, p)]);
+  }
+
+  if (!validate_fabric(clos, true)) {
+    fprintf(clos->out, "  FATAL: Fabric validation failed after incremental repair\n");
+    clos->repair_failures++;
+    return false;
+  }
+
+  clos->last_stability_cost = 0;
+  clos->last_reroute_cost = 0;
+  clos->last_rerouted_outputs = 0;
+  clos->last_solve_us = 0;
+  clos->last_repair_us = now_us() - start_us;
+  clos->total_repair_us += clos->last_repair_us;
+  clos->repair_count++;
+  clos->last_repair_nodes = repair_nodes;
+  clos->total_repair_nodes += repair_nodes;
+
+  compute_lock_counts_from_demands(clos);
+
+  fprintf(clos->out, "  REPAIR OK: incremental solve %.3f ms (total %.3f ms)\n",
+         clos->last_repair_us / 1000.0, clos->total_repair_us / 1000.0);
+
+  return true;
+}
+
+// Leaves the repair base mirroring the (possibly updated) fabric whether or not the repair succeeds
+static bool incremental_repair(clos_ctx *clos, Demand *added, int added_count, const Demand *removed, int removed_count,
+                               const PortEdit *edits, int edit_count) {
+  if (!clos->incremental_mode) return false;
+
+  bool repaired = try_incremental_repair(clos, added, added_count, removed, removed_count, edits, edit_count);
+  restore_incremental_base(clos, added, added_count, removed, removed_count);
+  return repaired;
+}
+
+// --- ROUTE ALTERNATIVES -----------------------------------------------------
+//
+// A rejected route often has a close variant that fits. suggest_route_alternatives() tries:
+// - the same input, with each target owned by another input moved to a free port of its egress block
+// - each idle input of the same ingress block (re-patch the source there), with the same targets
+// Every candidate is checked against the current fabric (capacity counts, matching pre-check, greedy
+// seed, then a search capped at ALTERNATIVE_NODE_LIMIT nodes) and ranked by the demands it would
+// reroute. Under --strict-stability only candidates with no reroutes are offered.
+
+#define ALTERNATIVE_NODE_LIMIT 20000
+#define ALTERNATIVE_MAX 5
+
+static void clear_route_alternatives(clos_ctx *clos) {
+  for (int i = 0; i < clos->route_alternative_count; i++) free(clos->route_alternatives[i].targets);
+  clos->route_alternative_count = 0;
+}
+
+// Returns the demands the candidate would reroute on the current fabric, or -1 if it does not fit
+// (including when its demands break a lock, which apply_route_request would reject)
+static int evaluate_route_candidate(clos_ctx *clos, int input_id, const int *targets, int num_targets) {
+  int *saved = malloc(sizeof(int) * (size_t)num_targets);
+  if (!saved) return -1;
+  for (int i = 0; i < num_targets; i++) {
+    saved[i] = clos->desired_owner[targets[i]];
+    clos->desired_owner[targets[i]] = input_id;
+  }
+
+  int result = -1;
+  int active_count = 0;
+  SolverScratch *sc = &clos->solver_scratch;
+  Demand *candidate = sc->demands_backup;
+  int num_demands = build_demands(clos, candidate, sc->max_demands, sc->active_inputs, &active_count, sc->need_blocks_mask,
+                                  sc->block_words);
+  PrecheckFailure failure;
+  if (num_demands > 0 && validate_locks_against_demands(clos, sc->need_blocks_mask, sc->block_words, false) &&
+      quick_capacity_check(clos, sc->need_blocks_mask, sc->block_words) &&
+      matching_precheck(clos, candidate, num_demands, &failure)) {
+    SolverCtx ctx;
+    bind_scratch_ctx(clos, &ctx);
+    for (int in_id = 0; in_id <= MAX_PORTS; in_id++) {
+      for (int e = 0; e < TOTAL_BLOCKS; e++) ctx.prev_spine_for[in_id][e] = -1;
+    }
+    for (int p = 1; p <= MAX_PORTS; p++) {
+      int in_id = clos->desired_owner[p];
+      if (in_id > 0 && clos->s3_port_owner[p] == in_id && clos->s3_port_spine[p] >= 0) {
+        ctx.prev_spine_for[in_id][get_block(clos, p)] = clos->s3_port_spine[p];
+      }
+    }
+
+    if (reset_search_ctx(&ctx, candidate, num_demands)) {
+      int incumbent = greedy_seed(&ctx) ? ctx.best_stability_cost : 999999;
+      if (incumbent != 0) {
+        (void)reset_search_ctx(&ctx, candidate, num_demands);
+        ctx.best_stability_cost = incumbent;
+        ctx.node_limit = ALTERNATIVE_NODE_LIMIT;
+        gettimeofday(&ctx.last_report, NULL);
+        (void)backtrack(&ctx, ctx.locked_count);
+      }
+      if (ctx.best_stability_cost != 999999) result = ctx.locked_cost + ctx.best_stability_cost;
+    }
+  }
+
+  for (int i = num_targets - 1; i >= 0; i--) clos->desired_owner[targets[i]] = saved[i];
+  free(saved);
+  return result;
+}
+
+static void add_route_alternative(clos_ctx *clos, int input_id, const int *targets, int num_targets, int reroutes) {
+  // Keep the best ALTERNATIVE_MAX, sorted by reroutes; ties keep evaluation order
+  int pos = clos->route_alternative_count;
+  while (pos > 0 && clos->route_alternatives[pos - 1].reroutes > reroutes) pos--;
+  if (pos >= ALTERNATIVE_MAX) return;
+
+  int *copy = malloc(sizeof(int) * (size_t)num_targets);
+  if (!copy) return;
+  memcpy(copy, targets, sizeof(int) * (size_t)num_targets);
+
+  if (clos->route_alternative_count == ALTERNATIVE_MAX) {
+    free(clos->route_alternatives[ALTERNATIVE_MAX - 1].targets);
+    clos->route_alternative_count--;
+  }
+  memmove(&clos->route_alternatives[pos + 1], &clos->route_alternatives[pos],
+          sizeof(RouteAlternative) * (size_t)(clos->route_alternative_count - pos));
+  clos->route_alternatives[pos] = (RouteAlternative){
+    .input_id = input_id,
+    .targets = copy,
+    .num_targets = num_targets,
+    .reroutes = reroutes
+  };
+  clos->route_alternative_count++;
+}
+
+static void print_route_alternative(clos_ctx *clos, const RouteAlternative *alt) {
+  fprintf(clos->out, "    %d", alt->input_id);
+  for (int i = 0; i < alt->num_targets; i++) fprintf(clos->out, ".%d", alt->targets[i]);
+  fprintf(clos->out, " (reroutes %d)\n", alt->reroutes);
+}
+
+// Call with desired_owner rolled back and the fabric restored to it
+static void suggest_route_alternatives(clos_ctx *clos, int input_id, const int *targets, int num_targets) {
+  clear_route_alternatives(clos);
+  if (!clos->route_alternatives) {
+    clos->route_alternatives = calloc(ALTERNATIVE_MAX, sizeof(RouteAlternative));
+    if (!clos->route_alternatives) return;
+  }
+
+  int *moved = malloc(sizeof(int) * (size_t)num_targets);
+  int *others = malloc(sizeof(int) * (size_t)num_targets);
+  bool *taken = calloc((size_t)MAX_PORTS + 1, sizeof(bool));
+  if (!moved || !others || !taken) {
+    free(moved);
+    free(others);
+    free(taken);
+    return;
+  }
+
+  // Move targets owned by other inputs to free ports of the same egress block
+  bool any_moved = false;
+  bool movable = true;
+  for (int i = 0; i < num_targets; i++) taken[targets[i]] = true;
+  for (int i = 0; i < num_targets && movable; i++) {
+    int p = targets[i];
+    moved[i] = p;
+    if (clos->desired_owner[p] == 0 || clos->desired_owner[p] == input_id) continue;
+    int base = get_block(clos, p) * N + 1;
+    moved[i] = 0;
+    for (int q = base; q < base + N; q++) {
+      if (clos->desired_owner[q] == 0 && !taken[q]) {
+        moved[i] = q;
+        taken[q] = true;
+        any_moved = true;
+        break;
+      }
+    }
+    if (moved[i] == 0) movable = false;
+  }
+
+  int evaluated = 0;
+  int fit = 0;
+  if (movable) {
+    if (any_moved) {
+      int reroutes = evaluate_route_candidate(clos, input_id, moved, num_targets);
+      evaluated++;
+      if (reroutes >= 0 && within_reroute_budget(clos, reroutes)) {
+        add_route_alternative(clos, input_id, moved, num_targets, reroutes);
+        fit++;
+      }
+    }
+
+    // Ports input_id already drives stay with it; an idle sibling takes the rest. A sibling shares
+    // input_id's ingress trunks, so it can only fit where input_id's own lock on a target block got
+    // in the way; otherwise input_id could have taken any spine the sibling would.
+    int other_count = 0;
+    bool locked = false;
+    for (int i = 0; i < num_targets; i++) {
+      if (clos->desired_owner[moved[i]] == input_id) continue;
+      others[other_count++] = moved[i];
+      if (clos->have_locks && clos->lock_spine_for[input_id][get_block(clos, moved[i])] >= 0) locked = true;
+    }
+
+    int base = get_block(clos, input_id) * N + 1;
+    for (int j = base; j < base + N && other_count > 0 && locked; j++) {
+      if (j == input_id) continue;
+      bool idle = true;
+      for (int e = 0; e < TOTAL_BLOCKS && idle; e++) idle = clos->demand_count[j][e] == 0;
+      if (!idle) continue;
+
+      int reroutes = evaluate_route_candidate(clos, j, others, other_count);
+      evaluated++;
+      if (reroutes >= 0 && within_reroute_budget(clos, reroutes)) {
+        add_route_alternative(clos, j, others, other_count, reroutes);
+        fit++;
+      }
+    }
+  }
+
+  if (clos->route_alternative_count > 0) {
+    fprintf(clos->out, "  ALTERNATIVES: %d of %d candidate(s) fit, best by reroutes:\n", fit, evaluated);
+    for (int i = 0; i < clos->route_alternative_count; i++) print_route_alternative(clos, &clos->route_alternatives[i]);
+  } else if (evaluated > 0) {
+    fprintf(clos->out, "  ALTERNATIVES: none of %d candidate(s) fit\n", evaluated);
+  }
+
+  free(moved);
+  free(others);
+  free(taken);
+}
+
+// --- COMMAND APPLICATION (transactional) ------------------------------------
+//
+// We treat each request as an edit to desired_owner[].
+// Then we try to repack globally.
+// If repack fails, we rollback desired_owner[] for that request.
+//
+
+static bool apply_route_request(clos_ctx *clos, int input_id, const int *targets, int num_targets) {
+  clear_unsat_core(clos);
+  clear_route_alternatives(clos);
+  if (!is_valid_port(clos, input_id)) {
+    fprintf(clos->out, "  FAIL: input %d out of range\n", input_id);
+    return false;
+  }
+  if (num_targets <= 0) {
+    fprintf(clos->out, "  FAIL: input %d has no targets\n", input_id);
+    return false;
+  }
+
+  PortEdit *edits = malloc(sizeof(PortEdit) * (size_t)num_targets);
+  int edit_count = 0;
+  if (!edits) {
+    fprintf(clos->out, "  FAIL: out of memory\n");
+    return false;
+  }
+
+  // Validate and stage edits
+  for (int i = 0; i < num_targets; i++) {
+    int p = targets[i];
+    if (!is_valid_port(clos, p)) {
+      fprintf(clos->out, "  FAIL: target port %d out of range\n", p);
+      free(edits);
+      return false;
+    }
+
+    int prev = clos->desired_owner[p];
+    if (prev != 0 && prev != input_id) {
+      fprintf(clos->out, "  FAIL: output port %d already owned by input %d (clear first)\n", p, prev);
+      free(edits);
+      suggest_route_alternatives(clos, input_id, targets, num_targets);
+      return false;
+    }
+
+    // Record edit only if it changes state
+    if (prev != input_id) {
+      edits[edit_count++] = (PortEdit){ .port = p, .prev_owner = prev };
+    }
+  }
+
+  // Apply edits
+  Demand *added = clos->solver_scratch.demands;
+  Demand *removed = clos->solver_scratch.demands_backup;
+  int added_count = 0;
+  int removed_count = 0;
+  for (int i = 0; i < edit_count; i++) {
+    int p = edits[i].port;
+    int prev = edits[i].prev_owner;
+    int e = get_block(clos, p);
+
+    if (prev > 0) {
+      int *cnt = &clos->demand_count[prev][e];
+      if (*cnt > 0) {
+        (*cnt)--;
+        if (*cnt == 0) {
+          removed[removed_count++] = (Demand){ .input_id = prev, .ingress_block = get_block(clos, prev), .egress_block = e };
+        }
+      }
+    }
+
+    int *cnt = &clos->demand_count[input_id][e];
+    if (*cnt == 0) {
+      added[added_count++] = (Demand){ .input_id = input_id, .ingress_block = get_block(clos, input_id), .egress_block = e };
+    }
+    (*cnt)++;
+    clos->desired_owner[p] = input_id;
+    touch_port(clos, p);
+  }
+
+  // Repack
+  fprintf(clos->out, ">> ROUTE: Input %d to %d output(s)\n", input_id, num_targets);
+  if (clos->incremental_mode) {
+    if (incremental_repair(clos, added, added_count, removed, removed_count, edits, edit_count)) {
+      free(edits);
+      return true;
+    }
+    clos->last_repair_us = 0;
+    if (clos->strict_stability) {
+      fprintf(clos->out, "  FAIL: Strict stability enabled - incremental repair could not be realized without rerouting\n");
+      fprintf(clos->out, "  ROLLBACK: route could not be realized\n");
+      for (int i = 0; i < edit_count; i++) {
+        int p = edits[i].port;
+        int prev = edits[i].prev_owner;
+        int e = get_block(clos, p);
+        int cur = clos->desired_owner[p];
+        if (cur > 0) {
+          clos->demand_count[cur][e]--;
+        }
+        if (prev > 0) {
+          clos->demand_count[prev][e]++;
+        }
+        clos->desired_owner[p] = prev;
+        touch_port(clos, p);
+      }
+      free(edits);
+      suggest_route_alternatives(clos, input_id, targets, num_targets);
+      return false;
+    }
+  }
+
+  clos->core_focus_input = input_id;
+  bool repacked = repack_fabric_and_commit(clos);
+  clos->core_focus_input = 0;
+  if (repacked) {
+    clos->last_repair_us = 0;
+    free(edits);
+    return true;
+  }
+
+  // Rollback
+  fprintf(clos->out, "  ROLLBACK: route could not be realized\n");
+  for (int i = 0; i < edit_count; i++) {
+    int p = edits[i].port;
+    int prev = edits[i].prev_owner;
+    int e = get_block(clos, p);
+    int cur = clos->desired_owner[p];
+    if (cur > 0) {
+      clos->demand_count[cur][e]--;
+    }
+    if (prev > 0) {
+      clos->demand_count[prev][e]++;
+    }
+    clos->desired_owner[p] = prev;
+    touch_port(clos, p);
+  }
+  free(edits);
+
+  // Restore fabric to match desired_owner after rollback
+  // (If this fails, something is very wrong)
+  (void)repack_fabric_and_commit(clos);
+  suggest_route_alternatives(clos, input_id, targets, num_targets);
+  return false;
+}
+
+static bool apply_clear_request(clos_ctx *clos, int input_id) {
+  clear_unsat_core(clos);
+  clear_route_alternatives(clos);
+  if (!is_valid_port(clos, input_id)) {
+    fprintf(clos->out, "  FAIL: clear input %d out of range\n", input_id);
+    return false;
+  }
+
+  PortEdit *edits = malloc(sizeof(PortEdit) * ((size_t)MAX_PORTS + 1));
+  int edit_count = 0;
+  if (!edits) {
+    fprintf(clos->out, "  FAIL: out of memory\n");
+    return false;
+  }
+
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    if (clos->desired_owner[p] == input_id) {
+      edits[edit_count++] = (PortEdit){ .port = p, .prev_owner = input_id };
+    }
+  }
+
+  if (edit_count == 0) {
+    fprintf(clos->out, ">> CLEAR: Input %d (no-op, nothing connected)\n", input_id);
+    free(edits);
+    return true;
+  }
+
+  fprintf(clos->out, ">> CLEAR: Input %d (removing %d output(s))\n", input_id, edit_count);
+
+  Demand *added = clos->solver_scratch.demands;
+  Demand *removed = clos->solver_scratch.demands_backup;
+  int added_count = 0;
+  int removed_count = 0;
+
+  for (int i = 0; i < edit_count; i++) {
+    int p = edits[i].port;
+    int prev = edits[i].prev_owner;
+    int e = get_block(clos, p);
+
+    if (prev > 0) {
+      int *cnt = &clos->demand_count[prev][e];
+      if (*cnt > 0) {
+        (*cnt)--;
+        if (*cnt == 0) {
+          removed[removed_count++] = (Demand){ .input_id = prev, .ingress_block = get_block(clos, prev), .egress_block = e };
+        }
+      }
+    }
+    clos->desired_owner[p] = 0;
+    touch_port(clos, p);
+  }
+
+  // Clearing should only make things easier, but keep it transactional anyway
+  if (clos->incremental_mode) {
+    if (incremental_repair(clos, added, added_count, removed, removed_count, edits, edit_count)) {
+      free(edits);
+      return true;
+    }
+    clos->last_repair_us = 0;
+    if (clos->strict_stability) {
+      fprintf(clos->out, "  FAIL: Strict stability enabled - incremental repair could not be realized without rerouting\n");
+      fprintf(clos->out, "  ROLLBACK: unexpected failure after clear\n");
+      for (int i = 0; i < edit_count; i++) {
+        int p = edits[i].port;
+        int prev = edits[i].prev_owner;
+        int e = get_block(clos, p);
+        int cur = clos->desired_owner[p];
+        if (cur > 0) {
+          clos->demand_count[cur][e]--;
+        }
+        if (prev > 0) {
+          clos->demand_count[prev][e]++;
+        }
+        clos->desired_owner[p] = prev;
+        touch_port(clos, p);
+      }
+      free(edits);
+      return false;
+    }
+  }
+
+  if (repack_fabric_and_commit(clos)) {
+    clos->last_repair_us = 0;
+    free(edits);
+    return true;
+  }
+
+  fprintf(clos->out, "  ROLLBACK: unexpected failure after clear\n");
+  for (int i = 0; i < edit_count; i++) {
+    int p = edits[i].port;
+    int prev = edits[i].prev_owner;
+    int e = get_block(clos, p);
+    int cur = clos->desired_owner[p];
+    if (cur > 0) {
+      clos->demand_count[cur][e]--;
+    }
+    if (prev > 0) {
+      clos->demand_count[prev][e]++;
+    }
+    clos->desired_owner[p] = prev;
+    touch_port(clos, p);
+  }
+  free(edits);
+
+  (void)repack_fabric_and_commit(clos);
+  return false;
+}
+
+// --- PARSER -----------------------------------------------------------------
+static void process_command_string(clos_ctx *clos, char *line) {
+  line[strcspn(line, "\r\n")] = 0;
+
+  // Remove inline comments starting with '#'
+  char *hash = strchr(line, '#');
+  if (hash) *hash = '\0';
+
+  char *clean = trim_in_place(line);
+  if (*clean == '\0') return;
+
+  char *str = strdup(clean);
+  if (!str) return;
+
+  char *request_save = NULL;
+  char *request = strtok_r(str, ",", &request_save);
+  while (request != NULL) {
+    char *req = trim_in_place(request);
+    if (*req == '\0') { request = strtok_r(NULL, ",", &request_save); continue; }
+
+    // Clear command: !<input>
+    if (req[0] == '!') {
+      int input_id = atoi(&req[1]);
+      if (!apply_clear_request(clos, input_id)) clos->failed_commands++;
+      request = strtok_r(NULL, ",", &request_save);
+      continue;
+    }
+
+    // Route command: <input>.<out>.<out>...
+    char *sub = strdup(req);
+    if (!sub) { request = strtok_r(NULL, ",", &request_save); continue; }
+
+    int *targets = malloc(sizeof(int) * ((size_t)MAX_PORTS + 1));
+    int count = 0;
+    if (!targets) {
+      free(sub);
+      request = strtok_r(NULL, ",", &request_save);
+      continue;
+    }
+
+    char *tok_save = NULL;
+    char *tok = strtok_r(sub, ".", &tok_save);
+    if (!tok) {
+      free(targets);
+      free(sub);
+      request = strtok_r(NULL, ",", &request_save);
+      continue;
+    }
+
+    int input_id = atoi(tok);
+
+    while ((tok = strtok_r(NULL, ".", &tok_save)) != NULL) {
+      if (count >= MAX_PORTS) break;
+      targets[count++] = atoi(tok);
+    }
+
+    if (!apply_route_request(clos, input_id, targets, count)) clos->failed_commands++;
+
+    free(targets);
+    free(sub);
+    request = strtok_r(NULL, ",", &request_save);
+  }
+
+  free(str);
+}
+
+// --- PREFIX CACHE (--prefix-cache FILE) ---------------------------------------
+//
+// The viz server sends its whole command list on every edit, and every line is a solve. The state
+// after each command is remembered under a fingerprint of everything that led to it: the size,
+// the solver flags, the locks, the previous state and the command lines so far. A run restores
+// the state of its longest cached prefix and solves only the lines after it. When every command
+// of a run succeeds, its final state F is also stored under (previous state F, same commands).
+// Replaying commands against their own result reroutes nothing: each line's demands keep their
+// spines in F, so the state is F again. The server sends the last run's commands plus the edit,
+// so an edit costs the solves of its own commands. That entry is skipped under --incremental
+// (repair places new demands without looking at the previous state) and --defrag (reroutes on
+// purpose).
+
+struct PrefixCacheEntry {
+  uint64_t key;
+  int commands;             // command lines behind this state
+  bool clean;               // none of them was rejected
+  int reroutes;             // cumulative_reroutes / cumulative_output_reroutes at this point
+  int output_reroutes;
+  unsigned long long last_used;
+  int routed;               // connected ports
+  int *ports;               // (port, owner, spine) per connected port
+};
+
+// Everything besides the command lines that decides the states they lead to; prev is NULL
+// without a previous state
+static uint64_t prefix_context_key(clos_ctx *clos, const int *prev) {
+  uint64_t h = hash_mix(0x636c6f7370726566ULL, (uint64_t)N);
+  h = hash_mix(h, (uint64_t)(clos->strict_stability ? 1 : 0) | (uint64_t)(clos->output_weighted ? 2 : 0) |
+                  (uint64_t)(clos->min_branches_mode ? 4 : 0) | (uint64_t)(clos->incremental_mode ? 8 : 0) |
+                  (uint64_t)clos->search_engine << 8);
+  h = hash_mix(h, (uint64_t)(uint32_t)(clos->max_reroutes + 1) << 32 | (uint32_t)(clos->defrag_reroutes + 1));
+  h = hash_mix(h, (uint64_t)clos->branch_node_budget ^ (uint64_t)(uint32_t)clos->lns_budget_ms << 40);
+
+  for (int i = 0; clos->have_locks && i < clos->lock_list_count; i++) {
+    const LockEntry *lock = &clos->lock_list[i];
+    h = hash_mix(h, (uint64_t)(uint32_t)lock->input_id << 32 | (uint32_t)lock->egress_block << 12 | (uint32_t)lock->spine);
+  }
+  h = hash_mix(h, prev ? 1 : 0);
+  for (int p = 1; prev && p <= MAX_PORTS; p++) h = hash_mix(h, (uint64_t)(uint32_t)(prev[p] + 1));
+  return h;
+}
+
+// FNV-1a of the trimmed line, taken before the parser edits it in place
+static uint64_t prefix_line_hash(const char *line) {
+  uint64_t text = 0xcbf29ce484222325ULL;
+  const char *end = line + strlen(line);
+  while (line < end && isspace((unsigned char)*line)) line++;
+  while (end > line && isspace((unsigned char)end[-1])) end--;
+  for (const char *c = line; c < end; c++) text = (text ^ (unsigned char)*c) * 0x100000001b3ULL;
+  return text;
+}
+
+static PrefixCacheEntry *prefix_cache_find(clos_ctx *clos, uint64_t key) {
+  for (int i = 0; i < clos->prefix_cache_count; i++) {
+    PrefixCacheEntry *entry = &clos->prefix_cache[i];
+    if (entry->key == key && entry->last_used > 0) {
+      entry->last_used = ++clos->prefix_cache_tick;
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// Reserves a slot for key (evicting the least recently used entry if full)
+static PrefixCacheEntry *prefix_cache_slot(clos_ctx *clos, uint64_t key, int routed) {
+  if (clos->prefix_cache_cap <= 0) return NULL;
+  if (!clos->prefix_cache) {
+    clos->prefix_cache = calloc((size_t)clos->prefix_cache_cap, sizeof(PrefixCacheEntry));
+    if (!clos->prefix_cache) return NULL;
+  }
+
+  PrefixCacheEntry *entry = NULL;
+  for (int i = 0; i < clos->prefix_cache_count; i++) {
+    if (clos->prefix_cache[i].key == key) {
+      entry = &clos->prefix_cache[i];
+      break;
+    }
+  }
+  if (!entry && clos->prefix_cache_count < clos->prefix_cache_cap) {
+    entry = &clos->prefix_cache[clos->prefix_cache_count++];
+  }
+  if (!entry) {
+    entry = &clos->prefix_cache[0];
+    for (int i = 1; i < clos->prefix_cache_count; i++) {
+      if (clos->prefix_cache[i].last_used < entry->last_used) entry = &clos->prefix_cache[i];
+    }
+  }
+
+  if (entry->routed != routed || !entry->ports) {
+    int *ports = realloc(entry->ports, sizeof(int) * 3 * (size_t)(routed > 0 ? routed : 1));
+    if (!ports) return NULL;
+    entry->ports = ports;
+  }
+  entry->key = key;
+  entry->routed = routed;
+  entry->last_used = ++clos->prefix_cache_tick;
+  return entry;
+}
+
+// Remembers the current fabric as the state after `commands` lines
+static void prefix_cache_store(clos_ctx *clos, uint64_t key, int commands, bool clean, int reroutes, int output_reroutes) {
+  int routed = 0;
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    if (clos->s3_port_owner[p] > 0) routed++;
+  }
+  PrefixCacheEntry *entry = prefix_cache_slot(clos, key, routed);
+  if (!entry) return;
+
+  int at = 0;
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    if (clos->s3_port_owner[p] <= 0) continue;
+    entry->ports[at++] = p;
+    entry->ports[at++] = clos->s3_port_owner[p];
+    entry->ports[at++] = clos->s3_port_spine[p];
+  }
+  entry->commands = commands;
+  entry->clean = clean;
+  entry->reroutes = reroutes;
+  entry->output_reroutes = output_reroutes;
+}
+
+// Loads a cached state into the empty fabric; false (fabric untouched) if it does not validate
+static bool prefix_cache_restore(clos_ctx *clos, const PrefixCacheEntry *entry) {
+  FabricSolution sol;
+  memset(&sol, 0, sizeof(sol));
+  sol.s1 = alloc_int_matrix(TOTAL_BLOCKS, N, &sol.s1_storage);
+  sol.s2 = alloc_int_matrix(N, TOTAL_BLOCKS, &sol.s2_storage);
+  sol.s3_owner = calloc((size_t)MAX_PORTS + 1, sizeof(int));
+  sol.s3_spine = calloc((size_t)MAX_PORTS + 1, sizeof(int));
+  if (!sol.s1 || !sol.s2 || !sol.s3_owner || !sol.s3_spine) {
+    free_solution(&sol);
+    return false;
+  }
+  for (int p = 1; p <= MAX_PORTS; p++) sol.s3_spine[p] = -1;
+
+  for (int i = 0; i < entry->routed; i++) {
+    int p = entry->ports[3 * i];
+    int owner = entry->ports[3 * i + 1];
+    int spine = entry->ports[3 * i + 2];
+    sol.s2[spine][get_block(clos, p)] = owner;
+    sol.s1[get_block(clos, owner)][spine] = owner;
+    sol.s3_owner[p] = owner;
+    sol.s3_spine[p] = spine;
+    clos->desired_owner[p] = owner;
+  }
+
+  if (!validate_fabric_state(clos, sol.s1, sol.s2, sol.s3_owner, sol.s3_spine, false)) {
+    memset(clos->desired_owner, 0, sizeof(int) * ((size_t)MAX_PORTS + 1));
+    free_solution(&sol);
+    return false;
+  }
+
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    if (clos->desired_owner[p] > 0) clos->demand_count[clos->desired_owner[p]][get_block(clos, p)]++;
+  }
+  commit_solution(clos, &sol);
+  free_solution(&sol);
+  clos->cumulative_reroutes = entry->reroutes;
+  clos->cumulative_output_reroutes = entry->output_reroutes;
+  return true;
+}
+
+static void free_prefix_cache(clos_ctx *clos) {
+  for (int i = 0; i < clos->prefix_cache_count; i++) free(clos->prefix_cache[i].ports);
+  free(clos->prefix_cache);
+  clos->prefix_cache = NULL;
+  clos->prefix_cache_count = 0;
+  clos->prefix_cache_tick = 0;
+}
+
+static bool save_prefix_cache(clos_ctx *clos, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror("prefix cache file");
+    return false;
+  }
+
+  int live = 0;
+  for (int i = 0; i < clos->prefix_cache_count; i++) {
+    if (clos->prefix_cache[i].last_used > 0) live++;
+  }
+
+  // Oldest first, so reloading replays recency order (as in save_solution_cache)
+  fprintf(f, "clos-prefix-cache 1 %d %d\n", N, live);
+  unsigned long long floor_tick = 0;
+  for (int written = 0; written < live; written++) {
+    PrefixCacheEntry *next = NULL;
+    for (int i = 0; i < clos->prefix_cache_count; i++) {
+      PrefixCacheEntry *entry = &clos->prefix_cache[i];
+      if (entry->last_used <= floor_tick) continue;
+      if (!next || entry->last_used < next->last_used) next = entry;
+    }
+    if (!next) break;
+    floor_tick = next->last_used;
+
+    fprintf(f, "%016llx %d %d %d %d %d", (unsigned long long)next->key, next->commands, next->clean ? 1 : 0,
+            next->reroutes, next->output_reroutes, next->routed);
+    for (int i = 0; i < 3 * next->routed; i++) fprintf(f, " %d", next->ports[i]);
+    fputc('\n', f);
+  }
+
+  fclose(f);
+  return true;
+}
+
+static bool load_prefix_cache(clos_ctx *clos, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) return false;  // first run: nothing cached yet
+
+  int version = 0, size = 0, count = 0;
+  if (fscanf(f, "clos-prefix-cache %d %d %d", &version, &size, &count) != 3 || version != 1 || size != N) {
+    fclose(f);
+    return false;
+  }
+
+  for (int c = 0; c < count; c++) {
+    unsigned long long key = 0;
+    int commands = 0, clean = 0, reroutes = 0, output_reroutes = 0, routed = 0;
+    if (fscanf(f, "%llx %d %d %d %d %d", &key, &commands, &clean, &reroutes, &output_reroutes, &routed) != 6) break;
+    if (routed < 0 || routed > MAX_PORTS) break;
+
+    PrefixCacheEntry *entry = prefix_cache_slot(clos, (uint64_t)key, routed);
+    if (!entry) break;
+    bool ok = true;
+    for (int i = 0; i < routed && ok; i++) {
+      int *t = &entry->ports[3 * i];
+      ok = fscanf(f, "%d %d %d", &t[0], &t[1], &t[2]) == 3 && is_valid_port(clos, t[0]) && is_valid_port(clos, t[1]) &&
+           t[2] >= 0 && t[2] < N;
+    }
+    if (!ok) {
+      entry->key = 0;
+      entry->last_used = 0;
+      break;
+    }
+    entry->commands = commands;
+    entry->clean = clean != 0;
+    entry->reroutes = reroutes;
+    entry->output_reroutes = output_reroutes;
+  }
+
+  fclose(f);
+  return true;
+}
+
+// Reads every line of a routes file; returns the line count, or -1 if it cannot be opened
+static int read_command_lines(const char *filename, char ***out_lines) {
+  *out_lines = NULL;
+  FILE *file = fopen(filename, "r");
+  if (!file) { perror("File error"); return -1; }
+
+  char **lines = NULL;
+  int count = 0;
+  int cap = 0;
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), file)) {
+    if (count == cap) {
+      int new_cap = cap ? cap * 2 : 64;
+      char **grown = realloc(lines, sizeof(char *) * (size_t)new_cap);
+      if (!grown) break;
+      lines = grown;
+      cap = new_cap;
+    }
+    lines[count] = strdup(line);
+    if (!lines[count]) break;
+    count++;
+  }
+  fclose(file);
+
+  *out_lines = lines;
+  return count;
+}
+
+static void free_command_lines(char **lines, int count) {
+  for (int i = 0; i < count; i++) free(lines[i]);
+  free(lines);
+}
+
+// --- SCENES (--scene FILE) --------------------------------------------------
+//
+// A scene is a stored configuration: desired_owner plus the s3_port_spine it was realized with,
+// as in any state JSON the router writes or the compact form the viz server saves. Recalling a
+// scene as a route file costs one solve per line. --scene applies the whole desired state at once
+// and solves it once against the live fabric (--previous-state). Routes the scene shares with the
+// live fabric keep their spines, and every other route tries its stored spine first, so the
+// greedy seed usually lands near the optimum before the search starts. Proving the optimum of a
+// whole-fabric transition can take minutes, so unless --lns-budget says otherwise the search is
+// the anytime LNS with SCENE_LNS_BUDGET_MS. The viz server runs this in the background for every
+// saved scene, so a recall only swaps in the precomputed state.
+
+#define SCENE_LNS_BUDGET_MS 250
+
+// Points output port p at in_id (0 = none), keeping demand_count in step
+static void scene_set_owner(clos_ctx *clos, int p, int in_id) {
+  int prev = clos->desired_owner[p];
+  if (prev == in_id) return;
+  int e = get_block(clos, p);
+  if (prev > 0) clos->demand_count[prev][e]--;
+  if (in_id > 0) clos->demand_count[in_id][e]++;
+  clos->desired_owner[p] = in_id;
+  touch_port(clos, p);
+}
+
+// Replaces the whole desired state, routed or not; false if the scene is unreadable or unroutable,
+// in which case the previous desired state is back in place
+static bool apply_scene(clos_ctx *clos, const char *path) {
+  char *buf = read_text_file(path, "scene file");
+  if (!buf) return false;
+
+  int *owners = malloc(sizeof(int) * ((size_t)MAX_PORTS + 1));
+  int *spines = malloc(sizeof(int) * ((size_t)MAX_PORTS + 1));
+  int *before = malloc(sizeof(int) * ((size_t)MAX_PORTS + 1));
+  if (!owners || !spines || !before) {
+    free(owners);
+    free(spines);
+    free(before);
+    free(buf);
+    return false;
+  }
+  int owner_count = parse_json_int_array(buf, "\"desired_owner\":", owners, MAX_PORTS + 1);
+  int spine_count = parse_json_int_array(buf, "\"s3_port_spine\":", spines, MAX_PORTS + 1);
+  free(buf);
+
+  bool ok = owner_count == MAX_PORTS + 1;
+  for (int p = 1; ok && p <= MAX_PORTS; p++) ok = owners[p] >= 0 && owners[p] <= MAX_PORTS;
+  if (!ok) {
+    fprintf(clos->out, ">> SCENE: %s is not a %d-port state\n", path, MAX_PORTS);
+    free(owners);
+    free(spines);
+    free(before);
+    return false;
+  }
+
+  for (int in_id = 0; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) clos->solver_scratch.plan_hint[in_id][e] = -1;
+  }
+  int routed = 0;
+  for (int p = 1; p <= MAX_PORTS; p++) {
+    int in_id = owners[p];
+    before[p] = clos->desired_owner[p];
+    scene_set_owner(clos, p, in_id);
+    if (in_id == 0) continue;
+    int e = get_block(clos, p);
+    if (spine_count == MAX_PORTS + 1 && spines[p] >= 0 && spines[p] < N) clos->solver_scratch.plan_hint[in_id][e] = spines[p];
+    routed++;
+  }
+  free(owners);
+  free(spines);
+
+  fprintf(clos->out, ">> SCENE: %s (%d output(s))\n", path, routed);
+  int saved_lns_budget = clos->lns_budget_ms;
+  if (clos->lns_budget_ms <= 0) clos->lns_budget_ms = SCENE_LNS_BUDGET_MS;
+  clos->placement_hints = true;
+  bool repacked = repack_fabric_and_commit(clos);
+  clos->placement_hints = clos->plan_mode;
+  clos->lns_budget_ms = saved_lns_budget;
+  if (!repacked) {
+    fprintf(clos->out, "  ROLLBACK: scene could not be realized\n");
+    for (int p = 1; p <= MAX_PORTS; p++) scene_set_owner(clos, p, before[p]);
+  }
+  free(before);
+  return repacked;
+}
+
+// --- PLANNING (--plan) -----------------------------------------------------
+//
+// Every line of a routes file is normally solved against the --previous-state snapshot, and a new
+// demand takes whatever spine is free at that moment, so a scripted session that shuffles inputs
+// pays for placements that a later line has to move again. --plan reads the whole file first and
+// treats it as one session. Each line is solved against the state the line before it committed,
+// as the UI does with one edit per process, and the cumulative reroutes are the cost of the whole
+// sequence. The file is first replayed silently, up to PLAN_PASSES times, recording the last spine
+// of every demand lifetime (from the line that adds the demand to the line that removes it). In
+// the next pass the k-th lifetime of a demand starts on the spine its k-th lifetime ended on last
+// time, when that spine is free, so it lands where the rest of the session was going to push it.
+// The hints of the cheapest pass drive the final, reported run.
+
+#define PLAN_PASSES 4
+
+typedef struct {
+  int *cell;   // input_id * TOTAL_BLOCKS + egress block, in order of birth
+  int *spine;  // last spine held during that lifetime
+  int count;
+  int cap;
+} PlanLifetimes;
+
+typedef struct {
+  PlanLifetimes pass;    // lifetimes of the pass being run
+  PlanLifetimes source;  // lifetimes the hints come from
+  int *source_first;     // cell -> first index into source_order (cells + 1 entries)
+  int *source_order;     // source lifetimes grouped by cell, in birth order
+  int *lives;            // cell -> lifetimes started in this pass
+  int *open;             // cell -> index into pass of its current lifetime, -1 if absent
+  size_t cells;
+} PlanState;
+
+static bool plan_lifetimes_push(PlanLifetimes *lt, int cell, int spine) {
+  if (lt->count == lt->cap) {
+    int new_cap = lt->cap ? lt->cap * 2 : 256;
+    int *cell_grown = realloc(lt->cell, sizeof(int) * (size_t)new_cap);
+    if (!cell_grown) return false;
+    lt->cell = cell_grown;
+    int *spine_grown = realloc(lt->spine, sizeof(int) * (size_t)new_cap);
+    if (!spine_grown) return false;
+    lt->spine = spine_grown;
+    lt->cap = new_cap;
+  }
+  lt->cell[lt->count] = cell;
+  lt->spine[lt->count] = spine;
+  lt->count++;
+  return true;
+}
+
+static bool plan_lifetimes_copy(PlanLifetimes *dst, const PlanLifetimes *src) {
+  dst->count = 0;
+  for (int i = 0; i < src->count; i++) {
+    if (!plan_lifetimes_push(dst, src->cell[i], src->spine[i])) return false;
+  }
+  return true;
+}
+
+static bool plan_lifetimes_equal(const PlanLifetimes *a, const PlanLifetimes *b) {
+  return a->count == b->count && (a->count == 0 || (memcmp(a->cell, b->cell, sizeof(int) * (size_t)a->count) == 0 &&
+                                                    memcmp(a->spine, b->spine, sizeof(int) * (size_t)a->count) == 0));
+}
+
+// Spine the k-th lifetime of cell ended on in the source pass, -1 if it had no such lifetime
+static int plan_source_spine(const PlanState *ps, size_t cell, int k) {
+  int at = ps->source_first[cell] + k;
+  return at < ps->source_first[cell + 1] ? ps->source.spine[ps->source_order[at]] : -1;
+}
+
+// Indexes the source lifetimes by cell (counting sort) and points every demand at its first one
+static void plan_begin_pass(clos_ctx *clos, PlanState *ps) {
+  memset(ps->source_first, 0, sizeof(int) * (ps->cells + 1));
+  for (int i = 0; i < ps->source.count; i++) ps->source_first[ps->source.cell[i] + 1]++;
+  for (size_t c = 0; c < ps->cells; c++) ps->source_first[c + 1] += ps->source_first[c];
+  memcpy(ps->lives, ps->source_first, sizeof(int) * ps->cells);  // fill cursor
+  for (int i = 0; i < ps->source.count; i++) ps->source_order[ps->lives[ps->source.cell[i]]++] = i;
+
+  memset(ps->lives, 0, sizeof(int) * ps->cells);
+  for (size_t c = 0; c < ps->cells; c++) {
+    ps->open[c] = -1;
+    clos->solver_scratch.plan_hint_storage[c] = plan_source_spine(ps, c, 0);
+  }
+  ps->pass.count = 0;
+}
+
+// After each line: extends the open lifetimes, opens and closes the others
+static void plan_record_spines(clos_ctx *clos, PlanState *ps) {
+  for (int in_id = 1; in_id <= MAX_PORTS; in_id++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) {
+      size_t c = (size_t)in_id * (size_t)TOTAL_BLOCKS + (size_t)e;
+      int spine = clos->current_spine_for[in_id][e];
+      if (spine < 0) {
+        ps->open[c] = -1;
+      } else if (ps->open[c] >= 0) {
+        ps->pass.spine[ps->open[c]] = spine;
+      } else if (plan_lifetimes_push(&ps->pass, (int)c, spine)) {
+        ps->open[c] = ps->pass.count - 1;
+        clos->solver_scratch.plan_hint[in_id][e] = plan_source_spine(ps, c, ++ps->lives[c]);
+      }
+    }
+  }
+}
+
+// The line just committed becomes the previous state of the next one
+static void plan_advance_previous_state(clos_ctx *clos) {
+  memcpy(clos->prev_s3_port_spine, clos->s3_port_spine, sizeof(int) * ((size_t)MAX_PORTS + 1));
+  clos->have_previous_state = true;
+  recount_fabric_stats(clos);
+}
+
+static void plan_run(clos_ctx *clos, PlanState *ps, char **lines, int count) {
+  plan_begin_pass(clos, ps);
+  for (int i = 0; i < count; i++) {
+    process_command_string(clos, lines[i]);
+    plan_advance_previous_state(clos);
+    plan_record_spines(clos, ps);
+  }
+}
+
+// Back to the state main() set up before the routes file: empty fabric, loaded previous state,
+// only the lock conflicts found while loading the locks (a pass's conflicts reject every later line)
+static void plan_reset_session(clos_ctx *clos, const int *start_prev, bool start_have_prev, int start_conflicts) {
+  for (int s = 0; s < N; s++) {
+    for (int e = 0; e < TOTAL_BLOCKS; e++) fabric_release_trunk(clos, s, e);
+  }
+  for (int p = 0; p <= MAX_PORTS; p++) {
+    if (clos->s3_port_owner[p] != 0 || clos->s3_port_spine[p] != -1) fabric_set_port(clos, p, 0, -1);
+  }
+  clear_touched(clos);
+  memset(clos->desired_owner, 0, sizeof(int) * ((size_t)MAX_PORTS + 1));
+  memset(clos->demand_count_storage, 0, sizeof(int) * ((size_t)MAX_PORTS + 1) * (size_t)TOTAL_BLOCKS);
+  memcpy(clos->prev_s3_port_spine, start_prev, sizeof(int) * ((size_t)MAX_PORTS + 1));
+  clos->have_previous_state = start_have_prev;
+  clos->lock_conflict_count = start_conflicts;
+  clear_unsat_core(clos);
+  clear_route_alternatives(clos);
+  recount_fabric_stats(clos);
+  reset_session_metrics(clos);
+}
+
+// A pass with the log discarded; returns its cumulative reroutes and sets *failed to its rejected lines
+static int plan_dry_run(clos_ctx *clos, PlanState *ps, char **lines, int count, int *failed) {
+  FILE *log = clos->out;
+  FILE *sink = fopen("/dev/null", "w");
+  if (sink) clos->out = sink;
+
+  plan_run(clos, ps, lines, count);
+
+  clos->out = log;
+  if (sink) fclose(sink);
+  *failed = clos->failed_commands;
+  return clos->cumulative_reroutes;
+}
+
+static void free_plan_state(PlanState *ps) {
+  free(ps->pass.cell);
+  free(ps->pass.spine);
+  free(ps->source.cell);
+  free(ps->source.spine);
+  free(ps->source_first);
+  free(ps->source_order);
+  free(ps->lives);
+  free(ps->open);
+}
+
+static bool plan_file(clos_ctx *clos, const char *filename) {
+  char **lines = NULL;
+  int count = read_command_lines(filename, &lines);
+  if (count < 0) return false;
+
+  // A line starts at most one lifetime per output it routes, which bounds every pass
+  int max_lifetimes = 1;
+  for (int i = 0; i < count; i++) {
+    for (const char *c = lines[i]; *c; c++) max_lifetimes += *c == '.';
+  }
+
+  PlanState ps = { .cells = ((size_t)MAX_PORTS + 1) * (size_t)TOTAL_BLOCKS };
+  PlanLifetimes best = {0};
+  int *start_prev = malloc(sizeof(int) * ((size_t)MAX_PORTS + 1));
+  ps.source_first = malloc(sizeof(int) * (ps.cells + 1));
+  ps.source_order = malloc(sizeof(int) * (size_t)max_lifetimes);
+  ps.lives = malloc(sizeof(int) * ps.cells);
+  ps.open = malloc(sizeof(int) * ps.cells);
+  if (!start_prev || !ps.source_first || !ps.source_order || !ps.lives || !ps.open) {
+    fprintf(clos->out, "PLAN: out of memory, solving line by line\n");
+    clos->plan_mode = clos->placement_hints = false;
+    for (int i = 0; i < count; i++) process_command_string(clos, lines[i]);
+  } else {
+    memcpy(start_prev, clos->prev_s3_port_spine, sizeof(int) * ((size_t)MAX_PORTS + 1));
+    bool start_have_prev = clos->have_previous_state;
+    int start_conflicts = clos->lock_conflict_count;
+
+    // Passes rank by rejected lines first, so one that fails a line is never preferred for its
+    // reroutes
+    int best_failed = INT_MAX;
+    int best_cost = INT_MAX;
+    int best_pass = 0;
+    int first_cost = 0;
+    int passes = 0;
+    while (passes < PLAN_PASSES) {
+      int failed = 0;
+      int cost = plan_dry_run(clos, &ps, lines, count, &failed);
+      plan_reset_session(clos, start_prev, start_have_prev, start_conflicts);
+      if (failed > 0) {
+        fprintf(clos->out, "PLAN PASS %d: %d reroute(s), %d rejected line(s)\n", ++passes, cost, failed);
+      } else {
+        fprintf(clos->out, "PLAN PASS %d: %d reroute(s)\n", ++passes, cost);
+      }
+      if (passes == 1) first_cost = cost;
+      bool better = failed < best_failed || (failed == best_failed && cost < best_cost);
+      if (better && plan_lifetimes_copy(&best, &ps.source)) {
+        best_failed = failed;
+        best_cost = cost;
+        best_pass = passes;
+      }
+      if ((cost == 0 && failed == 0) || plan_lifetimes_equal(&ps.pass, &ps.source)) break;  // clean, or the next pass repeats
+      if (!plan_lifetimes_copy(&ps.source, &ps.pass)) break;
+    }
+
+    (void)plan_lifetimes_copy(&ps.source, &best);
+    fprintf(clos->out, "PLAN: using pass %d of %d (%d reroute(s) across %d line(s), %d without lookahead)\n",
+           best_pass, passes, best_cost, count, first_cost);
+    plan_run(clos, &ps, lines, count);
+  }
+
+  free(start_prev);
+  free(best.cell);
+  free(best.spine);
+  free_plan_state(&ps);
+  free_command_lines(lines, count);
+  return true;
+}
+
+static bool process_file(clos_ctx *clos, const char *filename) {
+  if (clos->plan_mode) return plan_file(clos, filename);
+
+  char **lines = NULL;
+  int count = read_command_lines(filename, &lines);
+  if (count < 0) return false;
+
+  // keys[k]: fingerprint of the first k lines (PREFIX CACHE). The entries are states reached
+  // from an empty fabric, so a context that already holds routes (a scene, an earlier file or
+  // API command) solves every line.
+  bool empty = true;
+  for (int p = 1; empty && p <= MAX_PORTS; p++) empty = clos->desired_owner[p] == 0;
+  uint64_t *text = NULL;
+  uint64_t *keys = NULL;
+  int start = 0;
+  if (clos->prefix_cache_mode && clos->prefix_cache_cap > 0 && empty) {
+    text = malloc(sizeof(uint64_t) * (size_t)(count + 1));
+    keys = malloc(sizeof(uint64_t) * (size_t)(count + 1));
+  }
+  if (text && keys) {
+    keys[0] = prefix_context_key(clos, clos->have_previous_state ? clos->prev_s3_port_spine : NULL);
+    for (int i = 0; i < count; i++) {
+      text[i] = prefix_line_hash(lines[i]);
+      keys[i + 1] = hash_mix(keys[i], text[i]);
+    }
+    for (int k = count; k > 0; k--) {
+      PrefixCacheEntry *entry = prefix_cache_find(clos, keys[k]);
+      if (entry && prefix_cache_restore(clos, entry)) {
+        if (!entry->clean) clos->failed_commands++;
+        start = k;
+        fprintf(clos->out, "PREFIX CACHE: restored the state after %d of %d command(s)\n", k, count);
+        break;
+      }
+    }
+  } else {
+    free(text);
+    free(keys);
+    text = keys = NULL;
+  }
+
+  for (int i = start; i < count; i++) {
+    process_command_string(clos, lines[i]);
+    if (keys) {
+      prefix_cache_store(clos, keys[i + 1], i + 1, clos->failed_commands == 0, clos->cumulative_reroutes,
+                         clos->cumulative_output_reroutes);
+    }
+  }
+
+  // The same commands replayed against this result lead back to it
+  if (keys && count > 0 && clos->failed_commands == 0 && !clos->incremental_mode && clos->defrag_reroutes < 0) {
+    uint64_t key = prefix_context_key(clos, clos->s3_port_spine);
+    for (int i = 0; i < count; i++) key = hash_mix(key, text[i]);
+    prefix_cache_store(clos, key, count, true, 0, 0);
+  }
+
+  free(text);
+  free(keys);
+  free_command_lines(lines, count);
+  return true;
+}
+
+// --- LIBRARY API (libclos.h) ---------------------------------------------------
+
+void clos_options_init(clos_options *opts) {
+  *opts = (clos_options){0};
+  opts->size = 10;
+  opts->out = stdout;
+  opts->max_reroutes = -1;
+  opts->defrag_reroutes = -1;
+  opts->branch_budget = 20000;
+  opts->search = CLOS_SEARCH_DFS;
+  opts->solution_cache_size = 64;
+  opts->prefix_cache_size = 64;
+}
+
+clos_ctx *clos_create(const clos_options *opts) {
+  clos_options defaults;
+  if (!opts) {
+    clos_options_init(&defaults);
+    opts = &defaults;
+  }
+
+  clos_ctx *clos = calloc(1, sizeof(clos_ctx));
+  if (!clos) return NULL;
+
+  clos->out = opts->out ? opts->out : stdout;
+  clos->progress = opts->progress;
+  clos->progress_user = opts->progress_user;
+  clos->strict_stability = opts->strict_stability;
+  clos->max_reroutes = opts->max_reroutes;
+  clos->output_weighted = opts->output_weighted;
+  clos->min_branches_mode = opts->min_branches || opts->defrag_reroutes >= 0;
+  clos->defrag_reroutes = opts->defrag_reroutes;
+  clos->branch_node_budget = opts->branch_budget;
+  clos->search_engine = opts->search;
+  clos->lns_budget_ms = opts->lns_budget_ms;
+  clos->learn_mode = opts->learn;
+  clos->plan_mode = clos->placement_hints = opts->plan;
+  clos->incremental_mode = opts->incremental;
+#ifdef CLOS_PARANOID
+  clos->paranoid_mode = true;
+#else
+  clos->paranoid_mode = opts->paranoid;
+#endif
+  clos->solution_cache_cap = opts->solution_cache_size;
+  clos->prefix_cache_mode = opts->prefix_cache;
+  clos->prefix_cache_cap = opts->prefix_cache_size;
+
+  if (!init_fabric(clos, opts->size)) {
+    free(clos);
+    return NULL;
+  }
+  return clos;
+}
+
+void clos_free(clos_ctx *clos) {
+  if (!clos) return;
+  free_fabric(clos);
+  free(clos);
+}
+
+void clos_set_log(clos_ctx *clos, FILE *out) {
+  clos->out = out ? out : stdout;
+}
+
+bool clos_load_previous_state(clos_ctx *clos, const char *path) {
+  return load_previous_state(clos, path);
+}
+
+bool clos_load_previous_state_json(clos_ctx *clos, const char *json) {
+  return parse_previous_state(clos, json);
+}
+
+void clos_anchor_previous_state(clos_ctx *clos) {
+  plan_advance_previous_state(clos);
+}
+
+bool clos_load_locks(clos_ctx *clos, const char *path) {
+  return load_locks(clos, path);
+}
+
+bool clos_set_locks(clos_ctx *clos, const clos_lock *locks, int num_locks) {
+  return set_locks(clos, locks, num_locks);
+}
+
+bool clos_apply_route(clos_ctx *clos, int input_id, const int *outputs, int num_outputs) {
+  if (num_outputs > MAX_PORTS) num_outputs = MAX_PORTS;
+  bool ok = apply_route_request(clos, input_id, outputs, num_outputs);
+  if (!ok) clos->failed_commands++;
+  return ok;
+}
+
+bool clos_apply_clear(clos_ctx *clos, int input_id) {
+  bool ok = apply_clear_request(clos, input_id);
+  if (!ok) clos->failed_commands++;
+  return ok;
+}
+
+bool clos_apply_command(clos_ctx *clos, const char *line) {
+  char *copy = strdup(line);
+  if (!copy) return false;
+  int failed = clos->failed_commands;
+  process_command_string(clos, copy);
+  free(copy);
+  return clos->failed_commands == failed;
+}
+
+bool clos_apply_scene(clos_ctx *clos, const char *path) {
+  return apply_scene(clos, path);
+}
+
+bool clos_solve(clos_ctx *clos) {
+  return repack_fabric_and_commit(clos);
+}
+
+int clos_what_if_route(clos_ctx *clos, int input_id, const int *outputs, int num_outputs) {
+  if (!is_valid_port(clos, input_id) || num_outputs <= 0) return -1;
+  for (int i = 0; i < num_outputs; i++) {
+    if (!is_valid_port(clos, outputs[i])) return -1;
+    int owner = clos->desired_owner[outputs[i]];
+    if (owner != 0 && owner != input_id) return -1;  // the route would be rejected outright
+  }
+  return evaluate_route_candidate(clos, input_id, outputs, num_outputs);
+}
+
+bool clos_run_file(clos_ctx *clos, const char *path) {
+  return process_file(clos, path);
+}
+
+int clos_load_solution_cache(clos_ctx *clos, const char *path) {
+  return load_solution_cache(clos, path) ? clos->solution_cache_count : -1;
+}
+
+bool clos_save_solution_cache(clos_ctx *clos, const char *path) {
+  return clos->solution_cache_cap > 0 && save_solution_cache(clos, path);
+}
+
+bool clos_load_solver_memory(clos_ctx *clos, const char *path) {
+  return load_solver_memory(clos, path);
+}
+
+bool clos_save_solver_memory(clos_ctx *clos, const char *path) {
+  return save_solver_memory(clos, path);
+}
+
+int clos_load_prefix_cache(clos_ctx *clos, const char *path) {
+  return clos->prefix_cache_cap > 0 && load_prefix_cache(clos, path) ? clos->prefix_cache_count : -1;
+}
+
+bool clos_save_prefix_cache(clos_ctx *clos, const char *path) {
+  return clos->prefix_cache_cap > 0 && save_prefix_cache(clos, path);
+}
+
+clos_snapshot *clos_snapshot_take(const clos_ctx *clos) {
+  clos_snapshot *snap = calloc(1, sizeof(clos_snapshot));
+  if (!snap) return NULL;
+
+  size_t ports = (size_t)MAX_PORTS + 1;
+  size_t trunks = (size_t)N * (size_t)TOTAL_BLOCKS;
+  snap->size = N;
+  snap->ports = MAX_PORTS;
+  snap->desired_owner = malloc(sizeof(int) * ports);
+  snap->s3_port_owner = malloc(sizeof(int) * ports);
+  snap->s3_port_spine = malloc(sizeof(int) * ports);
+  snap->s1_to_s2 = malloc(sizeof(int) * trunks);
+  snap->s2_to_s3 = malloc(sizeof(int) * trunks);
+  if (!snap->desired_owner || !snap->s3_port_owner || !snap->s3_port_spine || !snap->s1_to_s2 || !snap->s2_to_s3) {
+    clos_snapshot_free(snap);
+    return NULL;
+  }
+
+  memcpy(snap->desired_owner, clos->desired_owner, sizeof(int) * ports);
+  memcpy(snap->s3_port_owner, clos->s3_port_owner, sizeof(int) * ports);
+  memcpy(snap->s3_port_spine, clos->s3_port_spine, sizeof(int) * ports);
+  memcpy(snap->s1_to_s2, clos->s1_to_s2_storage, sizeof(int) * trunks);
+  memcpy(snap->s2_to_s3, clos->s2_to_s3_storage, sizeof(int) * trunks);
+  snap->repacks = clos->repack_count;
+  snap->failed_commands = clos->failed_commands;
+  snap->last_reroutes = clos->last_stability_cost;
+  snap->cumulative_reroutes = clos->cumulative_reroutes;
+  snap->cumulative_output_reroutes = clos->cumulative_output_reroutes;
+  snap->last_solve_us = clos->last_solve_us;
+  snap->total_solve_us = clos->total_solve_us;
+  return snap;
+}
+
+void clos_snapshot_free(clos_snapshot *snap) {
+  if (!snap) return;
+  free(snap->desired_owner);
+  free(snap->s3_port_owner);
+  free(snap->s3_port_spine);
+  free(snap->s1_to_s2);
+  free(snap->s2_to_s3);
+  free(snap);
+}
+
+bool clos_write_json(clos_ctx *clos, const char *path) {
+  return write_state_json(clos, path);
+}
+
+void clos_write_json_stream(clos_ctx *clos, FILE *f) {
+  write_state_json_stream(clos, f);
+}
+
+void clos_print_report(clos_ctx *clos) {
+  print_heatmap(clos);
+  print_port_map_summary(clos);
+  print_fabric_summary(clos);
+}
@@ -0,0 +1,138 @@
+// libclos.h
+//
+// Library interface to the Clos mult router (see libclos.c for the model and the solver).
+//
+// A clos_ctx holds one fabric: its desired state, the realized trunks and ports, locks, solver
+// scratch, caches and metrics. Nothing is shared between contexts, so a process can hold several
+// fabrics and solve them on different threads; a single context must not be used from two
+// threads at once. clos_mult_router.c is the command-line front end over this API.
+//
+// Every command is solved and committed at once: a rejected route or clear leaves the fabric as
+// it was. Solver progress and diagnostics are written to the context's log (options.out).
+
+#ifndef LIBCLOS_H
+#define LIBCLOS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct clos_ctx clos_ctx;
+
+// Engine for the optimality search after the greedy seed and conflict kernel (--search)
+typedef enum {
+  CLOS_SEARCH_DFS,  // depth-first, deepening the reroute limit (default)
+  CLOS_SEARCH_LDS,  // limited discrepancy search
+  CLOS_SEARCH_SAT   // embedded CDCL solver with cardinality tightening
+} clos_search;
+
+// Search progress, reported every few seconds while one solve runs long (the log's PROGRESS line)
+typedef struct {
+  long long attempts;            // search nodes since the previous report
+  long elapsed_ms;               // since the previous report
+  int depth;                     // demands assigned on the current path
+  int num_demands;
+  int best_cost;                 // reroutes of the incumbent (999999 = none yet)
+} clos_progress;
+
+typedef void (*clos_progress_fn)(void *user, const clos_progress *progress);
+
+// A pinned (input, egress block) demand, as in a --locks file
+typedef struct {
+  int input_id;
+  int egress_block;              // 0-based
+  int spine;                     // 0-based
+} clos_lock;
+
+// Solver settings, fixed for the life of a context. clos_options_init() fills in the defaults;
+// the comments name the matching command-line flag.
+typedef struct {
+  int size;                      // N for C(N,N,N), >= 2 (--size, default 10)
+  FILE *out;                     // solver log (default stdout)
+  clos_progress_fn progress;     // optional; called on the solving thread
+  void *progress_user;
+  bool strict_stability;         // --strict-stability
+  int max_reroutes;              // --max-reroutes K (-1 = unlimited)
+  bool output_weighted;          // --output-weighted
+  bool min_branches;             // --min-branches
+  int defrag_reroutes;           // --defrag K (-1 off; K >= 0 implies min_branches)
+  long long branch_budget;       // --branch-budget (default 20000)
+  clos_search search;            // --search
+  int lns_budget_ms;             // --lns-budget MS (0 off)
+  bool learn;                    // --learn: keep conflict scores between commands
+  bool plan;                     // --plan: clos_run_file() solves the file as one session
+  bool incremental;              // --incremental
+  bool paranoid;                 // --paranoid
+  int solution_cache_size;       // --solution-cache-size (default 64, 0 disables)
+  bool prefix_cache;             // --prefix-cache: clos_run_file() restores cached command prefixes
+  int prefix_cache_size;         // --prefix-cache-size (default 64, 0 disables)
+} clos_options;
+
+// A copy of the fabric and its counters, owned by the caller (clos_snapshot_free)
+typedef struct {
+  int size;                      // N
+  int ports;                     // N^2; the port arrays below have ports + 1 entries, [0] unused
+  int *desired_owner;            // output port -> input_id the commands asked for (0 = none)
+  int *s3_port_owner;            // output port -> input_id it is connected to (0 = none)
+  int *s3_port_spine;            // output port -> spine (0..N-1), -1 if disconnected
+  int *s1_to_s2;                 // [ingress block * N + spine] -> input_id owning the trunk (0 free)
+  int *s2_to_s3;                 // [spine * N + egress block] -> input_id owning the trunk (0 free)
+  int repacks;                   // successful solves
+  int failed_commands;           // rejected routes and clears
+  int last_reroutes;             // demands the last solve moved off their previous spine
+  int cumulative_reroutes;
+  int cumulative_output_reroutes;
+  long long last_solve_us;
+  long long total_solve_us;
+} clos_snapshot;
+
+void clos_options_init(clos_options *opts);
+
+// NULL on an invalid size or out of memory
+clos_ctx *clos_create(const clos_options *opts);
+void clos_free(clos_ctx *clos);
+void clos_set_log(clos_ctx *clos, FILE *out);  // redirect the solver log (NULL = stdout)
+
+// Stability anchor: solves prefer the spines of the previous state. A state JSON file
+// (--previous-state), or the fabric as it is now.
+bool clos_load_previous_state(clos_ctx *clos, const char *path);
+bool clos_load_previous_state_json(clos_ctx *clos, const char *json);  // the state JSON as a string
+void clos_anchor_previous_state(clos_ctx *clos);
+
+// Replace the locks. Out-of-range or contradictory locks are dropped and reported in the
+// state JSON's lock_conflicts.
+bool clos_load_locks(clos_ctx *clos, const char *path);
+bool clos_set_locks(clos_ctx *clos, const clos_lock *locks, int num_locks);
+
+// Commands. Each solves at once and returns false if it was rejected (the fabric is unchanged).
+bool clos_apply_route(clos_ctx *clos, int input_id, const int *outputs, int num_outputs);
+bool clos_apply_clear(clos_ctx *clos, int input_id);
+bool clos_apply_command(clos_ctx *clos, const char *line);  // one routes-file line
+bool clos_apply_scene(clos_ctx *clos, const char *path);    // --scene; replaces every route
+bool clos_solve(clos_ctx *clos);                            // repack the current desired state
+
+// Demands the route would reroute on the current fabric, or -1 if it does not fit. Nothing is
+// committed; the search is node-capped like the alternatives offered for a rejected route.
+int clos_what_if_route(clos_ctx *clos, int input_id, const int *outputs, int num_outputs);
+
+// A routes file, line by line (or planned, or from the prefix cache, per the options; the prefix
+// cache is only used while the context holds no routes).
+// Returns false if the file could not be read.
+bool clos_run_file(clos_ctx *clos, const char *path);
+
+// Caches carried between runs (--solution-cache, --learn, --prefix-cache). A missing or stale
+// file just leaves the cache empty; the cache loaders return the entries loaded, or -1.
+int clos_load_solution_cache(clos_ctx *clos, const char *path);
+bool clos_save_solution_cache(clos_ctx *clos, const char *path);
+bool clos_load_solver_memory(clos_ctx *clos, const char *path);
+bool clos_save_solver_memory(clos_ctx *clos, const char *path);
+int clos_load_prefix_cache(clos_ctx *clos, const char *path);
+bool clos_save_prefix_cache(clos_ctx *clos, const char *path);
+
+// Results
+clos_snapshot *clos_snapshot_take(const clos_ctx *clos);
+void clos_snapshot_free(clos_snapshot *snap);
+bool clos_write_json(clos_ctx *clos, const char *path);  // the state JSON the viz server reads
+void clos_write_json_stream(clos_ctx *clos, FILE *f);
+void clos_print_report(clos_ctx *clos);                  // heatmap, port map and fabric summary
+
+#endif
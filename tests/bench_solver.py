@@ -42,7 +42,7 @@ BIN = ROOT / ".context" / "clos_mult_router_bench"
 def build_binary() -> None:
     (ROOT / ".context").mkdir(exist_ok=True)
     subprocess.run(
-        ["cc", "-O2", "-std=c11", "clos_mult_router.c", "-o", str(BIN)],
+        ["cc", "-O2", "-std=c11", "libclos.c", "clos_mult_router.c", "-o", str(BIN)],
         check=True,
         cwd=ROOT,
     )
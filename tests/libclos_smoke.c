@@ -0,0 +1,55 @@
+// Smoke test of the libclos API; built and run by solver_state_test.py
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libclos.h"
+
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                               \
+    }                                                                        \
+  } while (0)
+
+int main(void) {
+  clos_options opts;
+  clos_options_init(&opts);
+  opts.size = 4;
+  opts.out = fopen("/dev/null", "w");
+  CHECK(opts.out != NULL);
+
+  clos_ctx *clos = clos_create(&opts);
+  CHECK(clos != NULL);
+
+  int outputs[] = {2, 7, 16};
+  CHECK(clos_apply_route(clos, 5, outputs, 3));
+  CHECK(!clos_apply_route(clos, 17, outputs, 3));  // no input 17 on a 16-port fabric
+
+  clos_snapshot *snap = clos_snapshot_take(clos);
+  CHECK(snap != NULL);
+  CHECK(snap->size == 4 && snap->ports == 16);
+  for (int i = 0; i < 3; i++) {
+    int p = outputs[i];
+    int spine = snap->s3_port_spine[p];
+    int egress = (p - 1) / 4;
+    CHECK(snap->desired_owner[p] == 5 && snap->s3_port_owner[p] == 5);
+    CHECK(spine >= 0 && spine < 4);
+    CHECK(snap->s2_to_s3[spine * 4 + egress] == 5);
+    CHECK(snap->s1_to_s2[((5 - 1) / 4) * 4 + spine] == 5);
+  }
+  CHECK(snap->desired_owner[1] == 0 && snap->s3_port_spine[1] == -1);
+  CHECK(snap->repacks == 1 && snap->failed_commands == 1);
+  clos_snapshot_free(snap);
+
+  CHECK(clos_apply_clear(clos, 5));
+  snap = clos_snapshot_take(clos);
+  CHECK(snap != NULL);
+  for (int p = 1; p <= snap->ports; p++) CHECK(snap->s3_port_owner[p] == 0);
+  clos_snapshot_free(snap);
+
+  clos_free(clos);
+  fclose(opts.out);
+  printf("libclos smoke OK\n");
+  return 0;
+}
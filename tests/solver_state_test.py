@@ -1,12 +1,15 @@
 #!/usr/bin/env python3
 import hashlib
 import json
+import random
+import re
 import subprocess
 import sys
 from pathlib import Path
 
 ROOT = Path(__file__).resolve().parents[1]
 BIN = ROOT / ".context" / "clos_mult_router_test"
+SMOKE_BIN = ROOT / ".context" / "libclos_smoke_test"
 
 STATE_KEYS = [
     "s1_to_s2",
@@ -21,11 +24,68 @@ CASES = [
     ("test_100.txt", "91820cb1130d2098673f1474b9909bd5f3e4b495df03036d7bca38af787297e5"),
 ]
 
+# (input, egress block, spine), 0-based like the locks file; both differ from the unlocked state
+PLAN_LOCKS = [(1, 0, 3), (12, 1, 0)]
+PLAN_HASH = "5edb8695e4b0ca406940eb41aad31595975a00c6a1006116cbcd158fc63b42e9"
+
+# N=3: the stability-optimal solve spreads input 5 over two spines; one spine is enough
+BRANCHY_ROUTES = ["9.5", "2.7.6", "5.8"]
+
+# N=3: input 8 forces one of input 1's demands off its previous spine; the one-output demand
+# (egress 2, port 5) is the lighter move than the two-output one (egress 3, ports 7 and 9)
+WEIGHTED_ROUTES = ["9.6", "1.5.9.7", "8.8", "7.4"]
+WEIGHTED_SPINES = {5: 0, 6: 1, 7: 0, 9: 0}
+
+# N=3: locks give inputs 1 and 2 all three spines of ingress block 1, so input 3 (same block) has none
+SQUEEZED_ROUTES = ["1.1.4", "2.2", "3.7"]
+SQUEEZED_LOCKS = [(1, 0, 0), (1, 1, 1), (2, 0, 2)]
+
+# Same locks, with input 1's port 1 previously on spine 2 (0-based 1): its lock forces one reroute
+PINNED_ROUTES = ["1.1.4", "2.2", "5.8"]
+PINNED_SPINES = {1: 1}
+
+# N=4: input 16 previously sat on spine 3 (0-based 2). Greedy moves it to fit input 8; the
+# conflict kernel pins the uncontested demands and finds a placement that moves nothing.
+KERNEL_ROUTES = ["16.9.15.5", "4.1.16", "1.3.12", "8.6.2"]
+KERNEL_SPINES = {5: 2, 9: 2, 15: 2}
+
+# N=3: the last route costs two reroutes against this previous state, and no placement costs fewer
+DEEPENING_ROUTES = ["8.5", "5.3", "2.8.2", "4.1", "6.7", "5.6"]
+DEEPENING_SPINES = {2: 0, 3: 1, 5: 1, 8: 0}
+
+# N=3: the greedy seed reroutes two demands for the last route where one is enough
+LNS_ROUTES = ["5.3", "2.8.2", "4.1", "6.7"]
+LNS_SPINES = {2: 0, 3: 1, 8: 0}
+
+# N=3 incremental session: input 1 lands on spine 2 (0-based 1) and keeps it for egress 3; input 8
+# then has every spine free and should join spine 2, which carries the most trunks
+PACKED_ROUTES = ["4.1", "1.2", "1.7", "8.5"]
+
+# N=4: the greedy seed dead-ends on the last route; min-conflicts repair finds a free placement
+DEAD_END_ROUTES = ["14.6", "13.1", "1.2", "16.9", "15.4", "2.16", "13.13"]
+
+# N=4: the last route cannot be realized next to the others
+REJECTED_ROUTES = ["4.13.8.3", "1.11.6", "2.14", "9.2", "1.9.16.4", "10.15.7.1", "11.10.5.12"]
+
+# N=3: inputs 1 and 4 are locked onto the same Stage2 trunk, so 1.2 is rejected after 4.1
+LOCKED_ROUTES = ["4.1", "1.2"]
+ALTERNATIVE_LOCKS = [(1, 0, 0), (4, 0, 0)]
+
+# N=3 previous state with input 1 split over spines 1 and 2 (0-based 0 and 1), 3 branches. The
+# cheapest merge moves its two-output demand; input 4 holds spine 1 for the one-output one.
+FRAGMENTED_ROUTES = ["1.1.4.5", "4.2"]
+FRAGMENTED_SPINES = {1: 0, 2: 1, 4: 1, 5: 1}
+
 
 def build_binary() -> None:
     (ROOT / ".context").mkdir(exist_ok=True)
     subprocess.run(
-        ["cc", "-O2", "-std=c11", "clos_mult_router.c", "-o", str(BIN)],
+        ["cc", "-O2", "-std=c11", "libclos.c", "clos_mult_router.c", "-o", str(BIN)],
+        check=True,
+        cwd=ROOT,
+    )
+    subprocess.run(
+        ["cc", "-O2", "-std=c11", "-I.", "tests/libclos_smoke.c", "libclos.c", "-o", str(SMOKE_BIN)],
         check=True,
         cwd=ROOT,
     )
@@ -39,10 +99,42 @@ def hash_state(json_path: Path) -> str:
     return hashlib.sha256(blob.encode()).hexdigest()
 
 
-def run_case(routes_file: str, expected_hash: str) -> None:
+def run_routes(name: str, lines: list[str], *args: str) -> tuple[str, dict]:
+    """Runs the router on the given route lines; returns its log and state JSON."""
+    routes_path = ROOT / ".context" / f"{name}.txt"
+    out_path = ROOT / ".context" / f"{name}.json"
+    routes_path.write_text("\n".join(lines) + "\n")
+    result = subprocess.run(
+        [str(BIN), str(routes_path), "--json", str(out_path), *args],
+        check=True,
+        cwd=ROOT,
+        capture_output=True,
+        text=True,
+    )
+    return result.stdout, json.loads(out_path.read_text())
+
+
+def write_locks(name: str, locks: list[tuple[int, int, int]]) -> Path:
+    locks_path = ROOT / ".context" / f"{name}_locks.json"
+    locks_path.write_text(json.dumps([{"input": i, "egressBlock": e, "spine": s} for i, e, s in locks]))
+    return locks_path
+
+
+def write_previous_state(name: str, size: int, port_spines: dict[int, int]) -> Path:
+    """Writes a previous-state file holding only the given 0-based port spines."""
+    prev_path = ROOT / ".context" / f"{name}_prev.json"
+    spines = [-1] * (size * size + 1)
+    for port, spine in port_spines.items():
+        spines[port] = spine
+    prev_path.write_text(json.dumps({"s3_port_spine": spines}))
+    return prev_path
+
+
+def run_case(routes_file: str, expected_hash: str, search: str = "dfs") -> None:
+    """Every search engine must reach the same state."""
     out_path = ROOT / ".context" / f"{Path(routes_file).stem}.json"
     subprocess.run(
-        [str(BIN), str(ROOT / routes_file), "--json", str(out_path)],
+        [str(BIN), str(ROOT / routes_file), "--json", str(out_path), "--search", search],
         check=True,
         cwd=ROOT,
         stdout=subprocess.DEVNULL,
@@ -50,14 +142,430 @@ def run_case(routes_file: str, expected_hash: str) -> None:
     actual = hash_state(out_path)
     if actual != expected_hash:
         raise AssertionError(
-            f"State hash mismatch for {routes_file}: expected {expected_hash}, got {actual}"
+            f"State hash mismatch for {routes_file} (--search {search}): "
+            f"expected {expected_hash}, got {actual}"
         )
 
 
+def run_cache_case(routes_file: str, expected_hash: str) -> None:
+    """A second run against a persisted solution cache must hit and reproduce the same state."""
+    cache_path = ROOT / ".context" / f"{Path(routes_file).stem}.cache"
+    out_path = ROOT / ".context" / f"{Path(routes_file).stem}.cached.json"
+    cache_path.unlink(missing_ok=True)
+    for _ in range(2):
+        subprocess.run(
+            [
+                str(BIN), str(ROOT / routes_file), "--json", str(out_path),
+                "--solution-cache", str(cache_path), "--solution-cache-size", "256",
+            ],
+            check=True,
+            cwd=ROOT,
+            stdout=subprocess.DEVNULL,
+        )
+    actual = hash_state(out_path)
+    if actual != expected_hash:
+        raise AssertionError(
+            f"Cached state hash mismatch for {routes_file}: expected {expected_hash}, got {actual}"
+        )
+    hits = json.loads(out_path.read_text()).get("cache_hits", 0)
+    if hits <= 0:
+        raise AssertionError(f"Expected solution cache hits for {routes_file}, got {hits}")
+
+
+def run_prefix_cache_case(routes_file: str, expected_hash: str) -> None:
+    """A second run restores every command from the prefix cache and must reproduce the same state."""
+    cache_path = ROOT / ".context" / f"{Path(routes_file).stem}.prefixes"
+    out_path = ROOT / ".context" / f"{Path(routes_file).stem}.prefixed.json"
+    cache_path.unlink(missing_ok=True)
+    for _ in range(2):
+        result = subprocess.run(
+            [str(BIN), str(ROOT / routes_file), "--json", str(out_path), "--prefix-cache", str(cache_path)],
+            check=True,
+            cwd=ROOT,
+            capture_output=True,
+            text=True,
+        )
+    actual = hash_state(out_path)
+    if actual != expected_hash:
+        raise AssertionError(
+            f"Prefix-cached state hash mismatch for {routes_file}: expected {expected_hash}, got {actual}"
+        )
+    if "PREFIX CACHE: restored" not in result.stdout:
+        raise AssertionError(f"Expected a prefix cache restore for {routes_file}")
+
+
+def run_scene_case(routes_file: str, expected_hash: str) -> None:
+    """Recalling a saved state as a scene into an empty fabric must reproduce it."""
+    scene_path = ROOT / ".context" / f"{Path(routes_file).stem}.json"
+    out_path = ROOT / ".context" / f"{Path(routes_file).stem}.scene.json"
+    subprocess.run(
+        [str(BIN), "--scene", str(scene_path), "--json", str(out_path)],
+        check=True,
+        cwd=ROOT,
+        stdout=subprocess.DEVNULL,
+    )
+    actual = hash_state(out_path)
+    if actual != expected_hash:
+        raise AssertionError(
+            f"Scene state hash mismatch for {routes_file}: expected {expected_hash}, got {actual}"
+        )
+
+
+def run_plan_locks_case() -> None:
+    """--plan with locks must honor them and settle on the same state."""
+    locks_path = write_locks("plan", PLAN_LOCKS)
+    out_path = ROOT / ".context" / "test_100.plan.json"
+    subprocess.run(
+        [str(BIN), str(ROOT / "test_100.txt"), "--json", str(out_path), "--plan", "--locks", str(locks_path)],
+        check=True,
+        cwd=ROOT,
+        stdout=subprocess.DEVNULL,
+    )
+    data = json.loads(out_path.read_text())
+    for in_id, egress, spine in PLAN_LOCKS:
+        if data["s2_to_s3"][spine][egress] != in_id:
+            raise AssertionError(f"Lock ({in_id}, {egress}, {spine}) not honored under --plan")
+    actual = hash_state(out_path)
+    if actual != PLAN_HASH:
+        raise AssertionError(f"Planned state hash mismatch: expected {PLAN_HASH}, got {actual}")
+
+
+def run_min_branches_case() -> None:
+    """--min-branches lowers branches without rerouting, and comma-separated routes on one line all apply."""
+    _, plain = run_routes("branchy", BRANCHY_ROUTES, "--size", "3")
+    _, packed = run_routes("branchy_min", BRANCHY_ROUTES, "--size", "3", "--min-branches")
+    if packed["total_branches"] >= plain["total_branches"]:
+        raise AssertionError(f"--min-branches kept {packed['total_branches']} of {plain['total_branches']} branches")
+    if packed["reroutes_demands"] != plain["reroutes_demands"]:
+        raise AssertionError("--min-branches traded reroutes for branches")
+
+    _, one_line = run_routes("branchy_one_line", [", ".join(BRANCHY_ROUTES)], "--size", "3", "--min-branches")
+    if one_line["routes_active"] != 4 or one_line["repack_count"] != len(BRANCHY_ROUTES):
+        raise AssertionError(f"One-line routes: {one_line['routes_active']} active, {one_line['repack_count']} repacks")
+    if one_line["desired_owner"] != packed["desired_owner"]:
+        raise AssertionError("One-line routes reached a different desired state")
+
+
+def run_output_weighted_case() -> None:
+    """--output-weighted reroutes the demand with fewer outputs when one must move."""
+    prev_path = write_previous_state("weighted", 3, WEIGHTED_SPINES)
+    args = ("--size", "3", "--previous-state", str(prev_path))
+    _, plain = run_routes("weighted_plain", WEIGHTED_ROUTES, *args)
+    _, weighted = run_routes("weighted", WEIGHTED_ROUTES, *args, "--output-weighted")
+    if plain["reroutes_demands"] != 1 or weighted["reroutes_demands"] != 1:
+        raise AssertionError(f"Expected one demand rerouted, got {plain['reroutes_demands']} and {weighted['reroutes_demands']}")
+    if weighted["reroutes_outputs"] != 1 or plain["reroutes_outputs"] != 2:
+        raise AssertionError(f"Rerouted outputs: {plain['reroutes_outputs']} plain, {weighted['reroutes_outputs']} weighted")
+    if weighted["reroute_cost"] != weighted["reroutes_outputs"]:
+        raise AssertionError(f"Weighted cost {weighted['reroute_cost']} is not the outputs moved")
+
+
+def run_matching_precheck_case() -> None:
+    """A lock-squeezed route is rejected by the matching pre-check without any search nodes."""
+    locks_path = write_locks("squeezed", SQUEEZED_LOCKS)
+    log, data = run_routes("squeezed", SQUEEZED_ROUTES, "--size", "3", "--locks", str(locks_path))
+    if "(matching pre-check)" not in log or "Input 3 has no usable spine" not in log:
+        raise AssertionError("Expected the matching pre-check to reject input 3")
+    if ", 0 nodes," not in log:
+        raise AssertionError("The pre-check rejection still searched")
+    if data["desired_owner"][7] != 0 or data["routes_active"] != 3:
+        raise AssertionError("The rejected route was not rolled back")
+
+
+def run_pinned_locks_case() -> None:
+    """Locked demands are pinned before the search, and the reroutes they force count against the budget."""
+    locks_path = write_locks("pinned", SQUEEZED_LOCKS)
+    prev_path = write_previous_state("pinned", 3, PINNED_SPINES)
+    args = ("--size", "3", "--locks", str(locks_path), "--previous-state", str(prev_path))
+    _, data = run_routes("pinned", PINNED_ROUTES, *args)
+    for in_id, egress, spine in SQUEEZED_LOCKS:
+        if data["s2_to_s3"][spine][egress] != in_id:
+            raise AssertionError(f"Lock ({in_id}, {egress}, {spine}) not honored")
+    if data["locked_demands"] != 3 or data["reroutes_demands"] != 1:
+        raise AssertionError(f"{data['locked_demands']} locked, {data['reroutes_demands']} rerouted; expected 3 and 1")
+
+    log, data = run_routes("pinned_budget", PINNED_ROUTES, *args, "--max-reroutes", "0")
+    if "FAIL: No solution within --max-reroutes 0" not in log or data["desired_owner"][1] != 0:
+        raise AssertionError("A lock-forced reroute slipped past --max-reroutes 0")
+
+
+def random_commands(size: int, count: int, seed: int) -> list[str]:
+    """Seeded mix of multicast routes onto free ports and clears of routed inputs."""
+    rng = random.Random(seed)
+    ports = size * size
+    owner: dict[int, int] = {}
+    lines = []
+    for _ in range(count):
+        if owner and rng.random() < 0.2:
+            in_id = rng.choice(sorted(set(owner.values())))
+            owner = {p: o for p, o in owner.items() if o != in_id}
+            lines.append(f"!{in_id}")
+            continue
+        free = [p for p in range(1, ports + 1) if p not in owner]
+        if not free:
+            continue
+        in_id = rng.randint(1, ports)
+        targets = rng.sample(free, rng.randint(1, min(4, len(free))))
+        owner.update({p: in_id for p in targets})  # the router may reject it; the recount does not care
+        lines.append(".".join(str(x) for x in [in_id, *targets]))
+    return lines
+
+
+def recount_stats(data: dict, prev_spines: list[int]) -> dict:
+    """Fabric statistics recounted from the state arrays, as a full pass would."""
+    size = data["N"]
+    owners, spines = data["s3_port_owner"], data["s3_port_spine"]
+    trunks = [(s, e, data["s2_to_s3"][s][e]) for s in range(size) for e in range(size) if data["s2_to_s3"][s][e]]
+    egress_load = [sum(1 for _, e, _ in trunks if e == egress) for egress in range(size)]
+    input_spines: dict[int, set[int]] = {}
+    for s, _, in_id in trunks:
+        input_spines.setdefault(in_id, set()).add(s)
+    routed = [p for p in range(1, len(owners)) if owners[p] > 0 and spines[p] >= 0]
+    outputs: dict[int, int] = {}
+    for p in routed:
+        outputs[owners[p]] = outputs.get(owners[p], 0) + 1
+    return {
+        "routes_active": len(routed),
+        "routes_preserved": sum(1 for p in routed if prev_spines[p] == spines[p]),
+        "routes_new": sum(1 for p in routed if prev_spines[p] < 0),
+        "routes_removed": sum(1 for p in range(1, len(owners)) if prev_spines[p] >= 0 and spines[p] < 0),
+        "inputs_with_mult": sum(1 for n in outputs.values() if n >= 2),
+        "inputs_multi_spine": sum(1 for used in input_spines.values() if len(used) >= 2),
+        "egress_with_mult": sum(1 for load in egress_load if load >= 2),
+        "max_egress_load": max(egress_load),
+        "active_spines": len({s for s, _, _ in trunks}),
+        "total_branches": sum(len(used) for used in input_spines.values()),
+    }
+
+
+def run_live_stats_case() -> None:
+    """Incrementally maintained statistics match a recount after random routes and clears."""
+    _, previous = run_routes("live_stats_prev", random_commands(4, 30, 7), "--size", "4")
+    prev_path = ROOT / ".context" / "live_stats_prev.json"
+    commands = random_commands(4, 80, 11)
+    for count in (20, 50, 80):
+        _, data = run_routes("live_stats", commands[:count], "--size", "4", "--previous-state", str(prev_path))
+        expected = recount_stats(data, previous["s3_port_spine"])
+        actual = {key: data[key] for key in expected}
+        if actual != expected:
+            raise AssertionError(f"Live stats after {count} commands: expected {expected}, got {actual}")
+
+
+def run_paranoid_case() -> None:
+    """Full validation after every commit agrees with the touched-only checks across a full-check interval."""
+    commands = random_commands(4, 200, 5)
+    for mode in ((), ("--incremental",)):
+        log, data = run_routes("validated", commands, "--size", "4", *mode)
+        paranoid_log, paranoid = run_routes("validated_paranoid", commands, "--size", "4", *mode, "--paranoid")
+        if "FATAL" in log or "FATAL" in paranoid_log:
+            raise AssertionError(f"Fabric validation failed {mode}")
+        if paranoid["repack_count"] + paranoid["repair_count"] < 64:
+            raise AssertionError("Fixture too short to reach a periodic full check")
+        if any(paranoid[key] != data[key] for key in STATE_KEYS):
+            raise AssertionError(f"--paranoid changed the routed state {mode}")
+
+
+def run_conflict_kernel_case() -> None:
+    """The conflict kernel pins uncontested demands and improves on the greedy reroutes."""
+    prev_path = write_previous_state("kernel", 4, KERNEL_SPINES)
+    log, data = run_routes("kernel", KERNEL_ROUTES, "--size", "4", "--previous-state", str(prev_path))
+    if not re.search(r"KERNEL: [1-9]\d* demand\(s\) pinned, \d+ searched, cost 0", log):
+        raise AssertionError("Expected the conflict kernel to pin demands and reach cost 0")
+    if data["reroutes_demands"] != 0 or any(data["s3_port_spine"][p] != 2 for p in KERNEL_SPINES):
+        raise AssertionError(f"Input 16 was rerouted: {data['reroutes_demands']} demand(s)")
+
+
+def run_reroute_budget_case() -> None:
+    """--max-reroutes 0 rejects the route that needs a reroute and leaves the fabric as it was."""
+    prev_path = write_previous_state("weighted", 3, WEIGHTED_SPINES)
+    args = ("--size", "3", "--previous-state", str(prev_path))
+    _, before = run_routes("budget_before", WEIGHTED_ROUTES[:-1], *args, "--max-reroutes", "0")
+    log, data = run_routes("budget_zero", WEIGHTED_ROUTES, *args, "--max-reroutes", "0")
+    if "FAIL: No solution within --max-reroutes 0" not in log.split(">> ")[-1]:
+        raise AssertionError("Expected the last route to exceed --max-reroutes 0")
+    if any(data[key] != before[key] for key in STATE_KEYS):
+        raise AssertionError("A route rejected by the reroute budget changed the fabric")
+
+    _, data = run_routes("budget_one", WEIGHTED_ROUTES, *args, "--max-reroutes", "1")
+    if data["desired_owner"][4] != 7 or data["reroutes_demands"] != 1:
+        raise AssertionError("--max-reroutes 1 should admit the route with one reroute")
+
+
+def run_deepening_case() -> None:
+    """Every engine reports the proven reroute optimum, and a budget one below it is infeasible."""
+    prev_path = write_previous_state("deepening", 3, DEEPENING_SPINES)
+    args = ("--size", "3", "--previous-state", str(prev_path))
+    for search in ("dfs", "lds", "sat"):
+        _, data = run_routes(f"deepening_{search}", DEEPENING_ROUTES, *args, "--search", search)
+        if data["reroutes_demands"] != 2:
+            raise AssertionError(f"--search {search} rerouted {data['reroutes_demands']} demands, optimum is 2")
+    log, data = run_routes("deepening_budget", DEEPENING_ROUTES, *args, "--max-reroutes", "1")
+    if "FAIL: No solution within --max-reroutes 1" not in log or data["desired_owner"][6] != 0:
+        raise AssertionError("A placement with one reroute should not exist")
+
+
+def run_local_search_case() -> None:
+    """When greedy dead-ends, local search supplies the placement and the exact search is skipped."""
+    log, data = run_routes("dead_end", DEAD_END_ROUTES, "--size", "4", "--paranoid")
+    last = log.split(">> ")[-1]
+    if not re.search(r"LOCAL SEARCH: conflict-free after \d+ move\(s\), cost 0", last) or "FAIL" in last:
+        raise AssertionError("Expected local search to place the last route")
+    if data["desired_owner"][13] != 13 or data["solve_nodes"] != 0:
+        raise AssertionError(f"Route not placed by local search alone ({data['solve_nodes']} search nodes)")
+
+
+def run_lns_case() -> None:
+    """--lns-budget improves the greedy incumbent to the exact search's optimum."""
+    prev_path = write_previous_state("lns", 3, LNS_SPINES)
+    args = ("--size", "3", "--previous-state", str(prev_path))
+    _, exact = run_routes("lns_exact", LNS_ROUTES, *args)
+    log, data = run_routes("lns", LNS_ROUTES, *args, "--lns-budget", "50")
+    if not re.search(r"LNS: cost 2 -> 1 in \d+ round\(s\), [1-9]\d* improvement\(s\)", log):
+        raise AssertionError("Expected LNS to improve the incumbent from 2 reroutes to 1")
+    if data["reroutes_demands"] != exact["reroutes_demands"]:
+        raise AssertionError(f"LNS settled on {data['reroutes_demands']} reroutes, exact search on {exact['reroutes_demands']}")
+
+
+def read_solver_memory(path: Path) -> tuple[str, dict[tuple[int, int], int]]:
+    header, *rows = path.read_text().splitlines()
+    scores = {}
+    for row in rows:
+        in_id, egress, score = map(int, row.split())
+        scores[(in_id, egress)] = score
+    return header, scores
+
+
+def run_learn_case() -> None:
+    """--learn scores survive the round trip through FILE and reorder the next run's search."""
+    memory_path = ROOT / ".context" / "learn_memory.txt"
+    memory_path.unlink(missing_ok=True)
+    prev_path = write_previous_state("deepening", 3, DEEPENING_SPINES)
+    args = ("--size", "3", "--previous-state", str(prev_path), "--learn", str(memory_path))
+    _, first = run_routes("learn_first", DEEPENING_ROUTES, *args)
+    header, scores = read_solver_memory(memory_path)
+    if header != f"clos-solver-memory 1 3 {len(scores)}" or not scores or any(v != 8 for v in scores.values()):
+        raise AssertionError(f"Unexpected solver memory after one run: {header} {scores}")
+
+    # A score for a demand that no longer exists is dropped on save
+    stale = (9, 0)
+    memory_path.write_text("\n".join([f"clos-solver-memory 1 3 {len(scores) + 1}"]
+                                      + [f"{i} {e} {v}" for (i, e), v in {**scores, stale: 40}.items()]) + "\n")
+    _, second = run_routes("learn_second", DEEPENING_ROUTES, *args)
+    _, next_scores = read_solver_memory(memory_path)
+    if next_scores != {key: 8 // 2 + 8 for key in scores}:  # halved on load, bumped by the same reroutes
+        raise AssertionError(f"Scores were not halved and bumped on reload: {next_scores}")
+    if second["reroutes_demands"] != first["reroutes_demands"]:
+        raise AssertionError("Learned scores changed the reroute optimum")
+    if second["solve_nodes_total"] == first["solve_nodes_total"] and second["s3_port_spine"] == first["s3_port_spine"]:
+        raise AssertionError("Learned scores did not change the search")
+
+
+def run_headroom_case() -> None:
+    """New placements pack onto busy spines, and the repair counters add up over a session."""
+    _, data = run_routes("packed", PACKED_ROUTES, "--size", "3", "--incremental")
+    spines = data["s3_port_spine"]
+    if spines[7] != spines[2] or spines[5] != spines[2] or spines[2] != 1:
+        raise AssertionError(f"New placements did not pack onto spine 2: {spines}")
+
+    log, data = run_routes("repair_rate", random_commands(4, 200, 5), "--size", "4", "--incremental")
+    attempts, failures = data["repair_attempts"], data["repair_failures"]
+    if attempts != log.count(">> ") or failures == 0:
+        raise AssertionError(f"Expected a repair attempt per command and some fallbacks, got {attempts}/{failures}")
+    if data["repair_count"] != attempts - failures or log.count("REPAIR OK") != data["repair_count"]:
+        raise AssertionError(f"{data['repair_count']} repairs do not match {attempts} attempts and {failures} failures")
+    if f"{attempts - failures}/{attempts} edits repaired in place" not in log:
+        raise AssertionError("Summary repair rate does not match the counters")
+
+
+def run_unsat_core_case() -> None:
+    """A rejected route reports its core, and the next command clears it."""
+    log, data = run_routes("unsat_core", REJECTED_ROUTES, "--size", "4")
+    if "UNSAT CORE:" not in log or data["unsat_core_input"] != 11:
+        raise AssertionError(f"Expected an unsat core for input 11, got {data['unsat_core_input']}")
+    if not any(entry["input"] == 11 for entry in data["unsat_core"]):
+        raise AssertionError(f"Unsat core misses the rejected route: {data['unsat_core']}")
+
+    _, data = run_routes("unsat_core_cleared", REJECTED_ROUTES + ["!9"], "--size", "4")
+    if data["unsat_core"] or data["unsat_core_input"] != 0:
+        raise AssertionError(f"Unsat core outlived its command: {data['unsat_core']}")
+
+
+def run_alternatives_case() -> None:
+    """A route rejected by its own lock gets idle siblings as alternatives; other rejections do not."""
+    locks_path = write_locks("alternative", ALTERNATIVE_LOCKS)
+    expected = [
+        {"input": 2, "targets": [2], "reroutes": 0},
+        {"input": 3, "targets": [2], "reroutes": 0},
+    ]
+    log, data = run_routes("alternatives", LOCKED_ROUTES, "--size", "3", "--locks", str(locks_path))
+    if "ALTERNATIVES: 2 of 2 candidate(s) fit" not in log or "    2.2 (reroutes 0)" not in log:
+        raise AssertionError("Expected siblings 2 and 3 as alternatives in the log")
+    if data["alternatives"] != expected:
+        raise AssertionError(f"Alternatives mismatch: expected {expected}, got {data['alternatives']}")
+
+    _, data = run_routes("alternatives_cleared", LOCKED_ROUTES + ["!4"], "--size", "3", "--locks", str(locks_path))
+    if data["alternatives"]:
+        raise AssertionError(f"Alternatives outlived their command: {data['alternatives']}")
+
+    # Without a lock in the way an idle sibling cannot fit where input 11 did not
+    log, data = run_routes("alternatives_unlocked", REJECTED_ROUTES, "--size", "4")
+    if "ALTERNATIVES" in log or data["alternatives"]:
+        raise AssertionError(f"Unexpected alternatives for an unlocked rejection: {data['alternatives']}")
+
+
+def run_defrag(name: str, *args: str) -> tuple[str, dict]:
+    prev_path = write_previous_state("fragmented", 3, FRAGMENTED_SPINES)
+    return run_routes(name, FRAGMENTED_ROUTES, "--size", "3", "--previous-state", str(prev_path), *args)
+
+
+def run_defrag_case() -> None:
+    """--defrag K lowers branches by moving at most K demands; --defrag 0 and --min-branches move none."""
+    for args in ((), ("--min-branches",), ("--defrag", "0")):
+        _, data = run_defrag("defrag_off", *args)
+        if data["total_branches"] != 3 or data["reroutes_demands"] != 0:
+            raise AssertionError(f"{args} rerouted to {data['total_branches']} branches")
+    log, data = run_defrag("defrag_1", "--defrag", "1")
+    if "DEFRAG: branches 3 -> 2" not in log or data["total_branches"] != 2 or data["reroutes_demands"] != 1:
+        raise AssertionError(f"--defrag 1: {data['total_branches']} branches, {data['reroutes_demands']} reroutes")
+
+
+def run_weighted_defrag_case() -> None:
+    """Under --output-weighted the --defrag budget counts outputs: moving two outputs needs K = 2."""
+    _, data = run_defrag("defrag_weighted_1", "--defrag", "1", "--output-weighted")
+    if data["total_branches"] != 3 or data["reroutes_demands"] != 0:
+        raise AssertionError(f"--defrag 1 moved a two-output demand: {data['total_branches']} branches")
+    _, data = run_defrag("defrag_weighted_2", "--defrag", "2", "--output-weighted")
+    if data["total_branches"] != 2 or data["reroute_cost"] != 2:
+        raise AssertionError(f"--defrag 2 did not merge: {data['total_branches']} branches, cost {data['reroute_cost']}")
+
+
 def main() -> int:
     build_binary()
     for routes_file, expected_hash in CASES:
-        run_case(routes_file, expected_hash)
+        for search in ("dfs", "lds", "sat"):
+            run_case(routes_file, expected_hash, search)
+        run_scene_case(routes_file, expected_hash)
+        run_cache_case(routes_file, expected_hash)
+        run_prefix_cache_case(routes_file, expected_hash)
+    run_plan_locks_case()
+    run_min_branches_case()
+    run_output_weighted_case()
+    run_matching_precheck_case()
+    run_pinned_locks_case()
+    run_live_stats_case()
+    run_paranoid_case()
+    run_conflict_kernel_case()
+    run_reroute_budget_case()
+    run_deepening_case()
+    run_local_search_case()
+    run_lns_case()
+    run_learn_case()
+    run_headroom_case()
+    run_unsat_core_case()
+    run_alternatives_case()
+    run_defrag_case()
+    run_weighted_defrag_case()
+    subprocess.run([str(SMOKE_BIN)], check=True, stdout=subprocess.DEVNULL)
     return 0
 
 